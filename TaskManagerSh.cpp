@@ -22,6 +22,8 @@
 //	  Note that a subtask may also get all of its params from the command line
 //		by using TM_BEGINSUB_P(Tmsh_paramP, shparam) instead of TM_BEGINSUB()
 //		and then using shparam->Argc and shparam->Argv[] to access the params.
+//		Print to shparam->Out rather than Serial, and > and >> on the command line
+//		will send the output to a file.
 //
 //	  Tested on ESP32 and Mega2560.  We do not recommend using 328-based systems
 //		due to memory limitations.
@@ -35,115 +37,917 @@
 #if defined(ARDUINO_ARCH_ESP8266) || defined(ARDUINO_ARCH_ESP32)
 #include <FS.h>
 #include <SPIFFS.h>
+#include <new>
 #endif
 
 #include  <TaskManagerSh.h>
 #include  "utils.h"
+#include  "tmshHeap.h"
+#include  "tmshTrace.h"
+#include  "tmshRedirect.h"
+#include  "tmshPipe.h"
+#include  "tmshRegex.h"
+#include  "tmshKv.h"
+#include  "tmshIo.h"
+#include  "tmshSync.h"
+#include  "tmshSort.h"
+#include  "tmshStall.h"
+#include  "tmshLog.h"
+#include  "tmshGlob.h"
 
-#if defined(ARDUINO_ARCH_AVR)
-#define SH_MAXCOMMANDS 16
-#define SH_MAXCOMMANDLEN 12
-#elif defined(ARDUINO_ARCH_ESP8266) || defined(ARDUINO_ARCH_ESP32)
-#define SH_MAXCOMMANDS  32
-#define SH_MAXCOMMANDLEN  16
+static_assert(TmshRamUse<TmshProfile>::total <= TmshProfile::ramBudget,
+  "TaskManagerSh profile is over its RAM budget");
+#if !defined(ARDUINO_ARCH_ESP8266) && !defined(ARDUINO_ARCH_ESP32)
+static_assert(!TmshProfile::fileBuiltins && !TmshProfile::editor && TmshProfile::traceEvents==0
+  && TmshProfile::kvMaxKeys==0 && TmshProfile::sortBuf==0 && !TmshProfile::stallLog,
+  "TaskManagerSh file builtins, ed, trace, kv, sort and the stall log need SPIFFS (ESP only)");
 #endif
+static_assert(TmshProfile::maxStages>=1 && TmshProfile::maxStages<=TMSH_MAX_STAGES,
+  "TaskManagerSh maxStages is out of range");
+static_assert(TmshProfile::maxParams<32, "TaskManagerSh maxParams is over 31");
+
+// User commands, in the order they were added.  Each node is allocated to fit its name.
 struct ShCommand {
-  int taskId;
-  char cmd[SH_MAXCOMMANDLEN+1];
+  ShCommand* next;
+  tm_taskId_t taskId;
+  char cmd[1];		// really strlen(name)+1
 };
 
-static ShCommand theCommands[SH_MAXCOMMANDS+1];
+static ShCommand* theCommands = NULL;
+static ShCommand** lastCommand = &theCommands;
 static int numCommands = 0;
+static long commandBytes = 0;
+int Tmsh_lastStatus = 0;
+
+// *** BUILTINS
+// Names and syntax lines are kept in flash (PROGMEM) so they cost no SRAM on AVR.
+// The table is in the same order as the enum.
+enum {
+  SH_BI_HELP, SH_BI_REBOOT, SH_BI_STATUS, SH_BI_MEM, SH_BI_HEAP, SH_BI_TRACE,
+  SH_BI_EVERY, SH_BI_AT, SH_BI_CANCEL, SH_BI_SCHED, SH_BI_BOOT, SH_BI_STALLS,
+  SH_BI_ED,		// ESP only from here on
+  SH_BI_APPENDTO, SH_BI_CAT, SH_BI_GREP, SH_BI_ECHOTO, SH_BI_CP, SH_BI_FORMAT, SH_BI_MV, SH_BI_LS, SH_BI_RM,
+  SH_BI_GET, SH_BI_PUT, SH_BI_REFLASH, SH_BI_RX, SH_BI_TX, SH_BI_KV, SH_BI_SYNC, SH_BI_SORT,
+  SH_BI_LOGCAT, SH_BI_LOGCLEAR,
+  SH_BI_NONE
+};
 
-static void shHelp() {
+struct ShBuiltin {
+  char name[10];
+  char syntax[40];
+};
+
+static const ShBuiltin shBuiltins[] PROGMEM = {
+  { "help",     "help" },
+  { "reboot",   "reboot" },
+  { "status",   "status" },
+  { "mem",      "mem" },
+  { "heap",     "heap [reset]" },
+  { "trace",    "trace start|stop|dump fn" },
+  { "every",    "every interval cmd args..." },
+  { "at",       "at delay cmd args..." },
+  { "cancel",   "cancel job" },
+  { "sched",    "sched" },
+  { "boot",     "boot" },
+  { "stalls",   "stalls [clear|ms]" },
+#if defined(ARDUINO_ARCH_ESP8266) || defined(ARDUINO_ARCH_ESP32)
+  { "ed",       "ed [-s script] [-e cmd]... [filename]" },
+  { "appendTo", "appendTo fn text text text..." },
+  { "cat",      "cat [-n] fn..." },
+  { "grep",     "grep [-v] [-c] pattern [fn]" },
+  { "echoTo",   "echoTo fn text text text..." },
+  { "cp",       "cp [-n] f... fdest" },
+  { "format",   "format" },
+  { "mv",       "mv fold fnew" },
+  { "ls",       "ls" },
+  { "rm",       "rm [-n] fil..." },
+  { "xget",     "get remotefn localfn" },
+  { "xput",     "put localfn remotefn" },
+  { "xreflash", "reflash fn" },
+  { "rx",       "rx fn" },
+  { "tx",       "tx fn" },
+  { "kv",       "kv [get k|set k v|del k|list|compact]" },
+  { "sync",     "sync [-d] manifest-url" },
+  { "sort",     "sort [-k field] [-n] [-u] in out" },
+  { "logcat",   "logcat file [-n lines]" },
+  { "logclear", "logclear file" },
+#endif
+};
+static const int shNumBuiltins = sizeof(shBuiltins)/sizeof(shBuiltins[0]);
+#if defined(ARDUINO_ARCH_ESP8266) || defined(ARDUINO_ARCH_ESP32)
+static_assert(sizeof(shBuiltins)/sizeof(shBuiltins[0])==SH_BI_NONE, "shBuiltins is out of step with its enum");
+#else
+static_assert(sizeof(shBuiltins)/sizeof(shBuiltins[0])==SH_BI_ED, "shBuiltins is out of step with its enum");
+#endif
+
+#define SH_FLASH(s) (reinterpret_cast<const __FlashStringHelper*>(s))
+
+static bool shBuiltinEnabled(int bi) {
+  if(bi==SH_BI_HEAP) return TmshProfile::heapStats;
+  if(bi==SH_BI_TRACE) return TmshProfile::traceEvents>0;
+  if(bi>=SH_BI_EVERY && bi<=SH_BI_SCHED) return TmshProfile::maxJobs>0;
+  if(bi==SH_BI_STALLS) return TmshProfile::stallMs>0;
+  if(bi==SH_BI_ED) return TmshProfile::editor;
+  if(bi==SH_BI_KV) return TmshProfile::fileBuiltins && TmshProfile::kvMaxKeys>0;
+  if(bi==SH_BI_SORT) return TmshProfile::fileBuiltins && TmshProfile::sortBuf>0;
+  if(bi>SH_BI_ED) return TmshProfile::fileBuiltins;
+  return true;
+}
+
+static bool shIsFileBuiltin(int bi) {
+  return bi>SH_BI_ED && bi<SH_BI_NONE;
+}
+
+static int shFindBuiltin(const char* name) {
+  int i;
+  for(i=0; i<shNumBuiltins; i++) {
+    if(strcmp_P(name, shBuiltins[i].name)==0) return shBuiltinEnabled(i) ? i : SH_BI_NONE;
+  }
+  return SH_BI_NONE;
+}
+
+static void shSyntax(int bi) {
+  Serial.print(F("Syntax: "));
+  Serial.println(SH_FLASH(shBuiltins[bi].syntax));
+}
+
+static void shHelp(Print& out) {
+  ShCommand* c;
   int i;
-  for(i=0; i<numCommands; i++) {
-    Serial.print("  "); Serial.println(theCommands[i].cmd);
+  for(c=theCommands; c!=NULL; c=c->next) {
+    out.print(F("  ")); out.println(c->cmd);
+  }
+  for(i=0; i<shNumBuiltins; i++) {
+    if(!shBuiltinEnabled(i)) continue;
+    out.print(F("  ")); out.println(SH_FLASH(shBuiltins[i].syntax));
   }
+}
+
+#if defined(ARDUINO_ARCH_ESP8266) || defined(ARDUINO_ARCH_ESP32)
+long Tmsh_edMemUse();		// from ed
+long Tmsh_regexMemUse();	// from tmshRegex
+#endif
+
+static void shMemLine(Print& out, const __FlashStringHelper* what, long bytes) {
+  out.print(F("  ")); out.print(what); out.println(bytes);
+}
+
+// *** MEM
+// The shell's SRAM by category, in bytes.  lineBytes is what the shell task's own
+// line buffer, tokens and param block are using.
+static void shMem(Print& out, long lineBytes) {
+  shMemLine(out, F("commands  "), commandBytes);
+  shMemLine(out, F("line+args "), lineBytes);
 #if defined(ARDUINO_ARCH_ESP8266) || defined(ARDUINO_ARCH_ESP32)
-  Serial.print("  appendTo fn text text text...\n  cat fn\n");
-  Serial.print("  echoTo fn text text text...\n  cp f f... fdest\n");
-  Serial.print("  ed [filename]\n  mv fold fnew\n");
-  Serial.print("  format\n  reboot\n");
-  Serial.print("  help\n  mv fold fnew\n");
-  Serial.print("  ls\n  rm fil fil...\n");
-  Serial.print("  get remotefn localfn\n  put localfn remotefn\n");
-  Serial.print("  reflash fn\n");
+  if(TmshProfile::editor) {
+    shMemLine(out, F("ed        "), Tmsh_edMemUse());
+    shMemLine(out, F("regex     "), Tmsh_regexMemUse());
+  }
+  if(TmshProfile::fileBuiltins && TmshProfile::kvMaxKeys>0) shMemLine(out, F("kv        "), Tmsh_kv.memUse());
+  if(Tmsh_ioStackLeft()>=0) shMemLine(out, F("io unused "), Tmsh_ioStackLeft());
 #endif
-  Serial.print("  reboot\n");
+  shMemLine(out, F("free      "), Tmsh_heapFree());
+  shMemLine(out, F("(flash)   "), sizeof(shBuiltins));
 }
 
 //static bool shellBindShCommand(char* cmdName, int cmdTask) {
 static void shellTask();
 static void shellAddSubtasks();
+static void schedTask();
+static void pipeStageTask();
+typedef void (*ShTaskFn)();
+static ShTaskFn shTimed(tm_taskId_t id, ShTaskFn fn);
 void Tmsh_edTask();
+void Tmsh_ed2Task();
 void Tmsh_readIntoPasteBufferTask(); // from ed
+void Tmsh_rxTask();		// from tmshXfer
+void Tmsh_txTask();
+
+// *** STARTUP
+// Times are ms after begin() was called.
+static struct {
+  unsigned long start;		// millis() when begin() was called
+  unsigned long begin;		// how long begin() took
+  unsigned long firstTask;	// when the shell task first ran
+  unsigned long fsReady;	// when the filesystem was ready (or given up on)
+  unsigned long mountMs;	// the mount, including any format
+  unsigned long kvMs;		// loading the kv store
+  bool ran;
+  bool formatted;
+} shBoot;
 
-void TaskManagerSh::begin() {
-	// Format SPIFFS file system if needed; open SPIFFS filesystem
 #if defined(ARDUINO_ARCH_ESP8266) || defined(ARDUINO_ARCH_ESP32)
+bool Tmsh_fsReady = false;
+static bool shFsMounting = false;	// until the mount task is done, whichever way it went
+
+static void shMountJob(void*) {
+  // Mount SPIFFS, formatting it if it won't mount, and load the kv store from it.
+  // An I/O job, as a format takes seconds.
+  unsigned long t;
+  t = millis();
   if(!SPIFFS.begin(false)) {
-    Serial.print("Need to format, formatting.\n");
+    Serial.print(F("Need to format, formatting.\n"));
     SPIFFS.format();
+    shBoot.formatted = true;
     if(!SPIFFS.begin(false)) {
-      Serial.print("Format failed, exiting.\n");
+      Serial.print(F("Format failed; no filesystem.\n"));
       return;
     }
-    Serial.print("...format succeeded.\n");
+    Serial.print(F("...format succeeded.\n"));
   }
+  recoverFiles(SPIFFS);	// replaceFile()s that a reset cut short
+  shBoot.mountMs = millis()-t;
+  Tmsh_fsReady = true;
+  if(TmshProfile::fileBuiltins && TmshProfile::kvMaxKeys>0) {
+    t = millis();
+    if(!Tmsh_kv.begin(SPIFFS)) Serial.print(F("Can't load the kv store.\n"));
+    shBoot.kvMs = millis()-t;
+  }
+}
+
+static void shMountTask() {
+  static Tmsh_ioJob job;
+  TM_BEGIN();
+  if(!shFsMounting) { TM_RETURN(); }
+  job.fn = shMountJob;
+  while(!Tmsh_ioSubmit(&job)) { TM_YIELD(1); }
+  while(!Tmsh_ioDone(&job)) { TM_YIELD(2); }
+  shBoot.fsReady = millis()-shBoot.start;
+  shFsMounting = false;
+  TM_END();
+}
+#endif
+
+void TaskManagerSh::begin() {
+  int k;
+  shBoot.start = millis();
+  // SPIFFS is mounted (and formatted if need be) by a task, once the loop is running
+#if defined(ARDUINO_ARCH_ESP8266) || defined(ARDUINO_ARCH_ESP32)
+  if(TmshProfile::fileBuiltins || TmshProfile::editor) {
+    Tmsh_ioBegin();
+    shFsMounting = true;
+    TaskMgr.addAutoWaitDelay(FSMOUNT_TASK, shTimed(FSMOUNT_TASK, shMountTask), TMSH_FSMOUNT_TICK);
+  }
+  if(TmshProfile::stallMs>0 && TmshProfile::stallLog) TaskMgr.addAutoWaitDelay(STALLLOG_TASK, Tmsh_stallLogTask, TMSH_STALL_LOGTICK);
 #endif  
 
   // add the shell task and all of its callable subtask
-  TaskMgr.add(SHELL_TASK, shellTask);
+  TaskMgr.add(SHELL_TASK, shTimed(SHELL_TASK, shellTask));
+  if(TmshProfile::maxJobs>0) TaskMgr.addAutoWaitDelay(SCHED_TASK, shTimed(SCHED_TASK, schedTask), TMSH_SCHED_TICK);
+  for(k=0; k<TmshProfile::maxStages-1; k++) TaskMgr.addAutoWaitDelay(PIPE_TASK-k, shTimed(PIPE_TASK-k, pipeStageTask), TMSH_PIPE_TICK);
   shellAddSubtasks();
+  shBoot.begin = millis()-shBoot.start;
+}
+
+// *** BOOT
+static void shBootReport(Print& out) {
+  out.print(F("begin()          ")); out.print(shBoot.begin); out.print(F(" ms\n"));
+  out.print(F("first task at    ")); out.print(shBoot.firstTask); out.print(F(" ms\n"));
+#if defined(ARDUINO_ARCH_ESP8266) || defined(ARDUINO_ARCH_ESP32)
+  if(!TmshProfile::fileBuiltins && !TmshProfile::editor) return;
+  if(shFsMounting) { out.print(F("filesystem       mounting\n")); return; }
+  out.print(F("filesystem at    ")); out.print(shBoot.fsReady); out.print(F(" ms"));
+  if(!Tmsh_fsReady) out.print(F(", failed"));
+  else {
+    out.print(F(", mount ")); out.print(shBoot.mountMs); out.print(F(" ms"));
+    if(shBoot.formatted) out.print(F(" (formatted)"));
+    if(TmshProfile::fileBuiltins && TmshProfile::kvMaxKeys>0) { out.print(F(", kv ")); out.print(shBoot.kvMs); out.print(F(" ms")); }
+  }
+  out.println();
+#endif
 }
 
 bool TaskManagerSh::addCommand(tm_taskId_t cmdTask, const char* cmdName, void (*task)()) {
-  if(numCommands==SH_MAXCOMMANDS) return false;
-  if(strlen(cmdName)>SH_MAXCOMMANDLEN) return false;
+  ShCommand* c;
+  size_t len;
+  if(numCommands==TmshProfile::maxCommands) return false;
+  len = strlen(cmdName);
+  if(len>TmshProfile::maxCommandLen) return false;
+  if((c=(ShCommand*)malloc(sizeof(ShCommand)+len))==NULL) return false;
   // else safe to add.
-  theCommands[numCommands].taskId = cmdTask;
-  strcpy(&(theCommands[numCommands].cmd[0]), cmdName);
+  c->next = NULL;
+  c->taskId = cmdTask;
+  strcpy(c->cmd, cmdName);
+  *lastCommand = c;
+  lastCommand = &c->next;
   numCommands++;
+  commandBytes += sizeof(ShCommand)+len;
 
-  TM_ADDSUBTASK(cmdTask, task);
+  TM_ADDSUBTASK(cmdTask, shTimed(cmdTask, task));
   return true;
 }
 
 TaskManagerSh TaskMgrSh;
 
-static void shellTask() {
-  static int i;
-  static String readlineBuf;
-  static int Argc;
-#if USING_ARDUINOSSH
-  static vector<String> Argv;
+// *** RUNNING COMMANDS
+#if defined(ARDUINO_ARCH_ESP8266) || defined(ARDUINO_ARCH_ESP32)
+// What cat, grep, ls, kv list, logcat and the -n dry runs keep while they stream, a block
+// or a line at a time, between yields.
+#define TMSH_STREAM_BUF 256
+struct ShStream {
+  File f;
+  bool fromFile;		// else from In
+  Tmsh_regex re;
+  bool invert;			// grep -v
+  bool countOnly;		// grep -c
+  long matches;			// grep's, and the files the current pattern has matched
+  int next;				// kv list's place in the index
+  Tmsh_ringLogReader log;	// logcat's
+  Tmsh_glob glob;		// cat's, rm -n's and cp -n's current pattern
+  bool globbing;		// glob has begun on Argv[arg]
+  bool dryRun;			// -n
+  int arg, argEnd;		// the patterns left are Argv[arg..argEnd-1]
+  long files, bytes;	// matched so far
+  int len;				// of the line in buf
+  int outPos;			// how much of it has gone to Out
+  char buf[TMSH_STREAM_BUF+1];
+  ShStream(): fromFile(false), invert(false), countOnly(false), matches(0), next(0), globbing(false), dryRun(false),
+    arg(0), argEnd(0), files(0), bytes(0), len(0), outPos(0) {}
+};
+
+String addSlash(const char* fn);	// from utils
+#endif
+
+// A command line that's been tokenized and looked up, ready to run.  The shell has one,
+// each pipeline stage after the first has one, and each scheduled job has its own, so a
+// job runs without being parsed again.
+struct ShRun {
+  ShCommand* cmd;		// a user command, or NULL for a builtin
+  int builtin;
+  Tmsh_param param;
+  Tmsh_paramP paramP;
+  tm_taskId_t calling;	// the user command task it's waiting on, or 0
+  uint32_t quoted;		// bit i is set if Argv[i] was in quotes, so isn't a > or |
+  bool traced;			// a trace begin event is open for the command
+  Tmsh_heapMark heapMark;	// a file builtin's, over the slice it's running
+#if defined(ARDUINO_ARCH_ESP8266) || defined(ARDUINO_ARCH_ESP32)
+  String outPath;		// > or >> this file, if it's not empty
+  bool outAppend;
+  Tmsh_fileSink* sink;	// while the command runs
+  ShStream* stream;		// while cat, grep, ls or kv list runs
+  Tmsh_ioJob io;		// while the I/O worker does its flash writes
+  Tmsh_sort* sort;		// while sort runs
+#endif
+};
+
+static String shLineBuf;
+static ShRun shellRun;
+static ShRun* schedRun = NULL;	// the job the scheduler is running, if any
+
+// *** PIPELINES
+// Stage 0 of a pipeline is shellRun.  Stage k after it is shStages[k-1], which has pipe
+// shPipes[k-1] in front of it, and which PIPE_TASK-(k-1) runs by calling PIPERUN_TASK-(k-1).
+#define SH_PIPES (TmshProfile::maxStages-1)
+struct ShStage {
+  ShRun run;
+  bool running;
+};
+
+static TmshTable<ShStage, SH_PIPES> shStages;
+static TmshTable<Tmsh_pipe, SH_PIPES> shPipes;
+static int shNumStages = 1;
+
+static Tmsh_pipe* shOutPipe(Print* out) {
+  int k;
+  for(k=0; k<TmshProfile::maxStages-1; k++) if(out==&shPipes[k]) return &shPipes[k];
+  return NULL;
+}
+
+static Tmsh_pipe* shInPipe(Stream* in) {
+  int k;
+  for(k=0; k<TmshProfile::maxStages-1; k++) if(in==&shPipes[k]) return &shPipes[k];
+  return NULL;
+}
+
+int Tmsh_outRoom(Tmsh_paramP p) {
+  Tmsh_pipe* pipe;
+  pipe = shOutPipe(p->Out);
+  return pipe!=NULL ? pipe->room() : 256;
+}
+
+bool Tmsh_inEnded(Tmsh_paramP p) {
+  Tmsh_pipe* pipe;
+  pipe = shInPipe(p->In);
+  return pipe!=NULL && pipe->ended();
+}
+
+#if defined(ARDUINO_ARCH_ESP8266) || defined(ARDUINO_ARCH_ESP32)
+static void shTakeRedirect(ShRun* r) {
+  // Take "> fn" or ">> fn" (or ">fn", ">>fn") out of the line, wherever it is after the
+  // command.  The last one wins.  A > with no file name after it is left alone, as is
+  // one in quotes.
+  Tmsh_param& p = r->param;
+  String fn;
+  bool append;
+  int i, drop;
+  r->outPath = "";
+  for(i=1; i<p.Argc; i++) {
+    if(p.Argv[i][0]!='>' || (r->quoted>>i & 1)) continue;
+    append = p.Argv[i].startsWith(">>");
+    fn = p.Argv[i].substring(append ? 2 : 1);
+    drop = 1;
+    if(fn.length()==0 && i+1<p.Argc) { fn = p.Argv[i+1]; drop = 2; }
+    if(fn.length()==0) continue;
+    r->outPath = fn;
+    r->outAppend = append;
+    r->quoted = (r->quoted & ((1UL<<i)-1)) | (r->quoted>>(i+drop) << i);
+    while(drop-->0) p.Argv.remove(i);
+    p.Argc = p.Argv.size();
+    i--;
+  }
+}
+#endif
+
+static void shResolve(ShRun* r) {
+  // Search the user commands, and if none found, try the builtins
+  const char* name;
+  name = r->param.Argv[0].c_str();
+  for(r->cmd=theCommands; r->cmd!=NULL && strcmp(r->cmd->cmd, name)!=0; r->cmd=r->cmd->next) continue;
+  r->builtin = r->cmd==NULL ? shFindBuiltin(name) : SH_BI_NONE;
+  r->paramP = &r->param;
+  r->calling = 0;
+#if defined(ARDUINO_ARCH_ESP8266) || defined(ARDUINO_ARCH_ESP32)
+  // every/at leave the redirection on the line, for the job to take
+  if(TmshProfile::fileBuiltins && r->builtin!=SH_BI_EVERY && r->builtin!=SH_BI_AT) shTakeRedirect(r);
+#endif
+}
+
+static bool shOutBegin(ShRun* r) {
+  // Point the command's Out at the file it's redirected to, if it is.
+  // false (having said why) if that can't be done.
+#if defined(ARDUINO_ARCH_ESP8266) || defined(ARDUINO_ARCH_ESP32)
+  Tmsh_heapMark heapMark;
+  if(r->outPath.length()==0) return true;
+  // the sink is the shell's, not the command's
+  heapMark.begin(TMSH_HEAP_SHELL);
+  if((r->sink=new(std::nothrow) Tmsh_fileSink())!=NULL && !r->sink->open(SPIFFS, r->outPath.c_str(), r->outAppend)) {
+    Serial.printf("Can't write [%s]\n", r->outPath.c_str());
+    delete r->sink; r->sink = NULL;
+    r->heapMark.leaveOut(heapMark.end());
+    return false;
+  }
+  r->heapMark.leaveOut(heapMark.end());
+  if(r->sink==NULL) { Serial.print(F("Out of memory.\n")); return false; }
+  r->param.Out = r->sink;
+#endif
+  return true;
+}
+
+static void shOutEnd(ShRun* r) {
+#if defined(ARDUINO_ARCH_ESP8266) || defined(ARDUINO_ARCH_ESP32)
+  Tmsh_heapMark heapMark;
+  if(r->sink==NULL) return;
+  heapMark.begin(TMSH_HEAP_SHELL);
+  r->param.Out = &Serial;
+  if(!r->sink->close()) { Serial.printf("Error writing [%s]\n", r->outPath.c_str()); r->param.Status = 1; }
+  delete r->sink; r->sink = NULL;
+  r->heapMark.leaveOut(heapMark.end());
+#endif
+}
+
+static bool shFsReady() {
+#if defined(ARDUINO_ARCH_ESP8266) || defined(ARDUINO_ARCH_ESP32)
+  return Tmsh_fsReady;
+#else
+  return true;
+#endif
+}
+
+static bool shNeedsFs(ShRun* r) {
+  // whether the command can't run without SPIFFS
+#if defined(ARDUINO_ARCH_ESP8266) || defined(ARDUINO_ARCH_ESP32)
+  if(!TmshProfile::fileBuiltins && !TmshProfile::editor) return false;
+  return shIsFileBuiltin(r->builtin) || r->builtin==SH_BI_ED || r->builtin==SH_BI_TRACE || r->outPath.length()>0;
 #else
-  static Array<String, TMSH_MAX_PARAMS> Argv;
+  return false;
 #endif
-  static Tmsh_param shParam;
-  static Tmsh_paramP shParamP;
-  //static ReadlineParam rp(readlineBuf);
-  static Tmsh_readlineParam rp(&readlineBuf);
-  shParamP = &shParam;
+}
+
+#if defined(ARDUINO_ARCH_ESP8266) || defined(ARDUINO_ARCH_ESP32)
+// *** I/O JOBS
+// The writing builtins, as jobs for the I/O worker.  Nothing else touches the run's
+// Argv while its command waits for the job.
+static void shAppendToJob(void* arg) {
+  Tmsh_param& p = ((ShRun*)arg)->param;
+  int i;
+  for(i=2; i<p.Argc; i++) {
+    appendTo(SPIFFS, p.Argv[1].c_str(), p.Argv[i].c_str());
+    appendTo(SPIFFS, p.Argv[1].c_str(), "\n");
+  }
+}
+
+static void shEchoToJob(void* arg) {
+  Tmsh_param& p = ((ShRun*)arg)->param;
+  rm(SPIFFS, p.Argv[1].c_str());
+  echoTo(SPIFFS, p.Argv[1].c_str(), "");
+  shAppendToJob(arg);
+}
+
+// What rm and cp's jobs are given, and leave behind.
+struct ShBatch {
+  ShRun* r;
+  int from, to;			// the patterns are Argv[from..to-1]; cp's destination is Argv[to]
+  long files, bytes;
+  bool failed;			// a pattern matched nothing, or something couldn't be written
+};
+
+static void shRmJob(void* arg) {
+  ShBatch& b = *(ShBatch*)arg;
+  Tmsh_param& p = b.r->param;
+  Tmsh_glob g;
+  long n;
+  int i;
+  for(i=b.from; i<b.to; i++) {
+    if(!g.begin(SPIFFS, p.Argv[i].c_str())) { Serial.printf("Can't read [%s]\n", p.Argv[i].c_str()); b.failed = true; continue; }
+    for(n=0; g.next(); n++) {
+      SPIFFS.remove(g.path().c_str());
+      b.bytes += g.size();
+    }
+    g.end();
+    b.files += n;
+    if(n==0 && Tmsh_isGlob(p.Argv[i].c_str())) { Serial.printf("No match: [%s]\n", p.Argv[i].c_str()); b.failed = true; }
+  }
+}
+
+static void shCpJob(void* arg) {
+  // Every file the patterns match, one after another, into the destination, which is
+  // opened once, when the first one is found.
+  ShBatch& b = *(ShBatch*)arg;
+  Tmsh_param& p = b.r->param;
+  Tmsh_glob g;
+  File out, in;
+  uint8_t buf[256];
+  long n;
+  int i, k;
+  for(i=b.from; i<b.to; i++) {
+    if(!g.begin(SPIFFS, p.Argv[i].c_str(), p.Argv[b.to].c_str())) { Serial.printf("Can't read [%s]\n", p.Argv[i].c_str()); b.failed = true; continue; }
+    for(n=0; g.next(); n++) {
+      if(!out && !(out=SPIFFS.open(addSlash(p.Argv[b.to].c_str()).c_str(), FILE_WRITE))) {
+        Serial.printf("Can't write [%s]\n", p.Argv[b.to].c_str());
+        b.failed = true;
+        g.end();
+        return;
+      }
+      in = SPIFFS.open(g.path().c_str(), FILE_READ);
+      while((k=in.read(buf, sizeof(buf)))>0) {
+        if(out.write(buf, k)!=(size_t)k) { b.failed = true; break; }
+        b.bytes += k;
+      }
+      in.close();
+    }
+    g.end();
+    b.files += n;
+    if(n==0 && Tmsh_isGlob(p.Argv[i].c_str())) { Serial.printf("No match: [%s]\n", p.Argv[i].c_str()); b.failed = true; }
+  }
+  if(out) out.close();
+}
+
+static void shFormatJob(void*) {
+  format(SPIFFS, "/");
+}
+
+static bool shKvInUse = false;	// a kv write is out with the I/O worker
+bool Tmsh_kvBusy() { return shKvInUse; }
+
+static void shKvJob(void* arg) {
+  // kv set, del or compact, which write the log
+  Tmsh_param& p = ((ShRun*)arg)->param;
+  String value;
+  int i;
+  if(p.Argv[1]=="set") {
+    for(i=3; i<p.Argc; i++) {
+      if(i>3) value += ' ';
+      value += p.Argv[i];
+    }
+    if(!Tmsh_kv.set(p.Argv[2].c_str(), value.c_str(), value.length())) { Serial.print(F("Can't set that key.\n")); p.Status = 1; }
+  } else if(p.Argv[1]=="del") {
+    if(!Tmsh_kv.del(p.Argv[2].c_str())) p.Status = 1;
+  } else if(!Tmsh_kv.compact()) { Serial.print(F("Compaction failed.\n")); p.Status = 1; }
+}
+
+static bool shLogClear(const char* fn) {
+  // Empty the ring log fn, without making one if it isn't there
+  Tmsh_ringLog log;
+  if(!SPIFFS.exists(addSlash(fn).c_str()) || !log.begin(SPIFFS, fn)) return false;
+  return log.clear();
+}
+
+static void shStreamEnd(ShRun* r) {
+  Tmsh_heapMark heapMark;
+  if(r->stream==NULL) return;
+  heapMark.begin(TMSH_HEAP_SHELL);
+  r->stream->f.close();
+  r->stream->log.end();
+  r->stream->glob.end();
+  delete r->stream; r->stream = NULL;
+  r->heapMark.leaveOut(heapMark.end());
+}
+
+static bool shStreamBegin(ShRun* r, const char* fn) {
+  // Set up what cat or grep keeps while it streams, reading fn if it isn't NULL, else In.
+  // false (having said why) if that can't be done.  The stream is the shell's, not the
+  // command's, for the heap counters.
+  Tmsh_heapMark heapMark;
+  heapMark.begin(TMSH_HEAP_SHELL);
+  r->stream = new(std::nothrow) ShStream();
+  r->heapMark.leaveOut(heapMark.end());
+  if(r->stream==NULL) { Serial.print(F("Out of memory.\n")); return false; }
+  if(fn!=NULL) {
+    r->stream->f = SPIFFS.open(addSlash(fn).c_str(), FILE_READ);
+    if(!r->stream->f || r->stream->f.isDirectory()) {
+      Serial.printf("Can't read [%s]\n", fn);
+      shStreamEnd(r);
+      return false;
+    }
+    r->stream->fromFile = true;
+  }
+  return true;
+}
+
+static int shGrepFill(ShStream* st, Tmsh_paramP p) {
+  // Gather the next line of input into st->buf.  1 when there's a line, 0 when there's
+  // no more input yet (yield and come back), -1 at the end of the input.
+  // A line longer than the buffer comes out in pieces.
+  int c;
+  while(st->len<TMSH_STREAM_BUF) {
+    if(st->fromFile) c = st->f.available() ? st->f.read() : -2;
+    else c = p->In->available() ? p->In->read() : Tmsh_inEnded(p) ? -2 : -1;
+    if(c==-1) return 0;
+    if(c==-2) { if(st->len==0) return -1; break; }
+    if(c=='\n') break;
+    if(c!='\r') st->buf[st->len++] = c;
+  }
+  st->buf[st->len] = '\0';
+  return 1;
+}
+#endif
+
+static bool shTaskBusy(tm_taskId_t id) {
+  // A user command task can only be running for one caller at a time.
+  int k;
+  if(shellRun.calling==id || (schedRun!=NULL && schedRun->calling==id)) return true;
+  for(k=0; k<TmshProfile::maxStages-1; k++) if(shStages[k].running && shStages[k].run.calling==id) return true;
+  return false;
+}
+
+static bool shPipeable(int bi) {
+  // the ones that take over Serial, or that would make jobs out of the rest of the line
+  return bi!=SH_BI_ED && bi!=SH_BI_RX && bi!=SH_BI_TX && bi!=SH_BI_EVERY && bi!=SH_BI_AT;
+}
+
+static bool shIsPipe(const ShRun& r, int i) {
+  return r.param.Argv[i]=="|" && !(r.quoted>>i & 1);
+}
+
+static int shSplitPipeline() {
+  // Cut the shell's line at each "|" into stages, shellRun and then shStages[].
+  // Returns how many there are, or 0 (having said why) if the pipeline is no good.
+  // Without pipes in the profile, a | is just another argument.
+  Tmsh_param& p = shellRun.param;
+  Tmsh_param* stage;
+  int i, cut, n;
+  bool empty;
+  if(TmshProfile::maxStages<2) return 1;
+  for(cut=0; cut<p.Argc && !shIsPipe(shellRun, cut); cut++) continue;
+  if(cut==p.Argc) return 1;
+  stage = NULL;
+  empty = cut==0;
+  for(i=cut, n=1; i<p.Argc; i++) {
+    if(shIsPipe(shellRun, i)) {
+      if(stage!=NULL && stage->Argv.size()==0) empty = true;
+      if(n==TmshProfile::maxStages) { Serial.print(F("Too many commands in the pipeline.\n")); return 0; }
+      stage = &shStages[n-1].run.param;
+      stage->Argv.clear();
+      shStages[n-1].run.quoted = 0;
+      n++;
+    } else {
+      if(shellRun.quoted>>i & 1) shStages[n-2].run.quoted |= 1UL<<stage->Argv.size();
+      stage->Argv.push_back(p.Argv[i]);
+    }
+  }
+  if(stage->Argv.size()==0) empty = true;
+  while((int)p.Argv.size()>cut) p.Argv.pop_back();
+  p.Argc = cut;
+  if(empty) { Serial.print(F("Empty command in the pipeline.\n")); return 0; }
+  for(i=0; i<n-1; i++) shStages[i].run.param.Argc = shStages[i].run.param.Argv.size();
+  return n;
+}
+
+static bool shStartPipeline() {
+  // Look up each stage of the line the shell just split, and join them with pipes.
+  // false (having said why) if one of them can't be in a pipeline.
+  ShRun* r;
+  int k;
+  for(k=0; k<shNumStages; k++) {
+    r = k==0 ? &shellRun : &shStages[k-1].run;
+    shResolve(r);
+    r->param.Status = 0;
+    r->param.In = k==0 ? static_cast<Stream*>(&Serial) : &shPipes[k-1];
+    r->param.Out = k<shNumStages-1 ? static_cast<Print*>(&shPipes[k]) : &Serial;
+    if(shNumStages>1 && r->cmd==NULL && !shPipeable(r->builtin)) {
+      Serial.print(r->param.Argv[0]); Serial.print(F(" can't be in a pipeline.\n"));
+      return false;
+    }
+  }
+  for(k=0; k<shNumStages-1; k++) {
+    shPipes[k].reset();
+    shStages[k].running = true;
+  }
+  return true;
+}
+
+static void shStageEnd(int k) {
+  // Stage k is finished:  the next stage sees the end of its input, and the one before
+  // can stop waiting for room.
+  if(k<shNumStages-1) shPipes[k].closeWrite();
+  if(k>0) {
+    shPipes[k-1].closeRead();
+    shStages[k-1].running = false;
+  }
+}
+
+static bool shPipelineRunning() {
+  int k;
+  for(k=0; k<shNumStages-1; k++) if(shStages[k].running) return true;
+  return false;
+}
+
+// *** SCHEDULER
+// every/at jobs, run one at a time from SCHED_TASK, which wakes every TMSH_SCHED_TICK ms.
+enum { JOB_FREE, JOB_WAITING, JOB_CANCELLED };
+
+struct ShJob {
+  uint8_t state;
+  bool once;				// at, rather than every
+  unsigned long interval;	// ms
+  unsigned long due;		// millis() of the next run
+  unsigned long started;
+  unsigned long runs;
+  unsigned long missed;		// runs skipped because the command was busy or we fell behind
+  unsigned long lastMs;		// how long the last run took
+  unsigned long lastLate;	// how late the last run started, in ms
+  unsigned long maxLate;
+  int lastStatus;
+  ShRun run;
+};
+
+static TmshTable<ShJob, TmshProfile::maxJobs> shJobs;
+
+static bool shParseInterval(const String& s, unsigned long& ms) {
+  // 250ms, 10s, 5m, 2h; a bare number is seconds
+  const char* p;
+  char* end;
+  unsigned long n;
+  p = s.c_str();
+  n = strtoul(p, &end, 10);
+  if(end==p) return false;
+  if(strcmp(end, "ms")==0) ms = n;
+  else if(*end=='\0' || strcmp(end, "s")==0) ms = n*1000UL;
+  else if(strcmp(end, "m")==0) ms = n*60000UL;
+  else if(strcmp(end, "h")==0) ms = n*3600000UL;
+  else return false;
+  return ms>0;
+}
+
+static bool shSchedulable(const ShRun& r) {
+  // Not the ones that talk to the user, take over Serial, or manage jobs themselves.  ed
+  // can be, in batch mode (-s or -e), which never reads Serial.
+  int bi = r.builtin;
+  int i;
+  if(bi==SH_BI_ED) {
+    for(i=1; i<r.param.Argc; i++) if(r.param.Argv[i]=="-s" || r.param.Argv[i]=="-e") return true;
+    return false;
+  }
+  return bi!=SH_BI_RX && bi!=SH_BI_TX && bi!=SH_BI_EVERY && bi!=SH_BI_AT
+    && bi!=SH_BI_CANCEL && bi!=SH_BI_SCHED;
+}
+
+static int shAddJob(bool once, unsigned long ms, const ShRun& from) {
+  // Make a job of from's Argv[2...].  Returns its id, or -1 if there's no room, -2 for an
+  // unknown command, -3 for one that can't be scheduled.
+  const Tmsh_param& p = from.param;
+  ShJob* job;
+  int j, i;
+  for(j=0; j<TmshProfile::maxJobs && shJobs[j].state!=JOB_FREE; j++) continue;
+  if(j==TmshProfile::maxJobs) return -1;
+  job = &shJobs[j];
+  job->run.param.Argv.clear();
+  for(i=2; i<p.Argc; i++) job->run.param.Argv.push_back(p.Argv[i]);
+  job->run.param.Argc = p.Argc-2;
+  job->run.quoted = from.quoted>>2;
+  shResolve(&job->run);
+  if(job->run.cmd==NULL && job->run.builtin==SH_BI_NONE) return -2;
+  if(job->run.cmd==NULL && !shSchedulable(job->run)) return -3;
+  job->once = once;
+  job->interval = ms;
+  job->due = millis()+ms;
+  job->runs = job->missed = job->lastMs = job->lastLate = job->maxLate = 0;
+  job->lastStatus = 0;
+  job->state = JOB_WAITING;
+  return j+1;
+}
+
+static void shListJobs(Print& out) {
+  char line[72];
+  int j, i;
+  out.print(F(" id  every(ms)   runs missed  last ms  late ms   max late  status  command\n"));
+  for(j=0; j<TmshProfile::maxJobs; j++) {
+    const ShJob& job = shJobs[j];
+    if(job.state!=JOB_WAITING) continue;
+    snprintf(line, sizeof(line), "%3d %s%9lu %6lu %6lu %8lu %8lu %10lu %7d  ", j+1, job.once ? "at" : "  ",
+      job.interval, job.runs, job.missed, job.lastMs, job.lastLate, job.maxLate, job.lastStatus);
+    out.print(line);
+    for(i=0; i<job.run.param.Argc; i++) { out.print(job.run.param.Argv[i]); out.print(' '); }
+#if defined(ARDUINO_ARCH_ESP8266) || defined(ARDUINO_ARCH_ESP32)
+    if(job.run.outPath.length()>0) { out.print(job.run.outAppend ? ">> " : "> "); out.print(job.run.outPath); }
+#endif
+    out.println();
+  }
+}
+
+static void schedTask() {
+  static ShJob* job;
+  unsigned long now;
+  int j;
   TM_BEGIN();
-  Serial.print("cmd: ");
-  TM_CALL_P(2, READLINE_TASK, rp);
-  Serial.println(readlineBuf);
-  Tmsh_readlineBufTokenize(readlineBuf, Argc, Argv);
-  if(Argc==0) { TM_RETURN(); }	// no line to process
+  // run whichever job is furthest overdue
+  now = millis();
+  job = NULL;
+  for(j=0; j<TmshProfile::maxJobs; j++) {
+    if(shJobs[j].state==JOB_WAITING && (long)(now-shJobs[j].due)>=0
+      && (job==NULL || (long)(shJobs[j].due-job->due)<0)) job = &shJobs[j];
+  }
+  if(job==NULL) { TM_RETURN(); }
+  job->lastLate = now-job->due;
+  if(job->lastLate>job->maxLate) job->maxLate = job->lastLate;
+  job->due += job->interval;
+  if((long)(now-job->due)>=0) {
+    // fell a whole interval or more behind; skip ahead rather than run it back to back
+    job->missed += (now-job->due)/job->interval + 1;
+    job->due = now+job->interval;
+  }
+  if(job->run.cmd!=NULL && shTaskBusy(job->run.cmd->taskId)) { job->missed++; TM_RETURN(); }
+  job->started = now;
+  job->run.param.Status = 0;
+  schedRun = &job->run;
+  TM_CALL(1, SCHEDRUN_TASK);
+  schedRun = NULL;
+  job->lastMs = millis()-job->started;
+  job->lastStatus = job->run.param.Status;
+  job->runs++;
+  if(job->once || job->state==JOB_CANCELLED) job->state = JOB_FREE;
+  TM_END();
+}
 
-  // Search the user commands, and if none found, try the builtins
+static void shRun(ShRun* r) {
+  // Run the command in r to completion.  Called from the two runner tasks below.
+  Tmsh_param& shParam = r->param;
+  Tmsh_paramP& shParamP = r->paramP;
+  int& Argc = shParam.Argc;
+#if USING_ARDUINOSSH
+  vector<String>& Argv = shParam.Argv;
+#else
+  Array<String, TMSH_MAX_PARAMS>& Argv = shParam.Argv;
+#endif
+  ShCommand* cmd = r->cmd;
+  int builtin = r->builtin;
+  unsigned long ms;
+  int i;
+  long n;
+#if defined(ARDUINO_ARCH_ESP8266) || defined(ARDUINO_ARCH_ESP32)
+  ShStream* st = r->stream;
+  int caps[TMSH_RE_NSLOTS];
+  const char* err;
+  char key[TMSH_KV_MAXKEY+1];
+  Tmsh_sync* sy;
+  int field;
+  bool numeric, unique;
+  ShBatch* b;
+#endif
+  TM_BEGINSUB();
+#if defined(ARDUINO_ARCH_ESP8266) || defined(ARDUINO_ARCH_ESP32)
+  while(shNeedsFs(r) && shFsMounting) { TM_YIELD(17); }
+#endif
+  r->traced = Tmsh_tracing;
+  TMSH_TRACE('B', shIsFileBuiltin(builtin) ? TMSH_TRACE_FILE : TMSH_TRACE_SHELL, Argv[0].c_str());
+  // Output goes to shParam.Out; errors and syntax help stay on Serial.
+  if(shNeedsFs(r) && !shFsReady()) { Serial.print(F("No filesystem.\n")); shParam.Status = 1; }
+  else if(!shOutBegin(r)) { shParam.Status = 1; }
   // *** USER COMMANDS
-  for(i=0; i<numCommands; i++) if(strcmp(theCommands[i].cmd, Argv[0].c_str())==0) break;
-  if(i<numCommands) {
-	//static ShParam shParam(Argc, Argv);
-	shParam.Argc = Argc; shParam.Argv = Argv;
-    TM_CALL_P(1, theCommands[i].taskId, shParamP);
-  } else if(Argv[0]=="reboot") {              // *** REBOOT
-    if(Argc!=1) { Serial.print("Syntax: reboot\n"); }
+  else if(cmd!=NULL) {
+    if(shTaskBusy(cmd->taskId)) { Serial.print(cmd->cmd); Serial.print(F(" is already running.\n")); shParam.Status = 1; }
+    else {
+      r->calling = cmd->taskId;
+      TM_CALL_P(1, cmd->taskId, shParamP);
+      r->calling = 0;
+    }
+  } else if(builtin==SH_BI_STATUS) {          // *** STATUS
+    shParam.Out->println(Tmsh_lastStatus);
+    shParam.Status = Tmsh_lastStatus;	// so that status doesn't disturb it
+  } else if(builtin==SH_BI_REBOOT) {          // *** REBOOT
+    if(Argc!=1) { shSyntax(builtin); }
     else {
-      Serial.println("Rebooting...");
+      Serial.println(F("Rebooting..."));
 	  Serial.flush();
 #if defined(ARDUINO_ARCH_AVR)
 	  asm volatile (" jmp 0");
@@ -151,99 +955,507 @@ static void shellTask() {
       ESP.restart();
 #endif
 	}
-  } else if(Argv[0]=="help") {                // *** HELP
-    shHelp();
+  } else if(builtin==SH_BI_HELP) {            // *** HELP
+    shHelp(*shParam.Out);
+  } else if(builtin==SH_BI_MEM) {             // *** MEM
+    for(i=0, n=sizeof(shLineBuf)+TmshProfile::readlineMax+1+sizeof(shellRun); i<Argc; i++) {
+      n += Argv[i].length()+1;
+    }
+    shMem(*shParam.Out, n);
+  } else if(builtin==SH_BI_HEAP) {            // *** HEAP
+    if(Argc==1) Tmsh_heapReport(*shParam.Out);
+    else if(Argc==2 && Argv[1]=="reset") Tmsh_heapReset();
+    else { shSyntax(builtin); shParam.Status = 1; }
+  } else if(builtin==SH_BI_EVERY || builtin==SH_BI_AT) {   // *** EVERY, AT
+    if(Argc<3 || !shParseInterval(Argv[1], ms)) { shSyntax(builtin); shParam.Status = 1; }
+    else if((n=shAddJob(builtin==SH_BI_AT, ms, *r))>0) { shParam.Out->print(F("Job ")); shParam.Out->println(n); }
+    else {
+      shParam.Status = 1;
+      if(n==-1) Serial.print(F("No room for another job.\n"));
+      else if(n==-2) Serial.print(F("Invalid command.\n"));
+      else Serial.print(F("That command can't be scheduled.\n"));
+    }
+  } else if(builtin==SH_BI_CANCEL) {          // *** CANCEL
+    n = Argc==2 ? Argv[1].toInt() : 0;
+    if(n<1 || n>TmshProfile::maxJobs || shJobs[n-1].state!=JOB_WAITING) { shSyntax(builtin); shParam.Status = 1; }
+    else shJobs[n-1].state = schedRun==&shJobs[n-1].run ? JOB_CANCELLED : JOB_FREE;
+  } else if(builtin==SH_BI_SCHED) {           // *** SCHED
+    shListJobs(*shParam.Out);
+  } else if(builtin==SH_BI_BOOT) {            // *** BOOT
+    shBootReport(*shParam.Out);
+  } else if(builtin==SH_BI_STALLS) {          // *** STALLS
+    if(Argc==1) Tmsh_stallReport(*shParam.Out);
+    else if(Argc==2 && Argv[1]=="clear") Tmsh_stallClear();
+    else if(Argc==2 && Argv[1].toInt()>0) Tmsh_stallMs = Argv[1].toInt();
+    else { shSyntax(builtin); shParam.Status = 1; }
   } 
 #if defined(ARDUINO_ARCH_ESP8266) || defined(ARDUINO_ARCH_ESP32)
-  else if(Argv[0]=="appendTo") {            // *** APPENDTO
-    int i;
-    if(Argc<2) { Serial.print("syntax: appendTo fn text text text...\n"); }
+  else if(builtin==SH_BI_ED && TmshProfile::editor) {    // *** ED
+    // the shell's session, or the scheduler's, each in its own task with its own context
+    TM_CALL_P(3, r==&shellRun ? ED_TASK : ED2_TASK, shParamP);
+  } else if(builtin==SH_BI_TRACE && TmshProfile::traceEvents>0) {   // *** TRACE
+    if(Argc==2 && Argv[1]=="start") Tmsh_traceStart();
+    else if(Argc==2 && Argv[1]=="stop") Tmsh_traceStop();
+    else if(Argc==3 && Argv[1]=="dump") {
+      if((n=Tmsh_traceDump(SPIFFS, Argv[2].c_str()))<0) { Serial.printf("Can't write [%s]\n", Argv[2].c_str()); shParam.Status = 1; }
+      else shParam.Out->printf("%ld events written.\n", n);
+    } else { shSyntax(builtin); shParam.Status = 1; }
+  } else if(!TmshProfile::fileBuiltins) {    // the rest compile away
+    Serial.println(F("Invalid command.")); shParam.Status = 1;
+  } else if(builtin==SH_BI_APPENDTO || builtin==SH_BI_ECHOTO || builtin==SH_BI_FORMAT) {
+    // *** APPENDTO, ECHOTO, FORMAT:  the I/O worker does the writing while we yield
+    if(builtin!=SH_BI_FORMAT && Argc<2) { shSyntax(builtin); }
     else {
-      for(i=2; i<Argc; i++) {
-        appendTo(SPIFFS, Argv[1].c_str(), Argv[i].c_str());
-        appendTo(SPIFFS, Argv[1].c_str(), "\n");
-       }
+      r->io.fn = builtin==SH_BI_APPENDTO ? shAppendToJob : builtin==SH_BI_ECHOTO ? shEchoToJob : shFormatJob;
+      r->io.arg = r;
+      while(!Tmsh_ioSubmit(&r->io)) { TM_YIELD(12); }
+      while(!Tmsh_ioDone(&r->io)) { TM_YIELD(13); }
     }
-  } else if(Argv[0]=="cat") {                  // *** CAT
-    if(Argc!=2) { Serial.print("syntax: cat fn\n"); }
-    else { cat(SPIFFS, Argv[1].c_str());  }
-  } else if(Argv[0]=="echoTo") {
-    if(Argc<2) { Serial.print("syntax: echoTo fn text text text...\n"); }
+  } else if((builtin==SH_BI_RM || builtin==SH_BI_CP) && !(Argc>1 && Argv[1]=="-n")) {
+    // *** RM, CP:  the I/O worker expands the patterns and does the writing while we yield
+    if(Argc<(builtin==SH_BI_CP ? 3 : 2)) { shSyntax(builtin); shParam.Status = 1; }
+    else if((b=new(std::nothrow) ShBatch())==NULL) { Serial.print(F("Out of memory.\n")); shParam.Status = 1; }
     else {
-      int i;
-      rm(SPIFFS, Argv[1].c_str());
-      echoTo(SPIFFS, Argv[1].c_str(),"");
-      for(i=2; i<Argc; i++) {
-        appendTo(SPIFFS, Argv[1].c_str(), Argv[i].c_str());
-        appendTo(SPIFFS, Argv[1].c_str(), "\n");
-      }
+      b->r = r;
+      b->from = 1;
+      b->to = builtin==SH_BI_CP ? Argc-1 : Argc;
+      b->files = b->bytes = 0;
+      b->failed = false;
+      r->io.fn = builtin==SH_BI_RM ? shRmJob : shCpJob;
+      r->io.arg = b;
+      while(!Tmsh_ioSubmit(&r->io)) { TM_YIELD(21); }
+      while(!Tmsh_ioDone(&r->io)) { TM_YIELD(22); }
+      b = (ShBatch*)r->io.arg;
+      if(b->failed) shParam.Status = 1;
+      // the totals, when there were patterns to them
+      for(i=b->from; i<b->to && !Tmsh_isGlob(Argv[i].c_str()); i++) continue;
+      if(i<b->to) shParam.Out->printf("%ld files, %ld bytes\n", b->files, b->bytes);
+      delete b;
     }
-  } else if(Argv[0]=="cp") {                  // *** CP
-    if(Argc<3) { Serial.print("Syntax: cp f f... fdest\n"); }
+  } else if(builtin==SH_BI_CAT || builtin==SH_BI_RM || builtin==SH_BI_CP) {
+    // *** CAT, and rm -n and cp -n:  the files each pattern matches, in turn, printed or
+    // listed as Out has room for them
+    i = Argc>1 && Argv[1]=="-n" ? 2 : 1;
+    if(Argc-i<(builtin==SH_BI_CP ? 2 : 1)) { shSyntax(builtin); shParam.Status = 1; }
+    else if(!shStreamBegin(r, NULL)) { shParam.Status = 1; }
     else {
-      cp(SPIFFS, Argv[1].c_str(), Argv[Argc-1].c_str());
-      for(int i=1; i<Argc-1; i++) appendFile(SPIFFS, Argv[Argc-1].c_str(), Argv[i].c_str());
+      st = r->stream;
+      st->arg = i;
+      st->argEnd = builtin==SH_BI_CP ? Argc-1 : Argc;
+      st->dryRun = i==2;
+      for(;;) {
+        st = r->stream;
+        if(!st->globbing) {
+          if(st->arg==st->argEnd) break;
+          if(!st->glob.begin(SPIFFS, Argv[st->arg].c_str(), builtin==SH_BI_CP ? Argv[Argc-1].c_str() : NULL)) {
+            Serial.printf("Can't read [%s]\n", Argv[st->arg].c_str());
+            shParam.Status = 1;
+            st->arg++;
+            continue;
+          }
+          st->globbing = true;
+          st->matches = 0;
+        }
+        if(!st->glob.next()) {
+          if(st->matches==0) {
+            Serial.printf(Tmsh_isGlob(Argv[st->arg].c_str()) ? "No match: [%s]\n" : "Can't read [%s]\n", Argv[st->arg].c_str());
+            shParam.Status = 1;
+          }
+          st->glob.end();
+          st->globbing = false;
+          st->arg++;
+          continue;
+        }
+        st->matches++;
+        st->files++;
+        st->bytes += st->glob.size();
+        if(st->dryRun) {
+          // a line at a time
+          st->len = snprintf(st->buf, sizeof(st->buf), "%s  %ld\n", st->glob.path().c_str(), st->glob.size());
+          for(st->outPos=0; r->stream->outPos<r->stream->len; ) {
+            if((n=Tmsh_outRoom(shParamP))==0) { TM_YIELD(20); continue; }
+            st = r->stream;
+            if(n>st->len-st->outPos) n = st->len-st->outPos;
+            shParam.Out->write((const uint8_t*)st->buf+st->outPos, n);
+            st->outPos += n;
+          }
+        } else {
+          // a block at a time
+          st->f = SPIFFS.open(st->glob.path().c_str(), FILE_READ);
+          while(r->stream->f.available()) {
+            if((n=Tmsh_outRoom(shParamP))==0) { TM_YIELD(6); continue; }
+            st = r->stream;
+            n = st->f.read((uint8_t*)st->buf, n<TMSH_STREAM_BUF ? n : TMSH_STREAM_BUF);
+            shParam.Out->write((const uint8_t*)st->buf, n);
+            TM_YIELD(7);
+          }
+          r->stream->f.close();
+        }
+      }
+      st = r->stream;
+      if(st->dryRun) shParam.Out->printf("%ld files, %ld bytes\n", st->files, st->bytes);
     }
-  } else if(Argv[0]=="ed") {                  // *** ED
-    if(Argc>2) { Serial.print("Syntax: ed [filename]\n"); }
+  } else if(builtin==SH_BI_GREP) {            // *** GREP
+    for(i=1; i<Argc && (Argv[i]=="-v" || Argv[i]=="-c"); i++) continue;
+    if(i==Argc || Argc-i>2) { shSyntax(builtin); shParam.Status = 2; }
+    else if(Argc-i==1 && shInPipe(shParam.In)==NULL) { Serial.print(F("grep needs a file or a pipe.\n")); shParam.Status = 2; }
+    else if(!shStreamBegin(r, Argc-i==2 ? Argv[i+1].c_str() : NULL)) { shParam.Status = 2; }
+    else if((err=r->stream->re.compile(Argv[i].c_str()))!=NULL) { Serial.printf("Bad pattern: %s\n", err); shParam.Status = 2; }
     else {
-	  //static ShParam shParam(Argc, Argv);
-	  shParam.Argc = Argc;  shParam.Argv = Argv;
-      TM_CALL_P(3, ED_TASK, shParamP);
+      for(st=r->stream; --i>0; ) {
+        if(Argv[i]=="-v") st->invert = true;
+        else st->countOnly = true;
+      }
+      // a line at a time; each matching line goes out as Out has room for it
+      for(;;) {
+        if((n=shGrepFill(r->stream, shParamP))==0) { TM_YIELD(8); continue; }
+        if(n<0) break;
+        st = r->stream;
+        if(st->re.search(st->buf, 0, caps)!=st->invert) {
+          st->matches++;
+          if(!st->countOnly) {
+            st->buf[st->len++] = '\n';
+            for(st->outPos=0; r->stream->outPos<r->stream->len; ) {
+              if((n=Tmsh_outRoom(shParamP))==0) { TM_YIELD(9); continue; }
+              st = r->stream;
+              if(n>st->len-st->outPos) n = st->len-st->outPos;
+              shParam.Out->write((const uint8_t*)st->buf+st->outPos, n);
+              st->outPos += n;
+            }
+          }
+        }
+        r->stream->len = 0;
+      }
+      if(r->stream->countOnly) shParam.Out->println(r->stream->matches);
+      shParam.Status = r->stream->matches>0 ? 0 : 1;
     }
-  } else if(Argv[0]=="format") {              // *** FORMAT
-    format(SPIFFS,"/");
-  } else if(Argv[0]=="mv") {                  // *** MV
-    if(Argc!=3) { Serial.print("Syntax: mv fold fnew\n"); }
+  } else if(builtin==SH_BI_MV) {              // *** MV
+    if(Argc!=3) { shSyntax(builtin); }
     else {
       mv(SPIFFS, Argv[1].c_str(), Argv[2].c_str());
     }
-  } else if(Argv[0]=="ls") {                  // *** LS
-    ls(SPIFFS, "/", 0);
-  } else if(Argv[0]=="rm") {                  // *** RM
-    if(Argc<2) { Serial.print("Syntax: rm fil fil...\n"); }
+  } else if(builtin==SH_BI_LS) {              // *** LS
+    if(!shStreamBegin(r, NULL)) { shParam.Status = 1; }
+    else if(!(r->stream->f=SPIFFS.open("/")) || !r->stream->f.isDirectory()) { Serial.print(F("Can't list /\n")); shParam.Status = 1; }
     else {
-      for(int i=1; i<Argc; i++) rm(SPIFFS, Argv[i].c_str());
+      // a line at a time, as Out has room for it
+      st = r->stream;
+      st->len = snprintf(st->buf, sizeof(st->buf), "/ (DIR)\n");
+      for(;;) {
+        for(st->outPos=0; r->stream->outPos<r->stream->len; ) {
+          if((n=Tmsh_outRoom(shParamP))==0) { TM_YIELD(10); continue; }
+          st = r->stream;
+          if(n>st->len-st->outPos) n = st->len-st->outPos;
+          shParam.Out->write((const uint8_t*)st->buf+st->outPos, n);
+          st->outPos += n;
+        }
+        st = r->stream;
+        {
+          File file = st->f.openNextFile();
+          if(!file) break;
+          if(file.isDirectory()) st->len = snprintf(st->buf, sizeof(st->buf), "%s (DIR)\n", file.name());
+          else st->len = snprintf(st->buf, sizeof(st->buf), "%s  %d\n", file.name(), (int)file.size());
+          file.close();
+        }
+      }
     }
-  } else if(Argv[0]=="xget") {                 // *** GET
-	if(Argc!=3) { Serial.print("Syntax: get remotefn localfn\n"); }
+  } else if(builtin==SH_BI_GET) {             // *** GET
+	if(Argc!=3) { shSyntax(builtin); }
     else {
       String remoteFn;
       remoteFn = (Argv[1][0]=='/' ? "" : "/") + Argv[1];
       Serial.printf("Fetching file [%s]\n", remoteFn.c_str());
       //getFromWeb(SPIFFS, hwInfo.host, remoteFn/*(*(shParam.Argv))[1]*/, Argv[2]);
     }
-  } else if(Argv[0]=="xput") {                 // *** PUT
-	if(Argc!=3) { Serial.println("Syntax: put localfn remotefn"); }
+  } else if(builtin==SH_BI_PUT) {             // *** PUT
+	if(Argc!=3) { shSyntax(builtin); }
     else {
       String remoteFile;
       remoteFile = (Argv[2][0]=='/'?"":"/") + Argv[2];
       Serial.printf("Putting [%s] to  remote file: [%s]\n", Argv[1].c_str(), remoteFile.c_str());
       //putToWeb(SPIFFS, hwInfo.host, Argv[1], remoteFile);
     }
-  } else if(Argv[0]=="xreflash") {             // *** REFLASH
+  } else if(builtin==SH_BI_RX) {              // *** RX
+    TM_CALL_P(4, RX_TASK, shParamP);
+  } else if(builtin==SH_BI_TX) {              // *** TX
+    TM_CALL_P(5, TX_TASK, shParamP);
+  } else if(builtin==SH_BI_KV && TmshProfile::kvMaxKeys>0) {   // *** KV
+    // nothing reads the store while the worker is writing it
+    while(shKvInUse) { TM_YIELD(25); }
+    if(!Tmsh_kv.ready()) { Serial.print(F("The kv store isn't loaded.\n")); shParam.Status = 1; }
+    else if(Argc==3 && Argv[1]=="get") {
+      String value;
+      if(Tmsh_kv.get(Argv[2].c_str(), value)) shParam.Out->println(value);
+      else shParam.Status = 1;
+    } else if((Argc>=3 && Argv[1]=="set") || (Argc==3 && Argv[1]=="del") || (Argc==2 && Argv[1]=="compact")) {
+      // the I/O worker writes the log while we yield
+      shKvInUse = true;
+      r->io.fn = shKvJob;
+      r->io.arg = r;
+      while(!Tmsh_ioSubmit(&r->io)) { TM_YIELD(26); }
+      while(!Tmsh_ioDone(&r->io)) { TM_YIELD(27); }
+      shKvInUse = false;
+      if(Argv[1]=="compact") shParam.Out->printf("%d keys, %ld bytes\n", Tmsh_kv.count(), Tmsh_kv.logBytes());
+    } else if(Argc==2 && Argv[1]=="list") {
+      if(!shStreamBegin(r, NULL)) { shParam.Status = 1; }
+      else {
+        // a key=value line at a time, as Out has room for it; long values are cut short.
+        // A write in between can move keys about, so they may come out twice or not at all.
+        for(;;) {
+          while(shKvInUse) { TM_YIELD(28); }
+          st = r->stream;
+          if((st->next=Tmsh_kv.entry(st->next, key, st->buf, sizeof(st->buf)))<0) break;
+          i = strlen(key);
+          n = strlen(st->buf);
+          if(i+n+2>TMSH_STREAM_BUF) n = TMSH_STREAM_BUF-i-2;
+          memmove(st->buf+i+1, st->buf, n);
+          memcpy(st->buf, key, i);
+          st->buf[i] = '=';
+          st->buf[i+1+n] = '\n';
+          st->len = i+n+2;
+          for(st->outPos=0; r->stream->outPos<r->stream->len; ) {
+            if((n=Tmsh_outRoom(shParamP))==0) { TM_YIELD(11); continue; }
+            st = r->stream;
+            if(n>st->len-st->outPos) n = st->len-st->outPos;
+            shParam.Out->write((const uint8_t*)st->buf+st->outPos, n);
+            st->outPos += n;
+          }
+        }
+      }
+    } else if(Argc==1) {
+      shParam.Out->printf("%d keys, %ld of %ld bytes live\n", Tmsh_kv.count(), Tmsh_kv.liveBytes(), Tmsh_kv.logBytes());
+    } else { shSyntax(builtin); shParam.Status = 1; }
+  } else if(builtin==SH_BI_SYNC) {            // *** SYNC
+    if(Argc<2 || Argc>3 || (Argc==3 && Argv[1]!="-d")) { shSyntax(builtin); shParam.Status = 1; }
+    else if((r->io.arg=new(std::nothrow) Tmsh_sync(Argv[Argc-1], Argc==3))==NULL) { Serial.print(F("Out of memory.\n")); shParam.Status = 1; }
+    else {
+      // it waits on the network, so all of it is an I/O job
+      if(!Tmsh_ioOffloaded()) Serial.print(F("No I/O worker here:  nothing else runs until the sync is done.\n"));
+      r->io.fn = Tmsh_syncJob;
+      while(!Tmsh_ioSubmit(&r->io)) { TM_YIELD(14); }
+      while(!Tmsh_ioDone(&r->io)) { TM_YIELD(15); }
+      sy = (Tmsh_sync*)r->io.arg;
+      if(sy->ok || sy->files>0) {
+        shParam.Out->printf("%d files:  %d fetched (%ld bytes), %d unchanged, %d failed, %d deleted\n",
+          sy->files, sy->fetched, sy->fetchedBytes, sy->files-sy->fetched-sy->failed, sy->failed, sy->deleted);
+        shParam.Out->printf("%ld of %ld bytes not sent\n", sy->totalBytes-sy->fetchedBytes, sy->totalBytes);
+      }
+      shParam.Status = sy->ok ? 0 : 1;
+      delete sy;
+    }
+  } else if(builtin==SH_BI_SORT && TmshProfile::sortBuf>0) {   // *** SORT
+    field = 0;
+    numeric = unique = false;
+    for(i=1; i<Argc && Argv[i][0]=='-' && field>=0; i++) {
+      if(Argv[i]=="-n") numeric = true;
+      else if(Argv[i]=="-u") unique = true;
+      else if(Argv[i]=="-k" && i+1<Argc && Argv[i+1].toInt()>0) field = Argv[++i].toInt();
+      else field = -1;
+    }
+    if(field<0 || Argc-i!=2) { shSyntax(builtin); shParam.Status = 1; }
+    else if((r->sort=new(std::nothrow) Tmsh_sort())==NULL) { Serial.print(F("Out of memory.\n")); shParam.Status = 1; }
+    else {
+      if(!r->sort->begin(SPIFFS, Argv[i].c_str(), Argv[i+1].c_str(), field, numeric, unique)) { shParam.Status = 1; }
+      else {
+        // a run, or a stretch of a merge, as an I/O job, with a yield between them
+        for(;;) {
+          r->io.fn = Tmsh_sort::stepJob;
+          r->io.arg = r->sort;
+          while(!Tmsh_ioSubmit(&r->io)) { TM_YIELD(16); }
+          while(!Tmsh_ioDone(&r->io)) { TM_YIELD(23); }
+          if((n=r->sort->stepped())<=0) break;
+          TM_YIELD(24);
+        }
+        if(n<0) shParam.Status = 1;
+        else {
+          shParam.Out->printf("%ld lines in, %ld out, %d runs\n", r->sort->linesIn(), r->sort->linesOut(), r->sort->runs());
+          if(r->sort->cut()>0) Serial.printf("%ld lines were cut to %d characters.\n", r->sort->cut(), TMSH_SORT_MAXLINE);
+        }
+      }
+      delete r->sort;
+      r->sort = NULL;
+    }
+  } else if(builtin==SH_BI_LOGCAT) {          // *** LOGCAT
+    if(Argc==2) n = 0;
+    else n = Argc==4 && Argv[2]=="-n" && Argv[3].toInt()>0 ? Argv[3].toInt() : -1;
+    if(n<0) { shSyntax(builtin); shParam.Status = 1; }
+    else if(!shStreamBegin(r, NULL)) { shParam.Status = 1; }
+    else if(!r->stream->log.begin(SPIFFS, Argv[1].c_str(), n)) { Serial.printf("Not a ring log: [%s]\n", Argv[1].c_str()); shParam.Status = 1; }
+    else {
+      // a block at a time, as Out has room for it
+      for(;;) {
+        if((n=Tmsh_outRoom(shParamP))==0) { TM_YIELD(18); continue; }
+        st = r->stream;
+        if((n=st->log.read((uint8_t*)st->buf, n<TMSH_STREAM_BUF ? n : TMSH_STREAM_BUF))==0) break;
+        shParam.Out->write((const uint8_t*)st->buf, n);
+        TM_YIELD(19);
+      }
+    }
+  } else if(builtin==SH_BI_LOGCLEAR) {        // *** LOGCLEAR
+    if(Argc!=2) { shSyntax(builtin); shParam.Status = 1; }
+    else if(!shLogClear(Argv[1].c_str())) { Serial.printf("Not a ring log: [%s]\n", Argv[1].c_str()); shParam.Status = 1; }
+  } else if(builtin==SH_BI_REFLASH) {         // *** REFLASH
   	if(Argc==1) {
 		// just reflash, so use appRoot + binFile
 		//if(otaReflash(hwInfo.host, hwInfo.appRoot+hwInfo.binFile)) Serial.println("Image loaded successfully.");
 		//else Serial.println("Image load failed.");
 
-	} else if(Argc!=2) { Serial.println("Syntax: reflash fn"); }
+	} else if(Argc!=2) { shSyntax(builtin); }
     else {
       //if(otaReflash(hwInfo.host, Argv[1])) { Serial.println("Image loaded successfully."); }
       //else { Serial.println("Image load failed."); }
     }
   } 
 #endif // defined (ESP architecture)
-  else { Serial.println("Invalid command."); }
+  else { Serial.println(F("Invalid command.")); shParam.Status = 1; }
+#if defined(ARDUINO_ARCH_ESP8266) || defined(ARDUINO_ARCH_ESP32)
+  shStreamEnd(r);
+#endif
+  shOutEnd(r);
+  // not for trace start, whose begin came before there was a trace
+  if(r->traced) TMSH_TRACE('E', shIsFileBuiltin(builtin) ? TMSH_TRACE_FILE : TMSH_TRACE_SHELL, "");
+  TM_ENDSUB();
+}
+
+static void shRunSlice(ShRun* r) {
+  // Run a slice of r.  A file builtin's heap use is measured a slice at a time, as in
+  // between, the heap is the other tasks'.
+  bool file = shIsFileBuiltin(r->builtin);
+  if(file) r->heapMark.begin(TMSH_HEAP_FILE);
+  shRun(r);
+  if(file) r->heapMark.end();
+}
+
+static void shellRunTask() { shRunSlice(&shellRun); }
+static void schedRunTask() { shRunSlice(schedRun); }
+static void pipeRunTask() { shRunSlice(&shStages[PIPERUN_TASK-TaskMgr.myId()].run); }
+
+// *** STALLS
+// With the stall detector on, every shell task and user command is registered as
+// shTimedTask, which looks up the real task function by id and times the slice it runs.
+#define SH_FIRST_TASK FSMOUNT_TASK
+static TmshTable<ShTaskFn, (TmshProfile::stallMs>0 ? READLINE_TASK-SH_FIRST_TASK+1 : 0)> shTaskFns;
+static TmshTable<ShTaskFn, (TmshProfile::stallMs>0 ? TmshProfile::maxCommands : 0)> shCmdFns;	// in theCommands' order
+
+static void shTaskName(tm_taskId_t id, char* name) {
+  // the command the task is running, or what the task is
+  ShCommand* c;
+  const char* s = NULL;
+  ShRun* r = NULL;
+  for(c=theCommands; c!=NULL && c->taskId!=id; c=c->next) continue;
+  if(c!=NULL) s = c->cmd;
+  else if(id==SHRUN_TASK) r = &shellRun;
+  else if(id==SCHEDRUN_TASK) r = schedRun;
+  else if(id<=PIPERUN_TASK && id>PIPERUN_TASK-SH_PIPES) r = &shStages[PIPERUN_TASK-id].run;
+  if(r!=NULL && r->param.Argc>0) s = r->param.Argv[0].c_str();
+  if(s!=NULL) {
+    strncpy(name, s, TMSH_STALL_NAME);
+    name[TMSH_STALL_NAME] = '\0';
+    return;
+  }
+  s = id==SHELL_TASK ? PSTR("shell") : id==READLINE_TASK ? PSTR("readline") : id==SCHED_TASK ? PSTR("sched")
+    : id==FSMOUNT_TASK ? PSTR("mount") : id<=PIPE_TASK && id>PIPE_TASK-SH_PIPES ? PSTR("pipe")
+#if defined(ARDUINO_ARCH_ESP8266) || defined(ARDUINO_ARCH_ESP32)
+    : id==ED_TASK || id==ED2_TASK || id==READINTOPASTEBUFFER_TASK ? PSTR("ed")
+    : id==RX_TASK ? PSTR("rx") : id==TX_TASK ? PSTR("tx")
+#endif
+    : PSTR("?");
+  strncpy_P(name, s, TMSH_STALL_NAME);
+  name[TMSH_STALL_NAME] = '\0';
+}
+
+static void shTimedTask() {
+  tm_taskId_t id = TaskMgr.myId();
+  ShCommand* c;
+  ShTaskFn fn;
+  unsigned long t;
+  char name[TMSH_STALL_NAME+1];
+  int i;
+  if(id>=SH_FIRST_TASK && id<=READLINE_TASK) fn = shTaskFns[id-SH_FIRST_TASK];
+  else {
+    for(c=theCommands, i=0; c!=NULL && c->taskId!=id; c=c->next) i++;
+    if(c==NULL) return;
+    fn = shCmdFns[i];
+  }
+  t = micros();
+  fn();
+  t = (micros()-t)/1000;
+  if(t<Tmsh_stallMs) return;
+  shTaskName(id, name);
+  Tmsh_stallNote(name, t);
+}
+
+static ShTaskFn shTimed(tm_taskId_t id, ShTaskFn fn) {
+  // what to register for task id:  shTimedTask, having noted fn for it, or just fn.
+  // A user command is called from addCommand after it's been put on theCommands.
+  if(TmshProfile::stallMs==0) return fn;
+  if(id>=SH_FIRST_TASK && id<=READLINE_TASK) shTaskFns[id-SH_FIRST_TASK] = fn;
+  else shCmdFns[numCommands-1] = fn;
+  return shTimedTask;
+}
+
+static void pipeStageTask() {
+  // There's one of these for each pipeline stage after the first.  It waits for the shell
+  // to give it a command, and runs it alongside the rest of the pipeline.
+  int k = PIPE_TASK-TaskMgr.myId();
+  TM_BEGIN();
+  if(!shStages[k].running) { TM_RETURN(); }
+  TM_CALL(1, PIPERUN_TASK-k);
+  shStageEnd(k+1);
+  TM_END();
+}
+
+static void shellTask() {
+  static Tmsh_readlineParam rp(&shLineBuf);
+  int k;
+  if(!shBoot.ran) {
+    shBoot.firstTask = millis()-shBoot.start;
+    shBoot.ran = true;
+  }
+  TM_BEGIN();
+  Serial.print(F("cmd: "));
+  TM_CALL_P(2, READLINE_TASK, rp);
+  Serial.println(shLineBuf);
+  shellRun.heapMark.begin(TMSH_HEAP_TOKENIZER);
+  Tmsh_readlineBufTokenize(shLineBuf, shellRun.param.Argc, shellRun.param.Argv, &shellRun.quoted);
+  shellRun.heapMark.end();
+  if(shellRun.param.Argc==0) { TM_RETURN(); }	// no line to process
+  if((shNumStages=shSplitPipeline())==0 || !shStartPipeline()) {
+    shNumStages = 1;
+    Tmsh_lastStatus = 1;
+    TM_RETURN();
+  }
+  TM_CALL(1, SHRUN_TASK);
+  shStageEnd(0);
+  while(shPipelineRunning()) { TM_YIELD(3); }
+  // a pipeline's status is its last command's
+  Tmsh_lastStatus = shNumStages==1 ? shellRun.param.Status : shStages[shNumStages-2].run.param.Status;
+  for(k=0; k<shNumStages-1; k++) {
+    if(shPipes[k].dropped==0) continue;
+    Serial.print(F("Pipe ")); Serial.print(k+1); Serial.print(F(" overflowed, "));
+    Serial.print(shPipes[k].dropped); Serial.print(F(" bytes lost.\n"));
+    Tmsh_lastStatus = 1;
+  }
   TM_END();
 }
 
 static void shellAddSubtasks() {
   // add the subtasks for core subtasks and builtin shell commands that aren't handled in shellTask
-  TM_ADDSUBTASK(READLINE_TASK, Tmsh_readlineTask);
+  int k;
+  TM_ADDSUBTASK(READLINE_TASK, shTimed(READLINE_TASK, Tmsh_readlineTask));
+  TM_ADDSUBTASK(SHRUN_TASK, shTimed(SHRUN_TASK, shellRunTask));
+  if(TmshProfile::maxJobs>0) TM_ADDSUBTASK(SCHEDRUN_TASK, shTimed(SCHEDRUN_TASK, schedRunTask));
+  for(k=0; k<TmshProfile::maxStages-1; k++) TM_ADDSUBTASK(PIPERUN_TASK-k, shTimed(PIPERUN_TASK-k, pipeRunTask));
 #if defined(ARDUINO_ARCH_ESP8266) || defined(ARDUINO_ARCH_ESP32)
-  TM_ADDSUBTASK(ED_TASK, Tmsh_edTask);
-  TM_ADDSUBTASK(READINTOPASTEBUFFER_TASK, Tmsh_readIntoPasteBufferTask);
+  if(TmshProfile::editor) {
+    TM_ADDSUBTASK(ED_TASK, shTimed(ED_TASK, Tmsh_edTask));
+    if(TmshProfile::maxJobs>0) TM_ADDSUBTASK(ED2_TASK, shTimed(ED2_TASK, Tmsh_ed2Task));
+    TM_ADDSUBTASK(READINTOPASTEBUFFER_TASK, shTimed(READINTOPASTEBUFFER_TASK, Tmsh_readIntoPasteBufferTask));
+  }
+  if(TmshProfile::fileBuiltins) {
+    TM_ADDSUBTASK(RX_TASK, shTimed(RX_TASK, Tmsh_rxTask));
+    TM_ADDSUBTASK(TX_TASK, shTimed(TX_TASK, Tmsh_txTask));
+  }
 #endif
 }
 
@@ -264,8 +1476,15 @@ void Tmsh_readlineTask() {
     bool done;
     bool lastWasCr;
     static String* readlineBuf;
+    static bool traced;		// the begin event was recorded
+    Tmsh_heapMark heapMark;
     readlineBuf = readlineParam.sp;
+    traced = Tmsh_tracing;
+    TMSH_TRACE('B', TMSH_TRACE_READLINE, "readline");
+    heapMark.begin(TMSH_HEAP_READLINE);
     *readlineBuf = "";
+    readlineBuf->reserve(TmshProfile::readlineMax);	// one allocation for the whole line
+    heapMark.end();
     done = false;
     lastWasCr = false;
     while(!done) {
@@ -282,27 +1501,30 @@ void Tmsh_readlineTask() {
         // CR processing for PuTTY
         if(ch=='\r') { ch='\n'; lastWasCr = true; }
         else if(ch=='\n' && lastWasCr) { lastWasCr=false; continue; } // crlf, skip the lf
-        if(ch=='\n') { Serial << ch; lastWasCr = false; done = true; }
-        else {
+        if(ch=='\n') { Serial << ch; lastWasCr = false; done = true; if(traced) TMSH_TRACE('E', TMSH_TRACE_READLINE, ""); }
+        else if(readlineBuf->length()<TmshProfile::readlineMax) {
           Serial << ch;
+          heapMark.begin(TMSH_HEAP_READLINE);
           *readlineBuf += ch;
+          heapMark.end();
           lastWasCr = false;
-        } // end if(ch=='\n') else
+        } // end if(ch=='\n') else -- chars past readlineMax are dropped
       } // end if(ch==0x08) else
     } // end while !done
   TM_ENDSUB();
 }
 
 #if USING_ARDUINOSSH
-void Tmsh_readlineBufTokenize(String line, int& argc, vector<String>& argv) {
+void Tmsh_readlineBufTokenize(String line, int& argc, vector<String>& argv, uint32_t* quoted) {
 #else
-void Tmsh_readlineBufTokenize(String line, int& argc, Array<String, TMSH_MAX_PARAMS>& argv) {
+void Tmsh_readlineBufTokenize(String line, int& argc, Array<String, TMSH_MAX_PARAMS>& argv, uint32_t* quoted) {
 #endif
   // tokenize readlineBuf into an argc/argv set, up to maxTokens supported.
   // Note that quoted strings are supported, as well as escape char "\" inside the quoted string.
   // Note that up to maxTokens tokens are read in; the rest are discarded unceremoniously
   // An open string at the end of the line will also be discarded.
   // There will be no \r or \n in the string.
+  // If quoted isn't NULL, bit i of it is set if argv[i] was in quotes.
   int curPos;
   int startPos, endPos;   // markers for a single token
   String tok;
@@ -310,6 +1532,7 @@ void Tmsh_readlineBufTokenize(String line, int& argc, Array<String, TMSH_MAX_PAR
   curPos = 0;
   //for(int i=0; i<maxTokens; i++) argv[i] = "";
   argv.clear();
+  if(quoted!=NULL) *quoted = 0;
   // now scan the string, separating on space or tab
   while(curPos<line.length()) {
     // grab a token
@@ -320,6 +1543,7 @@ void Tmsh_readlineBufTokenize(String line, int& argc, Array<String, TMSH_MAX_PAR
     if(curPos==line.length()) break; // spaces were at the end
     // we have a token!  Process it.  Different processing depending on if a " or not
     if(line[curPos]=='"') {
+      if(quoted!=NULL && argv.size()<32) *quoted |= 1UL<<argv.size();
       // double-quoted-string, go to closing '"', including escape-char '\' processing
       // '\' just passes the next char unchanged, no special \t \n etc processing (they become t, n, etc.)
       curPos++;
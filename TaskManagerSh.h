@@ -30,6 +30,8 @@ using namespace std;
 #include <Array.h>
 #endif
 
+#include <TaskManagerShProfile.h>
+
 // shell command tasks are in the range 208-239
 #define READLINE_TASK 239
 #define SHELL_TASK 238
@@ -37,28 +39,53 @@ using namespace std;
 //#define REBOOT_TASK 236
 #if defined(ARDUINO_ARCH_ESP3266) || defined(ARDUINO_ARCH_ESP32)
 #define ED_TASK 236
+#define ED2_TASK 235		// a batch ed session run by an every/at job
+#define RX_TASK 234
+#define TX_TASK 233
 #endif
+#define SHRUN_TASK 232		// runs the command the shell just read
+#define SCHED_TASK 231		// every/at
+#define SCHEDRUN_TASK 230	// runs a scheduled command
+#define PIPE_TASK 229		// 229 down to 227:  a task for each pipeline stage after the first
+#define PIPERUN_TASK 226	// 226 down to 224:  runs that stage's command
+#define FSMOUNT_TASK 223	// mounts the filesystem after begin()
+#define STALLLOG_TASK 222	// writes the stall log (tmshStall.h)
 // end of shell command tasks
+#define TMSH_SCHED_TICK 10	// ms between the scheduler's looks at its jobs
+#define TMSH_MAX_STAGES 4	// the most a profile's maxStages can be
+#define TMSH_PIPE_TICK 2	// ms between an idle pipeline stage's looks for work
+#define TMSH_FSMOUNT_TICK 10	// ms between the mount task's looks at the mount
 
 #if !USING_ARDUINOSSH
-#define TMSH_MAX_PARAMS 10
+// kept for existing user code; the size comes from the profile
+#define TMSH_MAX_PARAMS (TmshProfile::maxParams)
 #endif
 // Note: to maintain compatibility with AVR systems, we need
 // to keep Tmsh_param under 27 bytes.
 // Instead, we pass around Tmsh_paramP things, pointers to Tmsh_param structs.
 struct Tmsh_param {
   int Argc;
+  int Status;		// exit status; the command sets this nonzero on failure
+  Print* Out;		// where the command's output goes:  Serial, a file for > and >>, or a pipe
+  Stream* In;		// where its input comes from:  Serial, or a pipe
 #if USING_ARDUINOSSH
   vector<String> Argv;
-  Tmsh_param(int argc, vector<String> argv): Argc(argc), Argv(argv) {};
+  Tmsh_param(int argc, vector<String> argv): Argc(argc), Status(0), Out(&Serial), In(&Serial), Argv(argv) {};
 #else
   Array<String,TMSH_MAX_PARAMS> Argv;
-  Tmsh_param(int argc, Array<String, TMSH_MAX_PARAMS> argv): Argc(argc), Argv(argv) {};
+  Tmsh_param(int argc, Array<String, TMSH_MAX_PARAMS> argv): Argc(argc), Status(0), Out(&Serial), In(&Serial), Argv(argv) {};
 #endif
-  Tmsh_param(): Argc(0) {}
+  Tmsh_param(): Argc(0), Status(0), Out(&Serial), In(&Serial) {}
 };
 typedef Tmsh_param* Tmsh_paramP;
 
+// For commands in a pipeline (cmd1 | cmd2), where In and Out are pipes.
+// A command that writes a lot should write no more than Tmsh_outRoom() bytes at a time,
+// and yield while it's 0; for Out that isn't a pipe it's 256.  A command that reads In is
+// done with it once Tmsh_inEnded() is true (never, for Serial).
+int Tmsh_outRoom(Tmsh_paramP p);
+bool Tmsh_inEnded(Tmsh_paramP p);
+
 // readline params and routines
 // The parameter to READLINE_TASK
 // It contains a single String*
@@ -69,13 +96,24 @@ struct Tmsh_readlineParam {
   Tmsh_readlineParam() {}
 };
 
+// Exit status of the last command run by the shell
+extern int Tmsh_lastStatus;
+
+#if defined(ARDUINO_ARCH_ESP8266) || defined(ARDUINO_ARCH_ESP32)
+// begin() leaves mounting SPIFFS (and formatting it, if need be) to a task, so that it
+// doesn't hold up the rest of setup().  This is true once SPIFFS can be used.  The file
+// builtins wait for it; a user task that uses SPIFFS should too.
+extern bool Tmsh_fsReady;
+#endif
+
 void Tmsh_readlineTask();
 #if USING_ARDUINOSSH
-void Tmsh_readlineBufTokenize(String line, int& argc, vector<String>(& argv));
+void Tmsh_readlineBufTokenize(String line, int& argc, vector<String>(& argv), uint32_t* quoted=NULL);
 #else
-void Tmsh_readlineBufTokenize(String line, int& argc, Array<String, TMSH_MAX_PARAMS>(& argv));
+void Tmsh_readlineBufTokenize(String line, int& argc, Array<String, TMSH_MAX_PARAMS>(& argv), uint32_t* quoted=NULL);
 #endif
 
+// The shell, sized by TmshProfile (see TaskManagerShProfile.h).
 class TaskManagerSh {
 	public:
 		TaskManagerSh() {};
@@ -0,0 +1,153 @@
+//
+// TaskManager Shell capacity profiles
+//
+// A profile is a struct of compile-time constants that sizes the shell's tables and
+// buffers and says which groups of builtins are compiled in.  A feature that's switched
+// off is dead code as far as the compiler is concerned, and the linker drops it.
+//
+// TaskManagerSh.h picks a profile to match the architecture.  To use a different one,
+// define TMSH_PROFILE as its name in the build flags, e.g.
+//    -DTMSH_PROFILE=TmshProfileAvrMinimal
+// A profile of your own just needs the same members as the ones below.
+//
+// ramBudget is a quarter of the board's RAM, which leaves the rest to the sketch, the
+// core and the stack.  TmshRamUse below is checked against it at compile time.  Set it
+// from the board, not from the profile:  when a profile doesn't fit, shrink its tables
+// rather than raise its budget.
+//
+
+#if !defined(__TASKMANAGERSHPROFILE__)
+#define __TASKMANAGERSHPROFILE__
+
+#include <Arduino.h>
+
+// Bare command shell for small AVRs:  a few user commands, short lines, no filesystem.
+struct TmshProfileAvrMinimal {
+	static constexpr int maxCommands = 6;		// user commands (addCommand)
+	static constexpr int maxCommandLen = 8;		// longest user command name
+	static constexpr int maxParams = 4;			// tokens on a command line, including the command
+	static constexpr int readlineMax = 40;		// longest input line
+	static constexpr int maxJobs = 0;			// every/at jobs, 0 for no scheduler
+	static constexpr int maxStages = 1;			// commands in a pipeline (up to 4), 1 for no pipes
+	static constexpr int pipeBuf = 0;			// bytes in each pipe's ring
+	static constexpr bool fileBuiltins = false;	// ls, cat, cp, ... (needs SPIFFS)
+	static constexpr bool editor = false;		// ed (needs SPIFFS)
+	static constexpr bool heapStats = false;	// heap telemetry and the heap builtin
+	static constexpr bool ioWorker = false;		// flash writes on the other core (ESP32 only)
+	static constexpr int traceEvents = 0;		// event tracer ring size, 0 for none (needs SPIFFS)
+	static constexpr int kvMaxKeys = 0;			// keys in the kv store, 0 for none (needs fileBuiltins)
+	static constexpr long sortBuf = 0;			// sort's arena, 0 for no sort (needs fileBuiltins)
+	static constexpr int stallMs = 0;			// task slices longer than this are stalls, 0 for no detector
+	static constexpr bool stallLog = false;		// also log stalls to SPIFFS (needs SPIFFS)
+	static constexpr int edMaxLines = 1;
+	static constexpr int edMaxBuffers = 1;
+	static constexpr long edArenaSize = 0;
+	static constexpr long ramBudget = 2048/4;	// of an ATmega328's 2 KB
+};
+
+// The Mega2560 shell as it's always been.
+struct TmshProfileAvrMega {
+	static constexpr int maxCommands = 16;
+	static constexpr int maxCommandLen = 12;
+	static constexpr int maxParams = 10;
+	static constexpr int readlineMax = 128;
+	static constexpr int maxJobs = 3;
+	static constexpr int maxStages = 2;
+	static constexpr int pipeBuf = 64;
+	static constexpr bool fileBuiltins = false;
+	static constexpr bool editor = false;
+	static constexpr bool heapStats = false;
+	static constexpr bool ioWorker = false;
+	static constexpr int traceEvents = 0;
+	static constexpr int kvMaxKeys = 0;
+	static constexpr long sortBuf = 0;
+	static constexpr int stallMs = 100;
+	static constexpr bool stallLog = false;
+	static constexpr int edMaxLines = 1;
+	static constexpr int edMaxBuffers = 1;
+	static constexpr long edArenaSize = 0;
+	static constexpr long ramBudget = 8192/4;	// of the ATmega2560's 8 KB
+};
+
+// Everything, for an ESP32.  An ESP8266 builds with it too, but has a quarter of the RAM;
+// give it a profile of its own if the sketch is big.
+struct TmshProfileEsp32Full {
+	static constexpr int maxCommands = 32;
+	static constexpr int maxCommandLen = 16;
+	static constexpr int maxParams = 10;
+	static constexpr int readlineMax = 256;
+	static constexpr int maxJobs = 8;
+	static constexpr int maxStages = 4;
+	static constexpr int pipeBuf = 1024;
+	static constexpr bool fileBuiltins = true;
+	static constexpr bool editor = true;
+	static constexpr bool heapStats = true;
+	static constexpr bool ioWorker = true;
+	static constexpr int traceEvents = 256;
+	static constexpr int kvMaxKeys = 128;
+	static constexpr long sortBuf = 8192;		// only while sort runs
+	static constexpr int stallMs = 50;
+	static constexpr bool stallLog = true;
+	static constexpr int edMaxLines = 100;		// per buffer
+	static constexpr int edMaxBuffers = 4;		// per ed session
+	static constexpr long edArenaSize = 6144;	// per ed session, only while it runs
+	static constexpr long ramBudget = 327680/4;	// of the ESP32's 320 KB of data RAM
+};
+
+#if !defined(TMSH_PROFILE)
+#if defined(ARDUINO_ARCH_ESP8266) || defined(ARDUINO_ARCH_ESP32)
+#define TMSH_PROFILE TmshProfileEsp32Full
+#else
+#define TMSH_PROFILE TmshProfileAvrMega
+#endif
+#endif
+typedef TMSH_PROFILE TmshProfile;
+
+// A table of n T's, for sizing by a profile, that holds nothing when n is 0 (the feature
+// is off).  The code that indexes it still compiles, but can't run then.  So that it's
+// still well defined, every index of an empty table is one spare T, shared by the empty
+// tables of that type.  The spare is there only where the compiler can't see that the
+// code is dead, so it usually costs nothing, and it's never more than one T per type.
+template<class T, int n> struct TmshTable {
+	T slot[n];
+	T& operator[](int i) { return slot[i]; }
+};
+template<class T> struct TmshTable<T, 0> {
+	T& operator[](int) { static T spare; return spare; }
+};
+
+// Roughly what a profile costs in RAM:  the tables with every slot in use, plus the ed
+// sessions at their largest (the shell's, and a batch one from every/at if there are
+// jobs).  Strings are counted at their bare size; the text they hold is extra.  Builtin
+// names and help are in flash and cost nothing here.
+template<class P> struct TmshRamUse {
+	// a list node per user command:  link, task id, name, and the allocator's header
+	static constexpr long commands = P::maxCommands * (long)(2*sizeof(void*)+1+P::maxCommandLen+1);
+	static constexpr long params = 3 * P::maxParams * (long)sizeof(String);
+	static constexpr long readline = P::readlineMax;
+	static constexpr long editor = P::editor
+		? (P::maxJobs>0 ? 2 : 1) * (P::edArenaSize + (4+3*P::edMaxBuffers) * P::edMaxLines * (long)sizeof(void*))
+		: 0;
+	// five areas of five counters, plus the low-water marks
+	static constexpr long heap = P::heapStats ? 27 * (long)sizeof(long) : 0;
+	// about 20 bytes an event
+	static constexpr long trace = P::traceEvents * 20L;
+	// a job is a pre-parsed command line, its redirection and its timing
+	static constexpr long jobs = P::maxJobs * ((P::maxParams+1)*(long)sizeof(String) + 64);
+	// each stage after the first has its own command line and a pipe in front of it
+	static constexpr long pipes = (P::maxStages-1) * (P::pipeBuf + P::maxParams*(long)sizeof(String) + 48);
+	// up to four 12-byte index slots a key, and a buffer for the longest record
+	static constexpr long kv = P::kvMaxKeys>0 ? 4L*P::kvMaxKeys*12 + 600 : 0;
+	// the file I/O worker's stack and queue
+	static constexpr long io = P::ioWorker ? 8192 + 64 : 0;
+	// sort's arena, and its merge inputs, last line and output block
+	static constexpr long sort = P::sortBuf>0 ? P::sortBuf + 16*24L + 256 + 512 + 64 : 0;
+	// eight 24-byte stall slots (and the log's copy of them), and the real task function of
+	// each shell task and user command
+	static constexpr long stalls = P::stallMs>0
+		? (P::stallLog ? 2 : 1) * 8*24L + (17+P::maxCommands)*(long)sizeof(void*) : 0;
+	static constexpr long total = commands + params + readline + editor + heap + trace + jobs + pipes + kv + io + sort
+		+ stalls;
+};
+
+#endif
@@ -2,11 +2,23 @@
 
 ed -- quick and dirty line oriented text editor
 
+ed [-s script] [-e cmd]... [fn]
+    With no -s or -e, ed is interactive.  Otherwise it runs the -e commands, then the
+    lines of the script file, against fn without prompting, echoing or chattering.
+    Text for ia/ib comes from the following script lines, up to a "." line.
+    The first error stops the run.  The exit status (see the shell's status command)
+    is 0 if everything worked, 1 if not.
+
 lines are numbered starting at 1.  line 0 is "first line in file";
 line -1 is "last line in file"
 
 commands supported
     r fil -- read a file
+    e fil -- edit fil in a buffer of its own (or switch to it, if it's already open).
+        All of the buffers share one paste buffer, so d/c in one and pa/pb in another
+        moves lines between files.
+    bn, bp -- switch to the next/previous buffer
+    bl -- list the buffers
     w [fil] -- write to either the current file or the specified file.
         the specified file will become the current file
     ? -- get info on the current file
@@ -25,10 +37,13 @@ commands supported
     d [start [end]] -- delete the specified line(s); save in the paste buffer.  Default: current line.
     c [start [end]] -- copy the specified line(s) to the paste buffer.
     u -- undo the last delete.
-    s str1 str2 [start [end]] -- change txt1 to txt2 in the specified range of lines.
-        str can be a simple word or a "longer string" ("" to have " in string)
-    f str1 [start [end]] -- find the first occurrence of txt1 starting with the specified line
-    b str [start] -- backwards-find for the first occurence of txt1 starting with the specified line
+    s pat str [start [end]] -- change the first match of pat to str in the specified range of lines.
+        pat and str can be a simple word or a "longer string" ("" to have " in string)
+        pat is a regular expression:  . [abc] [^a-z] * + ? | ( ) ^ $ and \c for a literal c.
+        In str, & is the whole match and \1..\9 are the ( ) groups.
+    sa pat str [start [end]] -- change every match of pat to str.  Default: the whole file.
+    f pat [start [end]] -- find the first line matching pat starting with the specified line
+    b pat [start] -- backwards-find for the first line matching pat starting with the specified line
     g n -- go to line n
     + n -- move down n lines
     - n -- move up n lines
@@ -44,108 +59,520 @@ commands supported
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdarg.h>
+#include <new>
 
-// State of the editing buffer
-#if USING_ARDUINOSSH
-static vector<String> theData;
-#else
-// For some reason, the compiler doesn't like TMSH_ED_MAX_LINES
-#define TMSH_ED_MAX_LINES 100
-static Array<String, TMSH_ED_MAX_LINES> theData;
-#endif
-static int currentLine;     // note: this is the PHYSICAL line (0..n-1), not the LOGICAL line (1..n).
-                            // note also:  -1 means "past the last line", for empty files or
-                            //  when you delete the last group of lines.
+#include "utils.h"
+#include "tmshRegex.h"
+#include "tmshHeap.h"
+#include "tmshTrace.h"
+#include "tmshIo.h"
+
+// LINE STORAGE
+// All line text lives in one arena that is allocated when ed starts and freed when it exits.
+// A line is never changed in place:  an edit builds a new line at the top of the arena and
+// the old one becomes garbage.  theData, the paste buffer and the undo copies only hold
+// pointers into the arena, so copying them around is cheap.  When the arena fills up, the
+// live lines are slid down to squeeze out the garbage (arenaCompact()).
+typedef const char* EdLine;
 #if USING_ARDUINOSSH
-static vector<String> pasteBuffer;
+typedef vector<EdLine> EdLineList;
 #else
-static Array<String, TMSH_ED_MAX_LINES> pasteBuffer;
+typedef Array<EdLine, TmshProfile::edMaxLines> EdLineList;
 #endif
-static int deleteSource;   // start line of wherever the paste buffer was grabbed from.
+#define TMSH_ED_READ_BLOCK 512
+#define TMSH_ED_WRITE_BLOCK 1024
 
-static String cmdLine;
-static int clCurPos;
+// EDITOR CONTEXT
+// Everything an ed session needs lives in an EdContext, made when the session starts and
+// thrown away when it ends, so the editor holds no RAM between sessions.  Two sessions
+// can run at once, each in its own task with its own context:  the shell's (ED_TASK),
+// and one run by an every/at job (ED2_TASK), which has to be a batch one (ed -s/-e), as
+// only the shell's can own Serial and the readline and paste tasks.  A session can hold
+// several buffers.  The buffer being edited lives in the working fields (theData,
+// currentLine, ...); the others are parked in buffers[].  Switching buffers only swaps
+// line pointer lists -- nothing is reread from flash.  All of a session's buffers share
+// its paste buffer and arena.
+#define TMSH_ED_SESSIONS 2
 
-static String currentFilename;
-static bool fileModified;
+class EdContext;
 
 // WORLD'S WORST UNDO MECHANISM
+// (less bad now that it only copies line pointers)
 class UndoBuffer {
     public:
         int undoCurrentLine;
         int undoDeleteSource;
-#if USING_ARDUINOSSH
-        vector<String> undoTheData;
-        vector<String> undoPasteBuffer;
-#else
-		Array<String, TMSH_ED_MAX_LINES> undoTheData;
-		Array<String, TMSH_ED_MAX_LINES> undoPasteBuffer;
-#endif
+        EdLineList undoTheData;
+        EdLineList undoPasteBuffer;
     private:
         bool undoBufferEmpty;
     public:
         UndoBuffer(): undoBufferEmpty(true) {}
-        void save() {
+        void save(EdContext& ed);
+        void restore(EdContext& ed);
+        void clear() {
             undoTheData.clear();
             undoPasteBuffer.clear();
-            undoTheData = theData;
-            undoCurrentLine = currentLine;
-            undoPasteBuffer = pasteBuffer;
-            undoDeleteSource = deleteSource;
-            undoBufferEmpty = false;
-        }
-        void restore() {
-            if(!undoBufferEmpty) {
-                theData.clear();
-                pasteBuffer.clear();
-                theData = undoTheData;
-                currentLine = undoCurrentLine;
-                pasteBuffer = undoPasteBuffer;
-                deleteSource = undoDeleteSource;
-                undoBufferEmpty = true;
-            }
+            undoBufferEmpty = true;
         }
 };
 
+// A parked buffer
+struct EdBuffer {
+    String filename;
+    EdLineList lines;
+    int currentLine;
+    bool fileModified;
+    UndoBuffer undo;
+};
+
+class EdContext {
+    public:
+        EdContext(): self(this), finished(false), arena(NULL), arenaUsed(0), arenaPeak(0),
+            currentLine(-1), fileModified(false), nBuffers(1), curBuffer(0), deleteSource(0),
+            batchMode(false), nextBatchCmd(0), edErrors(0), rp(&cmdLine), cmdTraced(false) {}
+        ~EdContext() { arenaEnd(); if(batchScript) batchScript.close(); }
+
+        void run();         // the ed task itself
+        EdContext* self;    // for passing this to subtasks
+        bool finished;      // run() has returned for the last time
+
+        // LINE STORAGE
+        char* arena;        // NULL until the session starts
+        int arenaUsed;
+        int arenaPeak;
+        bool arenaBegin();
+        void arenaEnd();
+        void arenaCompact();
+        char* arenaAlloc(int n);
+        EdLine arenaCopy(const char* s);
+        bool arenaPut(char*& out, const char* src, int len);
+
+        // State of the buffer being edited
+        EdLineList theData;
+        int currentLine;    // note: this is the PHYSICAL line (0..n-1), not the LOGICAL line (1..n).
+                            // note also:  -1 means "past the last line", for empty files or
+                            //  when you delete the last group of lines.
+        String currentFilename;
+        bool fileModified;
+        UndoBuffer undoBuffer;
+
+        // Parked buffers.  buffers[curBuffer] is an empty placeholder for the working buffer.
+        EdBuffer buffers[TmshProfile::edMaxBuffers];
+        int nBuffers;
+        int curBuffer;
+        void parkBuffer();
+        void loadBuffer(int n);
+        int findBuffer(const String& fn);
+
+        // Shared by all the buffers
+        EdLineList pasteBuffer;
+        int deleteSource;   // start line of wherever the paste buffer was grabbed from.
+
+        // Batch mode (ed -s script / ed -e cmd):  commands come from the -e args and then the
+        // script file instead of from the user.  No prompt, no echo, no chatter, and the first
+        // error ends the run with a nonzero exit status.
+        bool batchMode;
+#if USING_ARDUINOSSH
+        vector<String> batchCmds;
+#else
+        Array<String, TMSH_MAX_PARAMS> batchCmds;
+#endif
+        int nextBatchCmd;
+        File batchScript;
+        int edErrors;
+        void edError(const char* fmt, ...);
+        void edInfo(const char* fmt, ...);
+        bool nextBatchLine(String& line);
+        void readBatchIntoPasteBuffer();
+
+        // Command parsing state; these would be statics in an ordinary task
+        String cmdLine;
+        Tmsh_readlineParam rp;
+#if USING_ARDUINOSSH
+        vector<String> Argv;
+#else
+        Array<String, TMSH_MAX_PARAMS> Argv;
+#endif
+        int Argc;
+        String fn;
+        bool done;
+        int line1, line2, res;
+        int insertPoint;
+        bool cmdTraced;     // a trace begin event is open for the current command
+        Tmsh_ioJob ioJob;   // w, while the I/O worker writes the file
+        bool ioOk;
+
+        // Everything else
+        bool readTheFile(const char* fn);
+        bool writeTheFile(const char* fn);
+        int substituteLine(int n, Tmsh_regex* re, const char* rep, bool all);
+        Tmsh_regex* edCompile(const String& pattern);
+        void lineNumFix(int res, int& l1, int& l2, bool currentLineDefault=false);
+        bool lineNumsGood(int line1, int line2);
+        int peelNumber(String word, int& num, bool allowStar=true);
+        int peelTwoNumbers(String word1, String word2, int& n1, int& n2);
+        void insertPasteBufferBefore(int insertPoint);
+};
+
+static EdContext* edSessions[TMSH_ED_SESSIONS];
+
+inline static bool listFull(EdLineList& l) {
+#if USING_ARDUINOSSH
+    return false;
+#else
+    return l.full();
+#endif
+}
+
+void UndoBuffer::save(EdContext& ed) {
+    undoTheData = ed.theData;
+    undoCurrentLine = ed.currentLine;
+    undoPasteBuffer = ed.pasteBuffer;
+    undoDeleteSource = ed.deleteSource;
+    undoBufferEmpty = false;
+}
+
+void UndoBuffer::restore(EdContext& ed) {
+    if(!undoBufferEmpty) {
+        ed.theData = undoTheData;
+        ed.currentLine = undoCurrentLine;
+        ed.pasteBuffer = undoPasteBuffer;
+        ed.deleteSource = undoDeleteSource;
+        undoBufferEmpty = true;
+    }
+}
+
+// BUFFER SWITCHING
+void EdContext::parkBuffer() {
+    EdBuffer& b = buffers[curBuffer];
+    b.filename = currentFilename;
+    b.lines = theData;
+    b.currentLine = currentLine;
+    b.fileModified = fileModified;
+    b.undo = undoBuffer;
+}
+
+void EdContext::loadBuffer(int n) {
+    // The working fields become the live copy, so the parked one is emptied.
+    EdBuffer& b = buffers[n];
+    currentFilename = b.filename;
+    theData = b.lines;
+    currentLine = b.currentLine;
+    fileModified = b.fileModified;
+    undoBuffer = b.undo;
+    b.filename = "";
+    b.lines.clear();
+    b.undo.clear();
+    curBuffer = n;
+}
+
+int EdContext::findBuffer(const String& fn) {
+    for(int i=0; i<nBuffers; i++) {
+        if(i==curBuffer ? currentFilename==fn : buffers[i].filename==fn) return i;
+    }
+    return -1;
+}
+
+// MESSAGES AND BATCH INPUT
+void EdContext::edError(const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    vprintf(fmt, args);
+    va_end(args);
+    edErrors++;
+}
+
+void EdContext::edInfo(const char* fmt, ...) {
+    // progress chatter; quiet in batch mode
+    va_list args;
+    if(batchMode) return;
+    va_start(args, fmt);
+    vprintf(fmt, args);
+    va_end(args);
+}
+
+bool EdContext::nextBatchLine(String& line) {
+    // The next command (or insert text) line for batch mode.  False at the end of the script.
+    if(nextBatchCmd<batchCmds.size()) { line = batchCmds[nextBatchCmd++]; return true; }
+    if(!batchScript || !batchScript.available()) return false;
+    line = batchScript.readStringUntil('\n');
+    if(line.length()>0 && line[line.length()-1]=='\r') line.remove(line.length()-1);
+    return true;
+}
+
+// ARENA CODE
+bool EdContext::arenaBegin() {
+    arena = (char*)malloc(TmshProfile::edArenaSize);
+    arenaUsed = arenaPeak = 0;
+    return arena!=NULL;
+}
+
+void EdContext::arenaEnd() {
+    free(arena);
+    arena = NULL;
+    arenaUsed = 0;
+}
+
+static int ptrCompare(const void* a, const void* b) {
+    EdLine pa = *(const EdLine*)a;
+    EdLine pb = *(const EdLine*)b;
+    return pa<pb ? -1 : pa>pb ? 1 : 0;
+}
+
+static void arenaRemapList(EdLineList& l, EdLine* oldPtrs, EdLine* newPtrs, int n) {
+    for(int i=0; i<l.size(); i++) {
+        EdLine* p = (EdLine*)bsearch(&l[i], oldPtrs, n, sizeof(EdLine), ptrCompare);
+        l[i] = newPtrs[p-oldPtrs];
+    }
+}
+
+void EdContext::arenaCompact() {
+    // Gather every line that is still referenced, sort them by address, slide each one down
+    // to the end of the previous one, then fix up the lists to point at the new copies.
+    EdLineList* lists[4+3*TmshProfile::edMaxBuffers] = { &theData, &pasteBuffer, &undoBuffer.undoTheData, &undoBuffer.undoPasteBuffer };
+    int nLists = 4;
+    int nPtrs, nUnique, i, j;
+    char* dest;
+    for(i=0; i<nBuffers; i++) {
+        lists[nLists++] = &buffers[i].lines;
+        lists[nLists++] = &buffers[i].undo.undoTheData;
+        lists[nLists++] = &buffers[i].undo.undoPasteBuffer;
+    }
+    nPtrs = 0;
+    for(i=0; i<nLists; i++) nPtrs += lists[i]->size();
+    if(nPtrs==0) { arenaUsed = 0; return; }
+    EdLine* oldPtrs = (EdLine*)malloc(2*nPtrs*sizeof(EdLine));
+    if(oldPtrs==NULL) return;   // can't compact; caller will see the arena as full
+    EdLine* newPtrs = oldPtrs + nPtrs;
+    nPtrs = 0;
+    for(i=0; i<nLists; i++) for(j=0; j<lists[i]->size(); j++) oldPtrs[nPtrs++] = (*lists[i])[j];
+    qsort(oldPtrs, nPtrs, sizeof(EdLine), ptrCompare);
+    nUnique = 0;
+    for(i=0; i<nPtrs; i++) if(nUnique==0 || oldPtrs[nUnique-1]!=oldPtrs[i]) oldPtrs[nUnique++] = oldPtrs[i];
+    dest = arena;
+    for(i=0; i<nUnique; i++) {
+        int len = strlen(oldPtrs[i])+1;
+        memmove(dest, oldPtrs[i], len);
+        newPtrs[i] = dest;
+        dest += len;
+    }
+    for(i=0; i<nLists; i++) arenaRemapList(*lists[i], oldPtrs, newPtrs, nUnique);
+    arenaUsed = dest-arena;
+    free(oldPtrs);
+}
+
+char* EdContext::arenaAlloc(int n) {
+    // Returns n bytes from the arena, or NULL if they can't be found even after a compaction.
+    // NOTE: a compaction moves lines, so don't hold an EdLine across a call to this.
+    if(arenaUsed+n>TmshProfile::edArenaSize) arenaCompact();
+    if(arenaUsed+n>TmshProfile::edArenaSize) return NULL;
+    char* p = arena+arenaUsed;
+    arenaUsed += n;
+    if(arenaUsed>arenaPeak) arenaPeak = arenaUsed;
+    return p;
+}
+
+EdLine EdContext::arenaCopy(const char* s) {
+    int len = strlen(s)+1;
+    char* p = arenaAlloc(len);
+    if(p!=NULL) memcpy(p, s, len);
+    return p;
+}
+
 // FILE READ/WRITE CODE
 String addSlash(const char* fn);
 
-static bool readTheFile(const char* fn) {
-    String fntmp = fn;
-    String line;
-
-    int ch;
+bool EdContext::readTheFile(const char* fn) {
+    // The whole file is read into a single arena block, a block at a time,
+    // and split into lines in place by turning each \n into a \0.
+    int fileSize, pos, n;
+    char* buf;
+    char* p;
+    const char* lineStart;
+    unsigned long startTime;
+    recoverFile(SPIFFS, fn);    // a w that a reset cut short
     File f = SPIFFS.open(addSlash(fn).c_str(), FILE_READ);
     if(!f || f.isDirectory()) return false;
 
+    startTime = millis();
     theData.clear();
-    line = "";
-
-    while((ch=f.read())!=-1) {
-        if(ch=='\n') {
-            theData.push_back(line);
-            line = "";
-        } else line += char(ch);
+    fileSize = f.size();
+    if((buf=arenaAlloc(fileSize+1))==NULL) {
+        edError("File too large (%d bytes) for editor memory.\n", fileSize);
+        f.close();
+        return false;
+    }
+    pos = 0;
+    lineStart = buf;
+    while(pos<fileSize && !listFull(theData)) {
+        n = f.read((uint8_t*)buf+pos, min(TMSH_ED_READ_BLOCK, fileSize-pos));
+        if(n<=0) break;
+        for(p=buf+pos; p<buf+pos+n && !listFull(theData); p++) {
+            if(*p=='\n') {
+                *p = '\0';
+                theData.push_back(lineStart);
+                lineStart = p+1;
+            }
+        }
+        pos += n;
+    }
+    buf[pos] = '\0';
+    if(lineStart<buf+pos) {
+        if(listFull(theData)) edError("Too many lines, file truncated.\n");
+        else theData.push_back(lineStart);
     }
-    if(line.length()>0) theData.push_back(line);
     f.close();
+    edInfo("Read %d lines (%d bytes) in %lu ms.\n", (int)theData.size(), pos, millis()-startTime);
     return true;
 }
 
-static bool writeTheFile(const char* fn) {
-  File f = SPIFFS.open(addSlash(fn).c_str(), FILE_WRITE);
-  if(!f || f.isDirectory()) return false;
+static void edWriteJob(void* arg) {
+    EdContext* ed = (EdContext*)arg;
+    ed->ioOk = ed->writeTheFile(ed->fn.c_str());
+}
+
+bool EdContext::writeTheFile(const char* fn) {
+    // Write the buffer to fn.tmp through a block buffer, read it back to check the
+    // length and CRC, then rename it over fn.  A reset part way through leaves fn alone.
+    String target = addSlash(fn);
+    String tmp = target + ".tmp";
+    char* buf;
+    int bufUsed, len, i, n;
+    long bytes;
+    uint32_t crc, checkCrc;
+    unsigned long startTime;
+    bool ok;
 
-    for(int i=0; i<theData.size(); i++) {
-        f.printf("%s\n",theData[i].c_str());
+    startTime = millis();
+    if(!tmpNameFits(fn)) { edError("File name too long [%s]\n", fn); return false; }
+    if((buf=(char*)malloc(TMSH_ED_WRITE_BLOCK))==NULL) return false;
+    File f = SPIFFS.open(tmp.c_str(), FILE_WRITE);
+    if(!f || f.isDirectory()) { free(buf); return false; }
+    ok = true;
+    bytes = 0;
+    bufUsed = 0;
+    crc = 0;
+    for(i=0; i<theData.size() && ok; i++) {
+        const char* src = theData[i];
+        len = strlen(src)+1;    // +1 for the \n
+        while(len>0 && ok) {
+            n = min(len, TMSH_ED_WRITE_BLOCK-bufUsed);
+            if(len==n) { memcpy(buf+bufUsed, src, n-1); buf[bufUsed+n-1] = '\n'; }
+            else memcpy(buf+bufUsed, src, n);
+            src += n; len -= n; bufUsed += n;
+            if(bufUsed==TMSH_ED_WRITE_BLOCK) {
+                ok = f.write((uint8_t*)buf, bufUsed)==(size_t)bufUsed;
+                crc = crc32Update(crc, (uint8_t*)buf, bufUsed);
+                bytes += bufUsed;
+                bufUsed = 0;
+            }
+        }
+    }
+    if(ok && bufUsed>0) {
+        ok = f.write((uint8_t*)buf, bufUsed)==(size_t)bufUsed;
+        crc = crc32Update(crc, (uint8_t*)buf, bufUsed);
+        bytes += bufUsed;
     }
     f.close();
+
+    // verify
+    if(ok) {
+        f = SPIFFS.open(tmp.c_str(), FILE_READ);
+        ok = f && (long)f.size()==bytes;
+        checkCrc = 0;
+        while(ok && (n=f.read((uint8_t*)buf, TMSH_ED_WRITE_BLOCK))>0) checkCrc = crc32Update(checkCrc, (uint8_t*)buf, n);
+        if(f) f.close();
+        ok = ok && checkCrc==crc;
+    }
+    free(buf);
+    if(!ok || !replaceFile(SPIFFS, tmp.c_str(), target.c_str())) {
+        SPIFFS.remove(tmp.c_str());
+        return false;
+    }
+    edInfo("Wrote %d lines (%ld bytes) in %lu ms.\n", (int)theData.size(), bytes, millis()-startTime);
     return true;
 }
 
+bool EdContext::arenaPut(char*& out, const char* src, int len) {
+    // append len bytes at out, if they fit below the end of the arena
+    if(out+len>arena+TmshProfile::edArenaSize) return false;
+    memcpy(out, src, len);
+    out += len;
+    return true;
+}
+
+int EdContext::substituteLine(int n, Tmsh_regex* re, const char* rep, bool all) {
+    // Replace the first (or every) match of re in theData[n] with rep.  In rep, & or \0 stands
+    // for the whole match and \1..\9 for a group; \& and \\ are a literal & and \.
+    // The new line is built in one pass straight into the free space at the top of the arena;
+    // if it doesn't fit, the arena is compacted and we try once more.
+    // Returns the number of substitutions made, or -1 if we ran out of editor memory.
+    int caps[TMSH_RE_NSLOTS];
+    int count, pos, lastEnd, attempt, g;
+    const char* src;
+    const char* r;
+    char* out;
+    bool ok;
+    for(attempt=0; attempt<2; attempt++) {
+        src = theData[n];
+        out = arena+arenaUsed;
+        ok = true;
+        count = 0;
+        pos = 0;
+        lastEnd = -1;
+        while(ok && re->search(src, pos, caps)) {
+            if(caps[1]==caps[0] && caps[0]==lastEnd) {
+                // an empty match where the last one ended (b* after the b of "abc") isn't
+                // a new match; step over a char
+                if(src[pos]=='\0') break;
+                ok = arenaPut(out, src+pos, 1);
+                pos++;
+                continue;
+            }
+            count++;
+            ok = arenaPut(out, src+pos, caps[0]-pos);
+            for(r=rep; ok && *r!='\0'; r++) {
+                g = -1;
+                if(*r=='&') g = 0;
+                else if(*r=='\\' && r[1]>='0' && r[1]<='9') g = *++r-'0';
+                else if(*r=='\\' && r[1]!='\0') r++;
+                if(g==-1) ok = arenaPut(out, r, 1);
+                else if(g<=re->groups() && caps[2*g]!=-1) ok = arenaPut(out, src+caps[2*g], caps[2*g+1]-caps[2*g]);
+            }
+            pos = lastEnd = caps[1];
+            if(caps[1]==caps[0]) {
+                // empty match; step over a char so we don't match here again
+                if(src[pos]=='\0') break;
+                ok = ok && arenaPut(out, src+pos, 1);
+                pos++;
+            }
+            if(!all) break;
+        }
+        if(count==0) return 0;
+        if(ok) ok = arenaPut(out, src+pos, strlen(src+pos)+1);
+        if(ok) {
+            theData[n] = arena+arenaUsed;
+            arenaUsed = out-arena;
+            if(arenaUsed>arenaPeak) arenaPeak = arenaUsed;
+            return count;
+        }
+        arenaCompact();
+    }
+    return -1;
+}
+
+Tmsh_regex* EdContext::edCompile(const String& pattern) {
+    const char* err;
+    Tmsh_regex* re = Tmsh_regexCompile(pattern.c_str(), &err);
+    if(re==NULL) edError("Bad pattern [%s]: %s\n", pattern.c_str(), err);
+    return re;
+}
+
 // *** END of systems interface routines
 
-static void lineNumFix(int res, int& l1, int& l2, bool currentLineDefault=false) {
+void EdContext::lineNumFix(int res, int& l1, int& l2, bool currentLineDefault) {
     // fixes l1 and l2 wrt order, -1 values
     // this is messy because of the way the user can enter -1 and
     // enter the numbers out of order.
@@ -167,12 +594,12 @@ static void lineNumFix(int res, int& l1, int& l2, bool currentLineDefault=false)
     }
 }
 
-inline static bool lineNumsGood(int line1, int line2) {
+bool EdContext::lineNumsGood(int line1, int line2) {
   // makes sure the two values are in the range [1 theData.size()]
   return line1>=1 && line2>=1 && line1<=theData.size() && line2<=theData.size();
 }
 
-static int peelNumber(String word, int& num, bool allowStar=true) {
+int EdContext::peelNumber(String word, int& num, bool allowStar) {
     // Peels a number off of cmdLine.  Advances clCurPos past the number
     // Returns 0 if no number found, 1 if a number found, -1 if a non-numeric thing found
     // Assumes spaces have been pre-peeled.  Does not peel trailing spaces.
@@ -187,7 +614,7 @@ static int peelNumber(String word, int& num, bool allowStar=true) {
     return ret==1 ? 1 : -1;
 }
 
-static int peelTwoNumbers(String word1, String word2, int& n1, int& n2) {
+int EdContext::peelTwoNumbers(String word1, String word2, int& n1, int& n2) {
     // Peels one or two numbers off of cmdLine. Advances clCurPos past whatever was read.
     // Returns 0 if no numbers were found, 1 if one number was found, 2 if two numbers were found.
     // Returns -1 if either object was not a well-formed number.
@@ -201,16 +628,18 @@ static int peelTwoNumbers(String word1, String word2, int& n1, int& n2) {
 }
 
 void Tmsh_readIntoPasteBufferTask() {
-    TM_BEGINSUB();
-    // read lines into the paste buffer until a line with "." is entered.
+    TM_BEGINSUB_P(EdContext*, ed);
+    // read lines into ed's paste buffer until a line with "." is entered.
     // Enter .. for ., ... for .., etc.
     // Any time you need "." to start, add another "."
+    // Only an interactive session uses this, and only the shell's can be one, so the
+    // statics here are safe.
     static String tmpLine;
     static Tmsh_readlineParam rp(&tmpLine);
     static bool done;
     done = false;
     // clear the pastebuffer
-    pasteBuffer.clear();
+    ed->pasteBuffer.clear();
 
     // read lines and append until "." is hit
     while(!done) {
@@ -218,21 +647,39 @@ void Tmsh_readIntoPasteBufferTask() {
 		Serial.println(tmpLine);
         if(tmpLine==".") done = true; // single dot line is ignored
         else {
+          EdLine line;
           if(tmpLine[0]=='.' && tmpLine[1]=='.') tmpLine = tmpLine.substring(1);
-          pasteBuffer.push_back(tmpLine);
+          if(listFull(ed->pasteBuffer) || (line=ed->arenaCopy(tmpLine.c_str()))==NULL) {
+            ed->edError("Out of editor memory, line dropped.\n");
+          } else ed->pasteBuffer.push_back(line);
         }
     }
     TM_ENDSUB();
 }
 
-static void insertPasteBufferBefore(int insertPoint) {
+void EdContext::readBatchIntoPasteBuffer() {
+    // Tmsh_readIntoPasteBufferTask for batch mode: the text comes from the script.
+    String tmpLine;
+    EdLine line;
+    pasteBuffer.clear();
+    while(nextBatchLine(tmpLine) && tmpLine!=".") {
+        if(tmpLine[0]=='.' && tmpLine[1]=='.') tmpLine = tmpLine.substring(1);
+        if(listFull(pasteBuffer) || (line=arenaCopy(tmpLine.c_str()))==NULL) {
+            edError("Out of editor memory, line dropped.\n");
+            return;
+        }
+        pasteBuffer.push_back(line);
+    }
+}
+
+void EdContext::insertPasteBufferBefore(int insertPoint) {
     // insert the paste buffer before the given line.
     // insertPoint==0 then insert at the end (append)
     // insertPoint>=theData.size() or insertPoint==-1 then just insert at the end
 #if USING_ARDUINOSSH
-    vector<String>::iterator ipIt;
+    vector<EdLine>::iterator ipIt;
 #else
-	//ArrayIterator<String> ipIt(theData);
+	//ArrayIterator<EdLine> ipIt(theData);
 #endif
     if(insertPoint>=theData.size() || insertPoint==-1) {
         for(int i=0; i<pasteBuffer.size(); i++) theData.push_back(pasteBuffer[i]);
@@ -249,7 +696,7 @@ static void insertPasteBufferBefore(int insertPoint) {
 			// Pretty inefficient.
 			if(!theData.full()) {
 				// move the rest down
-				theData.push_back("");
+				theData.push_back(NULL);
 				for(int j=theData.size()-1; j>insertPoint+i; j--) {
 					theData[j] = theData[j-1];
 				}
@@ -261,52 +708,68 @@ static void insertPasteBufferBefore(int insertPoint) {
 }
 // *** END of fine-tuning for ESP
 
-void Tmsh_edTask() {
-    static Tmsh_readlineParam rp(&cmdLine);
-#if USING_ARDUINOSSH
-    static vector<String> Argv;
-#else
-	static Array<String, TMSH_MAX_PARAMS> Argv;
-#endif
-    static int Argc;
-    static String fn;
-    static bool ret;
-    static UndoBuffer undoBuffer;
-    static bool done;
-    // things used while parsing lines
-    static int line1, line2, res;
-    static int insertPoint;
+void EdContext::run() {
     TM_BEGINSUB_P(Tmsh_paramP, shParamP);
 
+    edErrors = 0;
+    if(!arenaBegin()) { edError("Not enough memory for the editor.\n"); shParamP->Status = 1; finished = true; TM_RETURN(); }
+
+    // ed [-s script] [-e cmd]... [fn]
+    batchMode = false;
+    batchCmds.clear();
+    nextBatchCmd = 0;
+    fn = "";
+    for(int i=1; i<shParamP->Argc && edErrors==0; i++) {
+        if(shParamP->Argv[i]=="-e" && i+1<shParamP->Argc) {
+            batchMode = true;
+            batchCmds.push_back(shParamP->Argv[++i]);
+        } else if(shParamP->Argv[i]=="-s" && i+1<shParamP->Argc) {
+            batchMode = true;
+            batchScript = SPIFFS.open(addSlash(shParamP->Argv[++i].c_str()).c_str(), FILE_READ);
+            if(!batchScript || batchScript.isDirectory()) edError("Can't read script [%s]\n", shParamP->Argv[i].c_str());
+        } else if(fn.length()==0 && shParamP->Argv[i][0]!='-') fn = shParamP->Argv[i];
+        else edError("Syntax: ed [-s script] [-e cmd]... [fn]\n");
+    }
+
     // If we were passed a file, read it in
-    if(shParamP->Argc == 2) {
-      // have a file, read it in
-      if( (shParamP->Argv)[1].length()==0) { printf("Syntax: ed fn\n"); }
-      else if(!readTheFile(shParamP->Argv[1].c_str())) { printf("Can't read file [%s]\n", shParamP->Argv[1].c_str()); }
-      else { currentFilename = shParamP->Argv[1]; fileModified = true; currentLine = 1; }
+    if(fn.length()>0 && edErrors==0) {
+      if(!readTheFile(fn.c_str())) { edError("Can't read file [%s]\n", fn.c_str()); }
+      else { currentFilename = fn; fileModified = true; currentLine = 1; }
     }
 
-    done = false;
+    done = edErrors>0;
     while(!done) {
-        Serial.print("ed: ");
-        TM_CALL_P(1, READLINE_TASK, rp);
-		Serial.println(cmdLine);
+        // the last command, however it ended, ends here
+        if(cmdTraced) { TMSH_TRACE('E', TMSH_TRACE_ED, ""); cmdTraced = false; }
+        if(batchMode) {
+            if(edErrors>0 || !nextBatchLine(cmdLine)) { done = true; continue; }
+        } else {
+            Serial.print("ed: ");
+            TM_CALL_P(1, READLINE_TASK, rp);
+            Serial.println(cmdLine);
+        }
         Tmsh_readlineBufTokenize(cmdLine, Argc, Argv);
         if(Argc==0) { continue; } // empty line
-        else if(Argv[0]=="?") {
-            if(Argc>1) { printf("Syntax: ?\n"); continue; }
-            else printf("Filename: [%s].  Number of lines: %ld. Current line is %d\n", currentFilename.c_str(), theData.size(), currentLine);
+        cmdTraced = Tmsh_tracing;
+        TMSH_TRACE('B', TMSH_TRACE_ED, Argv[0].c_str());
+        if(Argv[0]=="?") {
+            if(Argc>1) { edError("Syntax: ?\n"); continue; }
+            else {
+                printf("Filename: [%s].  Number of lines: %ld. Current line is %d\n", currentFilename.c_str(), theData.size(), currentLine);
+                printf("Buffer %d of %d.  Editor memory: %d of %d bytes used, peak %d\n",
+                  curBuffer+1, nBuffers, arenaUsed, (int)TmshProfile::edArenaSize, arenaPeak);
+            }
         } else if(Argv[0]=="+") {
-            if(Argc!=2) { printf("Syntax: + num\n"); continue; }
+            if(Argc!=2) { edError("Syntax: + num\n"); continue; }
             res = peelNumber(Argv[1], line1);
-            if(res==-1 || line1<-1 || line1==0) { printf("Syntax: + nlines\n"); continue; }
+            if(res==-1 || line1<-1 || line1==0) { edError("Syntax: + nlines\n"); continue; }
             if(line1==-1 || line1>theData.size()) line1 = theData.size();
             currentLine = min((int)theData.size(),currentLine+line1);
         } else if(Argv[0]=="-") {
             // - num
-            if(Argc!=2) { printf("Syntax: - num\n"); continue; }
+            if(Argc!=2) { edError("Syntax: - num\n"); continue; }
             res = peelNumber(Argv[1],line1);
-            if(res==-1 || line1<-1 || line1==0) { printf("Syntax: - nlines\n"); continue; }
+            if(res==-1 || line1<-1 || line1==0) { edError("Syntax: - nlines\n"); continue; }
             if(line1==-1 || line1>theData.size()) line1 = theData.size();
             currentLine = max(1,currentLine-line1);
         } else if(Argv[0]=="c") {
@@ -316,8 +779,8 @@ void Tmsh_edTask() {
             if(Argc==1) { res = 0; line1 = line2 = currentLine; }
             else if(Argc==2) { res = peelNumber(Argv[1], line1); line2 = line1; }
             else if(Argc==3) { res = peelTwoNumbers(Argv[1], Argv[2], line1, line2); }
-            else { printf("Syntax: c [line1 [line2]]\n"); continue; }
-            if(res==-1 || !lineNumsGood(line1, line2)) { printf("Syntax: c [line1 [line2]]\n"); continue; }
+            else { edError("Syntax: c [line1 [line2]]\n"); continue; }
+            if(res==-1 || !lineNumsGood(line1, line2)) { edError("Syntax: c [line1 [line2]]\n"); continue; }
             pasteBuffer.clear();
             for(n=line1; n<=line2; n++) {
                 pasteBuffer.push_back(theData[n-1]);
@@ -330,12 +793,12 @@ void Tmsh_edTask() {
             if(Argc==1) { res = 0; line1 = line2 = currentLine; }
             else if(Argc==2) { res = peelNumber(Argv[1], line1); line2 = line1; }
             else if(Argc==3) { res = peelTwoNumbers(Argv[1], Argv[2], line1, line2); }
-            else { printf("Syntax: d [line1 [line2]]\n"); continue; }
+            else { edError("Syntax: d [line1 [line2]]\n"); continue; }
             lineNumFix(res, line1, line2);
-            if(res==-1 || !lineNumsGood(line1, line2)) { printf("Syntax: d [line1 [line2]]\n"); continue; }
-            if(line1==line2) printf("Deleting line %d\n", line1);
-            else printf("Deleting %d through %d to pastebuffer\n", line1, line2);
-            undoBuffer.save();
+            if(res==-1 || !lineNumsGood(line1, line2)) { edError("Syntax: d [line1 [line2]]\n"); continue; }
+            if(line1==line2) edInfo("Deleting line %d\n", line1);
+            else edInfo("Deleting %d through %d to pastebuffer\n", line1, line2);
+            undoBuffer.save(*this);
             pasteBuffer.clear();
             for(n=line1; n<=line2; n++) {
                 pasteBuffer.push_back(theData[line1-1]);
@@ -348,11 +811,59 @@ void Tmsh_edTask() {
 			}
             currentLine = line1;
             if(currentLine>theData.size()) currentLine=-1;
+        } else if(Argv[0]=="e") {
+            // e fn -- edit fn in a buffer of its own, or switch to it if it's already open
+            int n;
+            if(Argc!=2 || Argv[1].length()==0) { edError("Syntax: e fn\n"); continue; }
+            if((n=findBuffer(Argv[1]))!=-1) {
+                if(n!=curBuffer) { parkBuffer(); loadBuffer(n); }
+            } else {
+                if(theData.size()>0 || currentFilename.length()>0) {
+                    // current buffer is in use, start a new one
+                    if(nBuffers==TmshProfile::edMaxBuffers) { edError("Too many buffers.\n"); continue; }
+                    parkBuffer();
+                    loadBuffer(nBuffers++);
+                }
+                currentFilename = Argv[1];
+                if(readTheFile(Argv[1].c_str())) { fileModified = true; currentLine = 1; }
+                else { edInfo("New file [%s]\n", Argv[1].c_str()); fileModified = false; currentLine = -1; }
+            }
+            edInfo("Buffer %d: [%s], %d lines\n", curBuffer+1, currentFilename.c_str(), (int)theData.size());
+        } else if(Argv[0]=="bn" || Argv[0]=="bp") {
+            // bn / bp -- switch to the next/previous buffer
+            if(Argc!=1) { edError("Syntax: %s\n", Argv[0].c_str()); continue; }
+            parkBuffer();
+            loadBuffer((curBuffer + (Argv[0]=="bn" ? 1 : nBuffers-1)) % nBuffers);
+            edInfo("Buffer %d: [%s], %d lines\n", curBuffer+1, currentFilename.c_str(), (int)theData.size());
+        } else if(Argv[0]=="bl") {
+            // bl -- list the buffers
+            int n;
+            if(Argc!=1) { edError("Syntax: bl\n"); continue; }
+            for(n=0; n<nBuffers; n++) {
+                if(n==curBuffer) printf("*%d: [%s], %d lines\n", n+1, currentFilename.c_str(), (int)theData.size());
+                else printf(" %d: [%s], %d lines\n", n+1, buffers[n].filename.c_str(), (int)buffers[n].lines.size());
+            }
+        } else if(Argv[0]=="b") {
+            // b pat [line] -- find the nearest line at or above line matching pat
+            int n;
+            Tmsh_regex* re;
+            int caps[TMSH_RE_NSLOTS];
+            if(Argc<2 || Argc>3) { edError("Syntax: b str [line]\n"); continue; }
+            if(Argc==2) { res = 1; line1 = currentLine; }
+            else res = peelNumber(Argv[2], line1);
+            if(res==1 && line1==-1) line1 = theData.size();
+            if(res!=1 || !lineNumsGood(line1, line1)) { edError("Syntax: b str [line]\n"); continue; }
+            if((re=edCompile(Argv[1]))==NULL) continue;
+            for(n=line1; n>=1; n--) if(re->search(theData[n-1], 0, caps)) break;
+            if(n>=1) { currentLine = n; printf("*%3d: %s\n", n, theData[n-1]); }
+            else { edError("Search string not found.\n"); }
         } else if(Argv[0]=="f") {
-            // f str1 [line1 [line2]] -- find first occurrence of str
+            // f pat [line1 [line2]] -- find first line matching pat
             int n;
             bool found;
-            if(Argc<2 || Argc>4) { printf("Syntax: f str [line1 [line2]]\n"); continue; }
+            Tmsh_regex* re;
+            int caps[TMSH_RE_NSLOTS];
+            if(Argc<2 || Argc>4) { edError("Syntax: f str [line1 [line2]]\n"); continue; }
             if(Argc==2) {
               res = 0; line1 = line2 = currentLine;
             } else if(Argc==3) {
@@ -360,47 +871,49 @@ void Tmsh_edTask() {
             } else { // Argc==4
               res = peelTwoNumbers(Argv[2], Argv[3], line1, line2);
             }
-            if(res==0 && currentLine==-1) { printf("At eof, no line to search.\n"); continue; }
+            if(res==0 && currentLine==-1) { edError("At eof, no line to search.\n"); continue; }
             lineNumFix(res, line1, line2);
             if(res==-1 || !lineNumsGood(line1, line2)) {
-                printf("Syntax: f strOld [line1 [line2]]\n");
+                edError("Syntax: f strOld [line1 [line2]]\n");
                 continue;
             }
+            if((re=edCompile(Argv[1]))==NULL) continue;
             found = false;
             for(n=line1; n<=line2 && !found; n++) {
-                if((theData[n-1].indexOf(Argv[1]))!=-1) {
+                if(re->search(theData[n-1], 0, caps)) {
                     currentLine = n;
                     found = true;
                 }
             }
             // Note: subtract an extra -1 because n has been incremented before the exit test.
-            if(found) { printf("*%3d: %s\n", n-1, theData[n-1-1].c_str()); }
-            else { printf("Search string not found.\n"); }
+            if(found) { printf("*%3d: %s\n", n-1, theData[n-1-1]); }
+            else { edError("Search string not found.\n"); }
         } else if(Argv[0]=="g") {
             // g line
-            if(Argc!=2) { printf("Syntax: g line\n"); continue; }
+            if(Argc!=2) { edError("Syntax: g line\n"); continue; }
             res = peelNumber(Argv[1], line1);
-            if(res==-1 || line1<-1 || line1==0) { printf("Syntax: g line\n"); continue; }
+            if(res==-1 || line1<-1 || line1==0) { edError("Syntax: g line\n"); continue; }
             if(line1==-1 || line1>theData.size()) line1 = theData.size();
             currentLine = line1;
         } else if(Argv[0]=="h") {
             // help -- list the commands
             printf("r w -- file read/write\n");
+            printf("e bn bp bl -- edit a file in a new buffer; next/previous buffer; list buffers\n");
             printf("q ? h -- quit, info, help\n");
             printf("g + - -- goto line; go forward or backwards by lines\n");
             printf("t ta tw -- type lines: specific, all, window around current line\n");
-            printf("f s sa -- find a string; substitute first/all occurrences of a string\n");
+            printf("f b s sa -- find a pattern forwards/backwards; substitute first/all matches\n");
             printf("d c -- delete or copy lines to pastebuffer\n");
             printf("ia ib pa pb -- insert new | paste pastebuffer after/before current line\n");
             printf("u -- undo last operation that modified the text\n");
         } else if(Argv[0]=="ia") {
             // ia [line] -- insert after
             int n;
-            if(Argc>2) { printf("Syntax: ia [line]\n"); continue; }
+            if(Argc>2) { edError("Syntax: ia [line]\n"); continue; }
             if(Argc==1) { res = 1; line1 = currentLine; }
             else {
               res = peelNumber(Argv[1],line1);
-              if(res!=1) { printf("Syntax: ia [line1]\n"); continue; }
+              if(res!=1) { edError("Syntax: ia [line1]\n"); continue; }
             }
             // set insertPoint to the point we insert lines BEFORE
             // This will be an index into theData.  It is not a user-line-number.
@@ -410,19 +923,20 @@ void Tmsh_edTask() {
                 if(line1==-1) insertPoint = -1;      // marker for "at the end, not before anything"
                 else insertPoint = line1;
             }
-            undoBuffer.save();
-            TM_CALL(3, READINTOPASTEBUFFER_TASK);
+            undoBuffer.save(*this);
+            if(batchMode) readBatchIntoPasteBuffer();
+            else TM_CALL_P(3, READINTOPASTEBUFFER_TASK, self);
             if(pasteBuffer.size()==0) continue;
             insertPasteBufferBefore(insertPoint);
             currentLine = insertPoint==-1 ? theData.size()-pasteBuffer.size() : insertPoint+1;
         } else if(Argv[0]=="ib") {
             // ib [line] -- insert before
             int n;
-            if(Argc>2) { printf("Syntax: ib [line]\n"); continue; }
+            if(Argc>2) { edError("Syntax: ib [line]\n"); continue; }
             if(Argc==1) { res = 1; line1 = currentLine; }
             else {
               res = peelNumber(Argv[1],line1);
-              if(res!=1) { printf("Syntax: ia [line1]\n"); continue; }
+              if(res!=1) { edError("Syntax: ia [line1]\n"); continue; }
             }
             // set insertPoint to the point we insert lines BEFORE
             // This will be an index into theData.  It is not a user-line-number.
@@ -430,8 +944,9 @@ void Tmsh_edTask() {
             if(res==0) insertPoint = (currentLine==-1 ? -1 : currentLine-1);    // noting entered, use current line
             else if(line1==-1) insertPoint = theData.size()-1;
             else insertPoint = line1-1;
-            undoBuffer.save();
-            TM_CALL(2, READINTOPASTEBUFFER_TASK);
+            undoBuffer.save(*this);
+            if(batchMode) readBatchIntoPasteBuffer();
+            else TM_CALL_P(2, READINTOPASTEBUFFER_TASK, self);
             if(pasteBuffer.size()==0) continue;
             insertPasteBufferBefore(insertPoint);
             currentLine = insertPoint==-1 ? theData.size()-pasteBuffer.size() : insertPoint;
@@ -439,11 +954,11 @@ void Tmsh_edTask() {
             // pa [line] -- paste after
             // sets currentLine to the first line of the inserted block.
             int n;
-            if(Argc>2) { printf("Syntax: ia [line]\n"); continue; }
+            if(Argc>2) { edError("Syntax: ia [line]\n"); continue; }
             if(Argc==1) { res = 1; line1 = currentLine; }
             else {
               res = peelNumber(Argv[1],line1);
-              if(res!=1) { printf("Syntax: ia [line1]\n"); continue; }
+              if(res!=1) { edError("Syntax: ia [line1]\n"); continue; }
             }
             if(pasteBuffer.size()==0) continue;
             // set insertPoint to the point we insert lines BEFORE
@@ -454,18 +969,18 @@ void Tmsh_edTask() {
                 if(line1==-1) insertPoint = -1;      // marker for "at the end, not before anything"
                 else insertPoint = line1;
             }
-            undoBuffer.save();
+            undoBuffer.save(*this);
             insertPasteBufferBefore(insertPoint);
             currentLine = insertPoint==-1 ? theData.size()-pasteBuffer.size() : insertPoint+1;
         } else if(Argv[0]=="pb") {
             // pb [line] -- paste before
             // Sets currentLine to the first line of the pasted block.
             int n;
-            if(Argc>2) { printf("Syntax: ia [line]\n"); continue; }
+            if(Argc>2) { edError("Syntax: ia [line]\n"); continue; }
             if(Argc==1) { res = 1; line1 = currentLine; }
             else {
               res = peelNumber(Argv[1],line1);
-              if(res!=1) { printf("Syntax: ia [line1]\n"); continue; }
+              if(res!=1) { edError("Syntax: ia [line1]\n"); continue; }
             }
             if(pasteBuffer.size()==0) continue;
             // set insertPoint to the point we insert lines BEFORE
@@ -474,36 +989,38 @@ void Tmsh_edTask() {
             if(res==0) insertPoint = (currentLine==-1 ? -1 : currentLine-1);    // noting entered, use current line
             else if(line1==-1) insertPoint = theData.size()-1;
             else insertPoint = line1-1;
-            undoBuffer.save();
+            undoBuffer.save(*this);
             insertPasteBufferBefore(insertPoint);
             currentLine = insertPoint==-1 ? theData.size()-pasteBuffer.size() : insertPoint+1;
         } else if(Argv[0]=="q") {
-            if(Argc!=1) { printf("Syntax: q\n"); continue; }
+            if(Argc!=1) { edError("Syntax: q\n"); continue; }
             else done = true;
         } else if(Argv[0]=="r") {
             // r filename //*****HERE*****
-            if(Argc==1 || Argc>2) { printf("Syntax: r fn\n"); continue; }
-            undoBuffer.save();
-            if(Argv[1].length()==0) { printf("Syntax: r fn\n"); continue; }
-            else if(!readTheFile(Argv[1].c_str())) { printf("Can't read file [%s]\n", Argv[1].c_str()); }
+            if(Argc==1 || Argc>2) { edError("Syntax: r fn\n"); continue; }
+            undoBuffer.save(*this);
+            if(Argv[1].length()==0) { edError("Syntax: r fn\n"); continue; }
+            else if(!readTheFile(Argv[1].c_str())) { edError("Can't read file [%s]\n", Argv[1].c_str()); }
             else { currentFilename = Argv[1]; fileModified = true; currentLine = 1; }
         } else if(Argv[0]=="s") {
             // s str1 str2 [line1 [line2]] -- substitute -- replace str1 with str2 once
             int n;
-            int pos;
+            int subs;
             bool found;
-            if(Argc<3 || Argc>5) { printf("Syntax: s strOld strNew [line1 [line2]]\n"); continue; }
+            Tmsh_regex* re;
+            if(Argc<3 || Argc>5) { edError("Syntax: s strOld strNew [line1 [line2]]\n"); continue; }
             if(Argc==3) { line1 = line2 = currentLine; res = 2; }
             else if(Argc==4) { res = peelNumber(Argv[3], line1); if(res==1) line2=line1; }
             else res = peelTwoNumbers(Argv[3], Argv[4], line1, line2);
-            if(res==0 && currentLine==-1) { printf("At eof, no line to search.\n"); continue; }
+            if(res==0 && currentLine==-1) { edError("At eof, no line to search.\n"); continue; }
             lineNumFix(res, line1, line2);
-            if(res==-1 || !lineNumsGood(line1, line2)) { printf("Syntax: s strOld strNew [line1 [line2]]\n"); continue; }
+            if(res==-1 || !lineNumsGood(line1, line2)) { edError("Syntax: s strOld strNew [line1 [line2]]\n"); continue; }
+            if((re=edCompile(Argv[1]))==NULL) continue;
             found = false;
-            undoBuffer.save();
+            undoBuffer.save(*this);
             for(n=line1; n<=line2 && !found; n++) {
-                if((pos=theData[n-1].indexOf(Argv[1]))!=-1) {
-                    theData[n-1] = theData[n-1].substring(0,pos) + Argv[2] + theData[n-1].substring(pos+Argv[1].length());
+                if((subs=substituteLine(n-1, re, Argv[2].c_str(), false))!=0) {
+                    if(subs==-1) { edError("Out of editor memory.\n"); break; }
                     found = true;
                     currentLine = n;
                 }
@@ -512,83 +1029,130 @@ void Tmsh_edTask() {
             // sa str1 str2 [line1 [line2]] -- substitute all -- replace all str1 with str2
             //string word1, word2;
             int n;
-            int linePos, matchLoc, pos;
-            if(Argc<3 || Argc>5) { printf("Syntax: s strOld strNew [line1 [line2]]\n"); continue; }
-            if(Argc==3) { res = peelNumber(Argv[3], line1); line2 = line1; }
+            int subs;
+            Tmsh_regex* re;
+            if(Argc<3 || Argc>5) { edError("Syntax: s strOld strNew [line1 [line2]]\n"); continue; }
+            if(Argc==3) { res = 0; }
+            else if(Argc==4) { res = peelNumber(Argv[3], line1); line2 = line1; }
             else { res = peelTwoNumbers(Argv[3], Argv[4], line1, line2); }
             lineNumFix(res, line1, line2);
-            if(res==-1 || !lineNumsGood(line1, line2)) { printf("Syntax: s strOld strNew [line1 [line2]]\n"); continue; }
-            undoBuffer.save();
+            if(res==-1 || !lineNumsGood(line1, line2)) { edError("Syntax: s strOld strNew [line1 [line2]]\n"); continue; }
+            if((re=edCompile(Argv[1]))==NULL) continue;
+            undoBuffer.save(*this);
             for(n=line1; n<=line2; n++) {
-                linePos = 0;    // allow for multiple matches in the line
-                while((pos = theData[n-1].indexOf(Argv[1],linePos))!=-1) {
-                    theData[n-1] = theData[n-1].substring(0,pos) + Argv[2] + theData[n-1].substring(pos+Argv[1].length());
-                    linePos = pos + Argv[2].length();
-                    currentLine = n;
+                if((subs=substituteLine(n-1, re, Argv[2].c_str(), true))==-1) {
+                    edError("Out of editor memory.\n");
+                    break;
                 }
+                if(subs>0) currentLine = n;
             }
         } else if(Argv[0]=="t") {
             // t [line1 [line2]]
             int n;
-            if(Argc==1 || Argc>3) { printf("Syntax: t [line1 [line2]]\n"); continue; }
+            if(Argc==1 || Argc>3) { edError("Syntax: t [line1 [line2]]\n"); continue; }
             if(Argc==2) {
               res = peelNumber(Argv[1], line1); line2 = line1;
-              if(res!=1) { printf("Syntax: t [line1 [line2]]"); continue; }
+              if(res!=1) { edError("Syntax: t [line1 [line2]]"); continue; }
             } else {
               res = peelNumber(Argv[2], line2); if(res==1) res=2; // force res to -1 0 2
-              if(res!=2) { printf("Syntax: t [line1 [line2]]"); continue; }
+              if(res!=2) { edError("Syntax: t [line1 [line2]]"); continue; }
             }
             lineNumFix(res, line1, line2, true);
-            if(res==-1  || !lineNumsGood(line1, line2)) { printf("Syntax: t [line1 [line2]]"); continue; }
-            if(!(line1==currentLine&&line2==currentLine) && (line1<1 || line2>theData.size())) { printf("Line number out of range.\n"); continue; }
+            if(res==-1  || !lineNumsGood(line1, line2)) { edError("Syntax: t [line1 [line2]]"); continue; }
+            if(!(line1==currentLine&&line2==currentLine) && (line1<1 || line2>theData.size())) { edError("Line number out of range.\n"); continue; }
             for(n=line1; n<=theData.size() && n<=line2; n++) {
-                printf("%c%.3d: %s\n", n==currentLine?'*':' ', n, theData[n-1].c_str());
+                printf("%c%.3d: %s\n", n==currentLine?'*':' ', n, theData[n-1]);
             }
         } else if(Argv[0]=="ta") {
             // ta
             int n;
-            if(Argc!=1) { printf("Syntax: ta\n"); continue; }
+            if(Argc!=1) { edError("Syntax: ta\n"); continue; }
             for(n=1; n<=theData.size(); n++) {
-                printf("%c%.3d: %s\n", n==currentLine?'*':' ', n, theData[n-1].c_str());
+                printf("%c%.3d: %s\n", n==currentLine?'*':' ', n, theData[n-1]);
             }
         } else if(Argv[0]=="tw") {
             // tw [num]
             int nLines;
             int n;
             int tmpCurrentLine;
-            if(Argc>2) { printf("Syntax: tw [line]\n"); continue; }
+            if(Argc>2) { edError("Syntax: tw [line]\n"); continue; }
             if(Argc==1) { res = 1; nLines = 1; }
             else {
               res = peelNumber(Argv[1], nLines);
-              if(res!=1) { printf("Syntax: tw [line1]\n"); continue; }
+              if(res!=1) { edError("Syntax: tw [line1]\n"); continue; }
             }
             tmpCurrentLine = currentLine==-1 ? theData.size()+1 : currentLine;
             line1 = max(1, tmpCurrentLine-nLines);
             line2 = min((int)theData.size(), currentLine+nLines);
             for(n=line1; n<=line2; n++) {
-                printf("%c%.3d: %s\n", n==currentLine?'*':' ', n, theData[n-1].c_str());
+                printf("%c%.3d: %s\n", n==currentLine?'*':' ', n, theData[n-1]);
             }
         } else if(Argv[0]=="u") {
             // u -- undelete lines
-            undoBuffer.restore();
+            undoBuffer.restore(*this);
         } else if(Argv[0]=="w") {
             // w [filename]
             if(Argc==1) fn = currentFilename;
             else if(Argc==2) fn = Argv[1];
-            else { printf("Syntax: w [fn]\n"); continue; }
-            if(fn.length()==0) { printf("Syntax: w [fn]\n"); continue; }
-            if(!writeTheFile(fn.c_str())) { printf("Can't write file[%s]\n", fn.c_str()); }
+            else { edError("Syntax: w [fn]\n"); continue; }
+            if(fn.length()==0) { edError("Syntax: w [fn]\n"); continue; }
+            // the write and its check go to the I/O worker; the rest of the loop runs meanwhile
+            ioJob.fn = edWriteJob;
+            ioJob.arg = this;
+            while(!Tmsh_ioSubmit(&ioJob)) { TM_YIELD(4); }
+            while(!Tmsh_ioDone(&ioJob)) { TM_YIELD(5); }
+            if(!ioOk) { edError("Can't write file[%s]\n", fn.c_str()); }
             else fileModified = false;
         } else {
-            printf("unknown command.\n");
+            edError("unknown command.\n");
         }
     }
-    // clean up
-    theData.clear();
-    pasteBuffer.clear();
-    currentFilename = "";
+    if(cmdTraced) TMSH_TRACE('E', TMSH_TRACE_ED, "");
+    // clean up is done by the destructor
+    shParamP->Status = edErrors>0 ? 1 : 0;
+    finished = true;
     TM_ENDSUB();
 }
 
+static void edSessionStep(int session) {
+    // Run the next step of an ed session.  The session's context is created on its first
+    // step and thrown away after its last.
+    if(edSessions[session]==NULL && (edSessions[session]=new(std::nothrow) EdContext())==NULL) {
+        TM_BEGINSUB_P(Tmsh_paramP, shParamP);
+        printf("Not enough memory for the editor.\n");
+        shParamP->Status = 1;
+        TM_ENDSUB();
+        return;
+    }
+    edSessions[session]->run();
+    if(edSessions[session]->finished) {
+        delete edSessions[session];
+        edSessions[session] = NULL;
+    }
+}
+
+static void edSessionTask(int session) {
+    Tmsh_heapMark heapMark;
+    heapMark.begin(TMSH_HEAP_ED);
+    edSessionStep(session);
+    heapMark.end();
+}
+
+void Tmsh_edTask() { edSessionTask(0); }
+void Tmsh_ed2Task() { edSessionTask(1); }
+
+long Tmsh_edMemUse() {
+    // RAM held by the running ed sessions:  their contexts and arenas.
+    long n;
+    int i;
+    n = 0;
+    for(i=0; i<TMSH_ED_SESSIONS; i++) {
+        if(edSessions[i]==NULL) continue;
+        n += sizeof(EdContext);
+        if(edSessions[i]->arena!=NULL) n += TmshProfile::edArenaSize;
+    }
+    return n;
+}
+
 #endif // ESP architecture
 
@@ -0,0 +1,16 @@
+#!/bin/sh
+#
+# Build the host test programs into extras/host/bin:
+#    node       the shell, for an ESP32 with the full profile, on a POSIX host
+#    tmshxfer   the rx/tx client (../tmshxfer.cpp)
+#
+# Then run the tests:  ./xfertest.sh (rx/tx), ./synctest.sh (sync; needs python3)
+#
+set -e
+cd "$(dirname "$0")"
+mkdir -p bin/include
+# some of the library spells it arduino.h; it can't sit beside Arduino.h on every filesystem
+echo '#include <Arduino.h>' >bin/include/arduino.h
+${CXX:-g++} -std=gnu++11 -O1 -pthread -DARDUINO_ARCH_ESP32 -DTMSH_HOST \
+	-Istubs -Ibin/include -I../.. -o bin/node node.cpp host.cpp ../../*.cpp
+${CXX:-g++} -O2 -o bin/tmshxfer ../tmshxfer.cpp
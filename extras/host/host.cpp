@@ -0,0 +1,306 @@
+//
+// The shell on a POSIX host -- see host.h
+//
+#include <Arduino.h>
+#include <TaskManagerSub.h>
+#include <FS.h>
+#include <SPIFFS.h>
+#include <TaskManagerSh.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <map>
+
+#include "host.h"
+
+const char* hostRoot = "fsroot";
+
+// *** TIME
+static unsigned long hostStart = micros();
+
+unsigned long micros() {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec*1000000UL + t.tv_nsec/1000 - hostStart;
+}
+unsigned long millis() { return micros()/1000; }
+void delay(unsigned long ms) { usleep(ms*1000); }
+void yield() {}
+
+// *** STRING
+String::String(const char* x): s(x!=NULL ? x : "") {}
+String::String(const String& o): s(o.s) {}
+String::String(char c): s(1, c) {}
+String::String(int v): s(std::to_string(v)) {}
+String::String(unsigned int v): s(std::to_string(v)) {}
+String::String(long v): s(std::to_string(v)) {}
+String::String(unsigned long v): s(std::to_string(v)) {}
+String::String(const __FlashStringHelper* f): s((const char*)f) {}
+String& String::operator=(const String& o) { s = o.s; return *this; }
+String& String::operator=(const char* o) { s = o; return *this; }
+unsigned int String::length() const { return s.size(); }
+const char* String::c_str() const { return s.c_str(); }
+char String::operator[](unsigned int i) const { return i<s.size() ? s[i] : 0; }
+char& String::operator[](unsigned int i) { return s[i]; }
+String String::substring(unsigned int a, unsigned int b) const {
+	String r;
+	if(a<s.size() && b>a) r.s = s.substr(a, b-a);
+	return r;
+}
+String String::substring(unsigned int a) const { String r; if(a<s.size()) r.s = s.substr(a); return r; }
+int String::indexOf(const String& x, unsigned int from) const { size_t p = s.find(x.s, from); return p==std::string::npos ? -1 : p; }
+int String::indexOf(char c, unsigned int from) const { size_t p = s.find(c, from); return p==std::string::npos ? -1 : p; }
+int String::lastIndexOf(char c) const { size_t p = s.rfind(c); return p==std::string::npos ? -1 : p; }
+void String::remove(unsigned int i) { if(i<s.size()) s.erase(i); }
+void String::remove(unsigned int i, unsigned int n) { if(i<s.size()) s.erase(i, n); }
+bool String::reserve(unsigned int n) { s.reserve(n); return true; }
+String& String::operator+=(const String& o) { s += o.s; return *this; }
+String& String::operator+=(const char* o) { s += o; return *this; }
+String& String::operator+=(char c) { s += c; return *this; }
+bool String::concat(const char* p, unsigned int n) { s.append(p, n); return true; }
+bool String::operator==(const String& o) const { return s==o.s; }
+bool String::operator==(const char* o) const { return s==o; }
+bool String::operator!=(const String& o) const { return s!=o.s; }
+bool String::operator!=(const char* o) const { return s!=o; }
+bool String::startsWith(const String& o) const { return s.compare(0, o.s.size(), o.s)==0; }
+bool String::endsWith(const String& o) const { return s.size()>=o.s.size() && s.compare(s.size()-o.s.size(), o.s.size(), o.s)==0; }
+long String::toInt() const { return atol(s.c_str()); }
+void String::trim() {
+	while(!s.empty() && isspace((unsigned char)s[s.size()-1])) s.erase(s.size()-1);
+	while(!s.empty() && isspace((unsigned char)s[0])) s.erase(0, 1);
+}
+void String::toCharArray(char* b, unsigned int n) const { if(n>0) { strncpy(b, s.c_str(), n); b[n-1] = '\0'; } }
+String operator+(const String& a, const String& b) { String r(a); r.s += b.s; return r; }
+String operator+(const String& a, const char* b) { String r(a); r.s += b; return r; }
+String operator+(const char* a, const String& b) { String r(a); r.s += b.s; return r; }
+String operator+(const String& a, char b) { String r(a); r.s += b; return r; }
+
+// *** PRINT, STREAM
+size_t Print::write(const uint8_t* b, size_t n) { size_t i; for(i=0; i<n && write(b[i])==1; i++) continue; return i; }
+size_t Print::write(const char* s) { return write((const uint8_t*)s, strlen(s)); }
+size_t Print::print(const char* s) { return write((const uint8_t*)s, strlen(s)); }
+size_t Print::print(const String& s) { return print(s.c_str()); }
+size_t Print::print(const __FlashStringHelper* f) { return print((const char*)f); }
+size_t Print::print(char c) { return write((uint8_t)c); }
+size_t Print::print(int v, int) { return print(std::to_string(v).c_str()); }
+size_t Print::print(unsigned int v, int) { return print(std::to_string(v).c_str()); }
+size_t Print::print(long v, int) { return print(std::to_string(v).c_str()); }
+size_t Print::print(unsigned long v, int) { return print(std::to_string(v).c_str()); }
+size_t Print::print(double v, int) { return print(std::to_string(v).c_str()); }
+size_t Print::println() { return print('\n'); }
+size_t Print::printf(const char* fmt, ...) {
+	char buf[1024];
+	va_list args;
+	va_start(args, fmt);
+	vsnprintf(buf, sizeof(buf), fmt, args);
+	va_end(args);
+	return print(buf);
+}
+String Stream::readStringUntil(char t) { String r; int c; while((c=read())>=0 && c!=t) r += (char)c; return r; }
+size_t Stream::readBytes(char* b, size_t n) { size_t i; int c; for(i=0; i<n && (c=read())>=0; i++) b[i] = c; return i; }
+size_t Stream::readBytes(uint8_t* b, size_t n) { return readBytes((char*)b, n); }
+
+EspClass ESP;
+void EspClass::restart() { exit(0); }
+uint32_t EspClass::getFreeHeap() { return 200000; }
+uint32_t EspClass::getMinFreeHeap() { return 200000; }
+uint32_t EspClass::getMaxAllocHeap() { return 100000; }
+uint32_t EspClass::getHeapSize() { return 320000; }
+
+// *** SERIAL
+// On a pty, a byte takes 10 bit times each way, and the send side has a FIFO, as on a
+// UART, so throughput is what a real link would give.  Incoming bytes are let through
+// at the line rate too.
+#define HOST_TX_FIFO 128
+
+HardwareSerial Serial;
+static int serialFd = -1;			// the pty, or -1 for a script
+static double byteUs;				// 0 for no pacing
+static double txFree;				// micros() when the FIFO will be empty
+static std::string rxBuf;			// read from the pty; rxBuf[rxPos..rxArrived) have "arrived"
+static size_t rxPos, rxArrived;
+static double rxClock;				// when the byte at rxArrived arrives
+
+void hostSerialPty(int fd, long baud) {
+	serialFd = fd;
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL)|O_NONBLOCK);
+	byteUs = baud>0 ? 10e6/baud : 0;
+}
+
+void hostSerialScript() {
+	serialFd = -1;
+	byteUs = 0;
+}
+
+void hostType(const char* line) {
+	rxBuf += line;
+	rxBuf += '\r';
+	rxArrived = rxBuf.size();
+}
+
+static void rxPoll() {
+	uint8_t b[256];
+	ssize_t n;
+	double now;
+	if(rxPos==rxBuf.size()) { rxBuf.clear(); rxPos = rxArrived = 0; }
+	if(serialFd<0) return;
+	now = micros();
+	if(rxArrived==rxBuf.size() && rxClock<now) rxClock = now;	// the line was idle
+	if(rxBuf.size()-rxPos<1024 && (n=::read(serialFd, b, sizeof(b)))>0) rxBuf.append((const char*)b, n);
+	if(byteUs==0) { rxArrived = rxBuf.size(); return; }
+	while(rxArrived<rxBuf.size() && now-rxClock>=byteUs) {
+		rxArrived++;
+		rxClock += byteUs;
+	}
+}
+
+int HardwareSerial::available() { rxPoll(); return rxArrived-rxPos; }
+int HardwareSerial::read() { rxPoll(); return rxPos<rxArrived ? (uint8_t)rxBuf[rxPos++] : -1; }
+int HardwareSerial::peek() { rxPoll(); return rxPos<rxArrived ? (uint8_t)rxBuf[rxPos] : -1; }
+
+int HardwareSerial::availableForWrite() {
+	double queued;
+	if(byteUs==0) return HOST_TX_FIFO;
+	queued = (txFree-micros())/byteUs;
+	return queued<=0 ? HOST_TX_FIFO : queued<HOST_TX_FIFO ? HOST_TX_FIFO-(int)(queued+0.999) : 0;
+}
+
+size_t HardwareSerial::write(const uint8_t* b, size_t n) {
+	size_t i, k;
+	ssize_t w;
+	for(i=0; i<n; i+=k) {
+		// as much as there's room for in the FIFO, waiting for room if there's none
+		while((k=availableForWrite())==0) usleep((unsigned)byteUs+1);
+		if(k>n-i) k = n-i;
+		if(byteUs>0) txFree = (txFree>micros() ? txFree : micros()) + k*byteUs;
+		if(serialFd<0) { fwrite(b+i, 1, k, stdout); continue; }
+		while((w=::write(serialFd, b+i, k))<0) usleep(100);
+		k = w;
+	}
+	return n;
+}
+
+size_t HardwareSerial::write(uint8_t c) { return write(&c, 1); }
+
+// *** FILES
+static std::string hostPath(const char* p) { return std::string(hostRoot) + (p[0]=='/' ? "" : "/") + p; }
+
+size_t fs::File::write(uint8_t c) { return write(&c, 1); }
+size_t fs::File::write(const uint8_t* b, size_t n) { return fp!=NULL ? fwrite(b, 1, n, fp) : 0; }
+size_t fs::File::read(uint8_t* b, size_t n) { return fp!=NULL ? fread(b, 1, n, fp) : 0; }
+int fs::File::read() { int c = fp!=NULL ? fgetc(fp) : EOF; return c==EOF ? -1 : c; }
+int fs::File::peek() { int c = fp!=NULL ? fgetc(fp) : EOF; if(c==EOF) return -1; ungetc(c, fp); return c; }
+int fs::File::available() { return fp!=NULL ? size()-position() : 0; }
+void fs::File::flush() { if(fp!=NULL) fflush(fp); }
+bool fs::File::seek(uint32_t pos, SeekMode mode) {
+	return fp!=NULL && fseek(fp, pos, mode==SeekSet ? SEEK_SET : mode==SeekCur ? SEEK_CUR : SEEK_END)==0;
+}
+size_t fs::File::position() const { return fp!=NULL ? ftell(fp) : 0; }
+size_t fs::File::size() const {
+	struct stat st;
+	if(fp==NULL) return 0;
+	fflush(fp);
+	return fstat(fileno(fp), &st)==0 ? st.st_size : 0;
+}
+void fs::File::close() {
+	if(fp!=NULL) fclose(fp);
+	if(dir!=NULL) closedir((DIR*)dir);
+	fp = NULL;
+	dir = NULL;
+}
+fs::File fs::File::openNextFile(const char*) {
+	struct dirent* e;
+	while(dir!=NULL && (e=readdir((DIR*)dir))!=NULL) {
+		if(e->d_name[0]!='.') return SPIFFS.open((std::string("/")+e->d_name).c_str());
+	}
+	return File();
+}
+
+fs::File fs::FS::open(const char* path, const char* mode, bool) {
+	File f;
+	struct stat st;
+	std::string real = hostPath(path);
+	f.path_ = path;
+	if(mode[0]=='r' && stat(real.c_str(), &st)==0 && S_ISDIR(st.st_mode)) f.dir = opendir(real.c_str());
+	else f.fp = fopen(real.c_str(), strcmp(mode, "r+")==0 ? "r+b" : mode[0]=='r' ? "rb" : mode[0]=='w' ? "wb" : "ab");
+	return f;
+}
+bool fs::FS::exists(const char* path) { return access(hostPath(path).c_str(), F_OK)==0; }
+bool fs::FS::remove(const char* path) { return ::remove(hostPath(path).c_str())==0; }
+bool fs::FS::rename(const char* from, const char* to) {
+	// SPIFFS won't rename onto a file that's there
+	if(exists(to)) return false;
+	return ::rename(hostPath(from).c_str(), hostPath(to).c_str())==0;
+}
+
+SPIFFSFS SPIFFS;
+bool SPIFFSFS::begin(bool) { mkdir(hostRoot, 0755); return true; }
+bool SPIFFSFS::format() { return true; }
+size_t SPIFFSFS::totalBytes() { return 1<<20; }
+size_t SPIFFSFS::usedBytes() { return 0; }
+
+// *** TASKS
+struct HostTask {
+	void (*fn)();
+	int label;
+	bool sub, active, blocked;
+	int parent;
+	char param[64];
+	unsigned long every, next;
+};
+static std::map<int, HostTask> tasks;
+static int curTask = -1;
+TaskManager TaskMgr;
+
+int tm_label() { return tasks[curTask].label; }
+void tm_set(int n) { tasks[curTask].label = n; }
+void* tm_param() { return tasks[curTask].param; }
+
+void tm_call(tm_taskId_t id, const void* p, size_t n) {
+	HostTask& t = tasks.at(id);
+	if(t.active) { fprintf(stderr, "host: task %d called while it's running\n", id); exit(3); }
+	t.active = true;
+	t.label = 0;
+	t.parent = curTask;
+	if(n>sizeof(t.param)) { fprintf(stderr, "host: task %d's parameter is too big\n", id); exit(3); }
+	memcpy(t.param, p, n);
+	tasks[curTask].blocked = true;
+}
+
+void TaskManager::add(tm_taskId_t id, void (*fn)()) {
+	HostTask t;
+	memset(&t, 0, sizeof(t));
+	t.fn = fn;
+	t.active = true;
+	t.parent = -1;
+	tasks[id] = t;
+}
+void TaskManager::addAutoWaitDelay(tm_taskId_t id, void (*fn)(), unsigned long ms) { add(id, fn); tasks[id].every = ms; }
+void TaskManager::addWaitDelay(tm_taskId_t id, void (*fn)(), unsigned long ms) { add(id, fn); tasks[id].next = millis()+ms; }
+void TaskManager::addSubtask(tm_taskId_t id, void (*fn)()) { add(id, fn); tasks[id].sub = true; tasks[id].active = false; }
+tm_taskId_t TaskManager::myId() { return curTask; }
+
+void hostLoopOnce() {
+	std::map<int, HostTask>::iterator i;
+	for(i=tasks.begin(); i!=tasks.end(); ++i) {
+		HostTask& t = i->second;
+		if(!t.active || t.blocked || (long)(millis()-t.next)<0) continue;
+		curTask = i->first;
+		t.fn();
+		if(t.label!=0) continue;
+		// it returned
+		if(t.sub) { t.active = false; tasks[t.parent].blocked = false; }
+		else if(t.every>0) t.next = millis()+t.every;
+	}
+}
+
+bool hostIdle() {
+	std::map<int, HostTask>::iterator i;
+	if(Serial.available()>0) return false;
+	for(i=tasks.begin(); i!=tasks.end(); ++i) {
+		if(i->second.sub && i->second.active && i->first!=READLINE_TASK) return false;
+	}
+	return true;
+}
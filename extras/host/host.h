@@ -0,0 +1,25 @@
+//
+// The shell on a POSIX host, for testing:  what node.cpp needs from host.cpp
+//
+// SPIFFS is a directory.  Serial is either a pty, paced to a baud rate the way a UART
+// would be, or lines handed to it one at a time from a script, with its output on
+// stdout.  TaskManager is a small round robin loop, run a pass at a time.
+//
+
+#if !defined(__TMSHHOST__)
+#define __TMSHHOST__
+
+extern const char* hostRoot;	// SPIFFS; "fsroot" unless it's set before anything runs
+
+// Serial on fd (a pty master) at baud bits/s, or unpaced if baud is 0.
+void hostSerialPty(int fd, long baud);
+// Serial from what hostType() gives it, to stdout.  The default.
+void hostSerialScript();
+void hostType(const char* line);
+
+// One pass of the task loop.
+void hostLoopOnce();
+// Whether the shell is waiting for a line, and nothing else is running or typed ahead.
+bool hostIdle();
+
+#endif
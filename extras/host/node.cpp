@@ -0,0 +1,89 @@
+//
+// node -- the shell built for a POSIX host, for the tests here (see build.sh)
+//
+//    node [-r dir] [-b baud] -p      the shell on a new pty, whose name is printed first;
+//                                    runs until it's killed
+//    node [-r dir] script            types script's lines at the shell, each once the
+//                                    shell is waiting for one, and exits at the end
+//
+// SPIFFS is the directory dir (./fsroot).  On a pty, -b paces Serial to that many
+// bits/s, as a UART would, so tmshxfer's throughput figures mean something.  In a
+// script, "#sleep ms" lets the loop run for ms before the next line.
+//
+#define _XOPEN_SOURCE 600
+#include <Arduino.h>
+#include <TaskManagerSub.h>
+#include <TaskManagerSh.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <termios.h>
+
+#include "host.h"
+
+static int openPty(long baud) {
+	// A pty, with its other end held open so that it stays up between clients.
+	struct termios t;
+	int fd;
+	if((fd=posix_openpt(O_RDWR|O_NOCTTY))<0 || grantpt(fd)<0 || unlockpt(fd)<0) return -1;
+	if(open(ptsname(fd), O_RDWR|O_NOCTTY)<0 || tcgetattr(fd, &t)<0) return -1;
+	cfmakeraw(&t);
+	tcsetattr(fd, TCSANOW, &t);
+	hostSerialPty(fd, baud);
+	printf("%s\n", ptsname(fd));
+	fflush(stdout);
+	return fd;
+}
+
+static void settle() {
+	// Run the loop until the shell has been waiting for a line for a few passes in a row,
+	// as a command that's just ended takes a pass or two to get back to it.
+	int idle;
+	for(idle=0; idle<5; idle = hostIdle() ? idle+1 : 0) hostLoopOnce();
+}
+
+static int runScript(const char* fn) {
+	FILE* fp;
+	char line[512];
+	unsigned long until;
+	size_t n;
+	if((fp=fopen(fn, "r"))==NULL) { perror(fn); return 1; }
+	while(fgets(line, sizeof(line), fp)!=NULL) {
+		n = strlen(line);
+		while(n>0 && (line[n-1]=='\n' || line[n-1]=='\r')) line[--n] = '\0';
+		settle();
+		if(strncmp(line, "#sleep ", 7)==0) {
+			for(until=millis()+atol(line+7); (long)(millis()-until)<0; usleep(100)) hostLoopOnce();
+			continue;
+		}
+		hostType(line);
+	}
+	settle();
+	fclose(fp);
+	return 0;
+}
+
+int main(int argc, char** argv) {
+	long baud;
+	bool pty;
+	int i;
+	baud = 0;
+	pty = false;
+	for(i=1; i<argc && argv[i][0]=='-'; i++) {
+		if(strcmp(argv[i], "-p")==0) pty = true;
+		else if(strcmp(argv[i], "-b")==0 && i+1<argc) baud = atol(argv[++i]);
+		else if(strcmp(argv[i], "-r")==0 && i+1<argc) hostRoot = argv[++i];
+		else break;
+	}
+	if(pty ? i!=argc : i+1!=argc) {
+		fprintf(stderr, "usage: node [-r dir] [-b baud] -p\n"
+		                "       node [-r dir] script\n");
+		return 2;
+	}
+	if(pty && openPty(baud)<0) { perror("pty"); return 1; }
+	if(!pty) hostSerialScript();
+
+	TaskMgrSh.begin();
+	if(!pty) return runScript(argv[i]);
+	for(;;) hostLoopOnce();
+}
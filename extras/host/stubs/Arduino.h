@@ -0,0 +1,139 @@
+//
+// Host stand-in for the Arduino core:  just what the shell uses.  See ../host.cpp.
+//
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <ctype.h>
+#include <algorithm>
+#include <string>
+using std::min;
+using std::max;
+
+// no separate flash
+#define PROGMEM
+#define PGM_P const char*
+#define PSTR(s) (s)
+class __FlashStringHelper;
+#define F(s) (reinterpret_cast<const __FlashStringHelper*>(s))
+inline uint8_t pgm_read_byte(const void* p) { return *(const uint8_t*)p; }
+inline uint16_t pgm_read_word(const void* p) { return *(const uint16_t*)p; }
+inline const void* pgm_read_ptr(const void* p) { return *(const void* const*)p; }
+#define strcmp_P strcmp
+#define strlen_P strlen
+#define strcpy_P strcpy
+#define strncpy_P strncpy
+#define memcpy_P memcpy
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void yield();
+
+class String {
+	public:
+		std::string s;
+		String(const char* s="");
+		String(const String&);
+		String(char c);
+		String(int);
+		String(unsigned int);
+		String(long);
+		String(unsigned long);
+		String(const __FlashStringHelper*);
+		String& operator=(const String&);
+		String& operator=(const char*);
+		unsigned int length() const;
+		const char* c_str() const;
+		char operator[](unsigned int) const;
+		char& operator[](unsigned int);
+		String substring(unsigned int from, unsigned int to) const;
+		String substring(unsigned int from) const;
+		int indexOf(const String&, unsigned int from=0) const;
+		int indexOf(char, unsigned int from=0) const;
+		int lastIndexOf(char) const;
+		void remove(unsigned int at);
+		void remove(unsigned int at, unsigned int n);
+		bool reserve(unsigned int);
+		String& operator+=(const String&);
+		String& operator+=(const char*);
+		String& operator+=(char);
+		bool concat(const char*, unsigned int);
+		bool operator==(const String&) const;
+		bool operator==(const char*) const;
+		bool operator!=(const String&) const;
+		bool operator!=(const char*) const;
+		bool startsWith(const String&) const;
+		bool endsWith(const String&) const;
+		long toInt() const;
+		void trim();
+		void toCharArray(char*, unsigned int) const;
+};
+String operator+(const String&, const String&);
+String operator+(const String&, const char*);
+String operator+(const char*, const String&);
+String operator+(const String&, char);
+
+class Print {
+	public:
+		virtual ~Print() {}
+		virtual size_t write(uint8_t) = 0;
+		virtual size_t write(const uint8_t* b, size_t n);
+		size_t write(const char* s);
+		size_t write(const char* b, size_t n) { return write((const uint8_t*)b, n); }
+		virtual int availableForWrite() { return 0; }
+		virtual void flush() {}
+		size_t print(const char*);
+		size_t print(const String&);
+		size_t print(const __FlashStringHelper*);
+		size_t print(char);
+		size_t print(int, int=10);
+		size_t print(unsigned int, int=10);
+		size_t print(long, int=10);
+		size_t print(unsigned long, int=10);
+		size_t print(double, int=2);
+		size_t println();
+		template<class T> size_t println(T v) { return print(v)+print('\n'); }
+		size_t printf(const char*, ...) __attribute__((format(printf, 2, 3)));
+};
+template<class T> inline Print& operator<<(Print& p, T v) { p.print(v); return p; }
+
+class Stream: public Print {
+	public:
+		virtual int available() = 0;
+		virtual int read() = 0;
+		virtual int peek() = 0;
+		size_t readBytes(char*, size_t);
+		size_t readBytes(uint8_t*, size_t);
+		void setTimeout(unsigned long) {}
+		String readStringUntil(char);
+};
+
+// Serial is a pty or a script; see host.h
+class HardwareSerial: public Stream {
+	public:
+		void begin(unsigned long) {}
+		operator bool() { return true; }
+		size_t write(uint8_t);
+		size_t write(const uint8_t*, size_t);
+		int availableForWrite();
+		int available();
+		int read();
+		int peek();
+		void flush() {}
+};
+extern HardwareSerial Serial;
+
+class EspClass {
+	public:
+		void restart();
+		uint32_t getFreeHeap();
+		uint32_t getMinFreeHeap();
+		uint32_t getMaxAllocHeap();
+		uint32_t getHeapSize();
+};
+extern EspClass ESP;
@@ -0,0 +1,27 @@
+//
+// Host stand-in for the Array library:  a fixed-capacity vector.
+//
+#pragma once
+#include <stddef.h>
+
+template<typename T, size_t MAX> class Array {
+	public:
+		Array(): size_(0) {}
+		T& operator[](size_t i) { return values_[i]; }
+		const T& operator[](size_t i) const { return values_[i]; }
+		T& at(size_t i) { return values_[i]; }
+		T& back() { return values_[size_-1]; }
+		T* data() { return values_; }
+		void push_back(const T& v) { if(size_<MAX) values_[size_++] = v; }
+		void pop_back() { if(size_>0) size_--; }
+		void remove(size_t i) { for(size_t j=i; j+1<size_; j++) values_[j] = values_[j+1]; size_--; }
+		void clear() { size_ = 0; }
+		size_t size() const { return size_; }
+		size_t max_size() const { return MAX; }
+		bool empty() const { return size_==0; }
+		bool full() const { return size_==MAX; }
+
+	private:
+		T values_[MAX];
+		size_t size_;
+};
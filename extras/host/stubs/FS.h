@@ -0,0 +1,51 @@
+//
+// Host stand-in for the ESP filesystem API, over a directory (see hostRoot in ../host.h).
+// Flat, like SPIFFS:  files are straight under the directory.
+//
+#pragma once
+#include <Arduino.h>
+
+#define FILE_READ "r"
+#define FILE_WRITE "w"
+#define FILE_APPEND "a"
+
+namespace fs {
+
+enum SeekMode { SeekSet, SeekCur, SeekEnd };
+
+class File: public Stream {
+	public:
+		FILE* fp = NULL;
+		void* dir = NULL;		// a DIR*, if this is the directory
+		std::string path_;
+
+		size_t write(uint8_t);
+		size_t write(const uint8_t*, size_t);
+		int available();
+		int read();
+		int peek();
+		void flush();
+		size_t read(uint8_t*, size_t);
+		bool seek(uint32_t pos, SeekMode mode=SeekSet);
+		size_t position() const;
+		size_t size() const;
+		void close();
+		operator bool() const { return fp!=NULL || dir!=NULL; }
+		const char* name() const { return path_.c_str(); }
+		const char* path() const { return path_.c_str(); }
+		bool isDirectory() { return dir!=NULL; }
+		File openNextFile(const char* mode=FILE_READ);
+};
+
+class FS {
+	public:
+		File open(const char* path, const char* mode=FILE_READ, bool create=false);
+		File open(const String& path, const char* mode=FILE_READ) { return open(path.c_str(), mode); }
+		bool exists(const char* path);
+		bool remove(const char* path);
+		bool rename(const char* from, const char* to);
+};
+
+}
+using fs::File;
+using fs::FS;
@@ -0,0 +1,53 @@
+//
+// Host stand-in for the ESP HTTPClient:  an HTTP/1.0 GET, which is all the shell does.
+//
+#pragma once
+#include <WiFi.h>
+
+#define HTTP_CODE_OK 200
+
+class HTTPClient {
+	public:
+		bool begin(WiFiClient& client, const String& url) {
+			std::string u = url.c_str();
+			size_t slash, colon;
+			c = &client;
+			if(u.compare(0, 7, "http://")!=0) return false;
+			u = u.substr(7);
+			slash = u.find('/');
+			path = slash==std::string::npos ? "/" : u.substr(slash);
+			host = u.substr(0, slash);
+			port = 80;
+			if((colon=host.find(':'))!=std::string::npos) {
+				port = atoi(host.c_str()+colon+1);
+				host = host.substr(0, colon);
+			}
+			return true;
+		}
+		void useHTTP10(bool) {}
+		int GET() {
+			std::string req, hdr;
+			size_t at;
+			uint8_t ch;
+			if(!c->connect(host.c_str(), port)) return -1;
+			req = "GET " + path + " HTTP/1.0\r\nHost: " + host + "\r\n\r\n";
+			c->write((const uint8_t*)req.data(), req.size());
+			while(hdr.size()<4 || hdr.compare(hdr.size()-4, 4, "\r\n\r\n")!=0) {
+				if(c->read(&ch, 1)!=1) return -1;
+				hdr += (char)ch;
+			}
+			for(at=0; at<hdr.size(); at++) hdr[at] = tolower(hdr[at]);
+			at = hdr.find("content-length:");
+			size = at==std::string::npos ? -1 : atol(hdr.c_str()+at+15);
+			return atoi(hdr.c_str()+9);
+		}
+		long getSize() { return size; }
+		WiFiClient* getStreamPtr() { return c; }
+		void end() { if(c!=NULL) c->stop(); }
+
+	private:
+		WiFiClient* c = NULL;
+		std::string host, path;
+		int port;
+		long size = -1;
+};
@@ -0,0 +1,15 @@
+//
+// Host stand-in for SPIFFS:  the directory hostRoot (see ../host.h).
+//
+#pragma once
+#include <FS.h>
+
+class SPIFFSFS: public fs::FS {
+	public:
+		bool begin(bool formatOnFail=false);
+		bool format();
+		size_t totalBytes();
+		size_t usedBytes();
+		void end() {}
+};
+extern SPIFFSFS SPIFFS;
@@ -0,0 +1,36 @@
+//
+// Host stand-in for TaskManager:  the task macros the shell uses, over a small round
+// robin loop (see ../host.cpp).  A called subtask runs in its caller's place until it
+// returns.  Locals don't survive a yield, as with the real one.
+//
+#pragma once
+#include <Arduino.h>
+
+typedef uint8_t tm_taskId_t;
+
+int tm_label();
+void tm_set(int label);
+void* tm_param();
+void tm_call(tm_taskId_t id, const void* param, size_t size);
+
+class TaskManager {
+	public:
+		void add(tm_taskId_t id, void (*fn)());
+		void addAutoWaitDelay(tm_taskId_t id, void (*fn)(), unsigned long ms);
+		void addWaitDelay(tm_taskId_t id, void (*fn)(), unsigned long ms);
+		void addSubtask(tm_taskId_t id, void (*fn)());
+		tm_taskId_t myId();
+		unsigned long runtime() { return millis(); }
+};
+extern TaskManager TaskMgr;
+
+#define TM_BEGIN() switch(tm_label()) { case 0:
+#define TM_END() } tm_set(0);
+#define TM_YIELD(n) do { tm_set(n); return; case n:; } while(0)
+#define TM_CALL(n, id) do { tm_call(id, 0, 0); tm_set(n); return; case n:; } while(0)
+#define TM_CALL_P(n, id, p) do { tm_call(id, &(p), sizeof(p)); tm_set(n); return; case n:; } while(0)
+#define TM_RETURN() do { tm_set(0); return; } while(0)
+#define TM_BEGINSUB() switch(tm_label()) { case 0:
+#define TM_BEGINSUB_P(type, name) type name = *(type*)tm_param(); switch(tm_label()) { case 0:
+#define TM_ENDSUB() } tm_set(0); return;
+#define TM_ADDSUBTASK(id, fn) TaskMgr.addSubtask(id, fn)
@@ -0,0 +1,45 @@
+//
+// Host stand-in for the ESP WiFiClient:  a TCP connection over a POSIX socket.
+//
+#pragma once
+#include <Arduino.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <errno.h>
+
+class WiFiClient: public Stream {
+	public:
+		int fd = -1;
+
+		bool connect(const char* host, int port) {
+			struct addrinfo hints, *res;
+			char ps[8];
+			bool ok;
+			memset(&hints, 0, sizeof(hints));
+			hints.ai_family = AF_INET;
+			hints.ai_socktype = SOCK_STREAM;
+			snprintf(ps, sizeof(ps), "%d", port);
+			if(getaddrinfo(host, ps, &hints, &res)!=0) return false;
+			fd = socket(res->ai_family, res->ai_socktype, 0);
+			ok = fd>=0 && ::connect(fd, res->ai_addr, res->ai_addrlen)==0;
+			freeaddrinfo(res);
+			if(!ok) stop();
+			return ok;
+		}
+		void stop() { if(fd>=0) ::close(fd); fd = -1; }
+		bool connected() {
+			char c;
+			int r;
+			if(fd<0) return false;
+			r = ::recv(fd, &c, 1, MSG_PEEK|MSG_DONTWAIT);
+			return r>0 || (r<0 && errno==EAGAIN);
+		}
+		int available() { int n = 0; if(fd>=0) ioctl(fd, FIONREAD, &n); return n; }
+		int read() { uint8_t c; return read(&c, 1)==1 ? c : -1; }
+		int read(uint8_t* b, size_t n) { return fd>=0 ? ::recv(fd, b, n, 0) : -1; }
+		int peek() { return -1; }
+		size_t write(uint8_t c) { return write(&c, 1); }
+		size_t write(const uint8_t* b, size_t n) { return fd>=0 ? ::send(fd, b, n, 0) : 0; }
+};
@@ -0,0 +1,75 @@
+#!/bin/sh
+#
+# sync against a local web server (Python's http.server):  the first sync fetches every
+# file, a second fetches none, a changed file is fetched on its own, and -d deletes one
+# that's gone from the manifest.  The node's copies are checked against the server's
+# each time.  Build first (./build.sh).
+#
+#    PORT=8765 ./synctest.sh
+#
+cd "$(dirname "$0")"
+PORT=${PORT:-8765}
+
+dir=$(mktemp -d)
+pid=
+trap '[ -n "$pid" ] && kill $pid; rm -rf "$dir"' EXIT
+mkdir -p "$dir/fsroot" "$dir/www/node"
+www=$dir/www/node
+url=http://127.0.0.1:$PORT/node/manifest.txt
+
+manifest() {
+	# a manifest of the files in www, less any named on the command line
+	python3 - "$www" "$@" <<-'EOF'
+	import os, sys, zlib
+	www, skip = sys.argv[1], sys.argv[2:]
+	with open(os.path.join(www, "manifest.txt"), "w") as m:
+	    m.write("# path size crc32\n")
+	    for fn in sorted(os.listdir(www)):
+	        if fn=="manifest.txt" or fn in skip: continue
+	        data = open(os.path.join(www, fn), "rb").read()
+	        m.write("%s %d %08x\n" % (fn, len(data), zlib.crc32(data) & 0xffffffff))
+	EOF
+}
+
+fail=0
+sync() {
+	# sync with $1 (-d or nothing), and check the totals line says $2 fetched, $3 deleted
+	echo "sync $1 $url" >"$dir/script"
+	bin/node -r "$dir/fsroot" "$dir/script" >"$dir/out.txt"
+	sed -n 's/^\([0-9]* files:.*\)/    \1/p' "$dir/out.txt"
+	grep -q "files:  $2 fetched .* $3 deleted" "$dir/out.txt" || { echo "FAIL: sync $1 should fetch $2, delete $3"; cat "$dir/out.txt"; fail=1; }
+}
+same() {
+	for fn in "$@"; do cmp -s "$www/$fn" "$dir/fsroot/$fn" || { echo "FAIL: $fn differs"; fail=1; }; done
+}
+
+head -c 3000 /dev/urandom >"$www/a.bin"
+echo "name=node7" >"$www/b.cfg"
+head -c 20000 /dev/urandom >"$www/c.bin"
+manifest
+
+python3 -m http.server "$PORT" --bind 127.0.0.1 --directory "$dir/www" >/dev/null 2>&1 &
+pid=$!
+for i in 1 2 3 4 5 6 7 8 9 10; do
+	python3 -c "import socket; socket.create_connection(('127.0.0.1', $PORT), 1)" 2>/dev/null && break
+	sleep 0.2
+done
+
+echo "first sync:"
+sync "" 3 0
+same a.bin b.cfg c.bin
+echo "again, with nothing changed:"
+sync "" 0 0
+echo "b.cfg changed:"
+echo "name=node8" >"$www/b.cfg"
+manifest
+sync "" 1 0
+same a.bin b.cfg c.bin
+echo "c.bin gone from the manifest, with -d:"
+manifest c.bin
+sync -d 0 1
+same a.bin b.cfg
+[ -e "$dir/fsroot/c.bin" ] && { echo "FAIL: c.bin wasn't deleted"; fail=1; }
+
+[ $fail = 0 ] && echo "PASS: sync against http://127.0.0.1:$PORT"
+exit $fail
@@ -0,0 +1,41 @@
+#!/bin/sh
+#
+# rx/tx over a pty:  put a file on the node with tmshxfer, get it back, and check that
+# both copies match and that each way ran at MIN% or more of the line rate.  Build first
+# (./build.sh).
+#
+#    BAUD=460800 MIN=80 SIZE=65536 ./xfertest.sh
+#
+cd "$(dirname "$0")"
+BAUD=${BAUD:-460800}
+MIN=${MIN:-80}
+SIZE=${SIZE:-65536}
+
+dir=$(mktemp -d)
+pid=
+trap '[ -n "$pid" ] && kill $pid; rm -rf "$dir"' EXIT
+mkdir "$dir/fsroot"
+bin/node -r "$dir/fsroot" -b "$BAUD" -p >"$dir/pty" &
+pid=$!
+for i in 1 2 3 4 5 6 7 8 9 10; do [ -s "$dir/pty" ] && break; sleep 0.2; done
+pty=$(head -n 1 "$dir/pty")
+[ -n "$pty" ] || { echo "FAIL: the node didn't start"; exit 1; }
+head -c "$SIZE" /dev/urandom >"$dir/in.bin"
+
+fail=0
+rate() {
+	# the percentage of the line rate on tmshxfer's last line, vs MIN
+	pct=$(tail -n 1 "$1" | sed -n 's/.*(\([0-9]*\)% of the line rate).*/\1/p')
+	if [ -z "$pct" ] || [ "$pct" -lt "$MIN" ]; then echo "FAIL: $2 ran at ${pct:-?}% of the line rate"; fail=1; fi
+}
+
+bin/tmshxfer -b "$BAUD" "$pty" put "$dir/in.bin" big.bin | tee "$dir/put.txt"
+cmp "$dir/in.bin" "$dir/fsroot/big.bin" || { echo "FAIL: put"; fail=1; }
+rate "$dir/put.txt" put
+
+bin/tmshxfer -b "$BAUD" "$pty" get big.bin "$dir/out.bin" | tee "$dir/get.txt"
+cmp "$dir/in.bin" "$dir/out.bin" || { echo "FAIL: get"; fail=1; }
+rate "$dir/get.txt" get
+
+[ $fail = 0 ] && echo "PASS: $SIZE bytes each way at $BAUD baud"
+exit $fail
@@ -0,0 +1,364 @@
+//
+// tmshxfer -- host side of the shell's rx/tx file transfer (see ../tmshXfer.h)
+//
+//    tmshxfer [-b baud] port put localfn remotefn
+//    tmshxfer [-b baud] port get remotefn localfn
+//
+// put types "rx remotefn" at the shell and sends the file; get types "tx remotefn" and
+// receives it into localfn.part, renamed to localfn when it checks out.  Run either one
+// again after an interruption and it carries on from where it stopped.
+//
+// POSIX only.  Build with
+//    g++ -O2 -o tmshxfer tmshxfer.cpp
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <termios.h>
+#include <sys/select.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include "../tmshXfer.h"
+
+static int port = -1;
+
+// *** CRC32 (the same one as crc32Update in utils.cpp)
+static uint32_t crcTable[256];
+
+static uint32_t crc32Update(uint32_t crc, const uint8_t* p, size_t n) {
+	int i, k;
+	if(crcTable[1]==0) {
+		for(i=0; i<256; i++) {
+			uint32_t c = i;
+			for(k=0; k<8; k++) c = c&1 ? 0xEDB88320 ^ (c>>1) : c>>1;
+			crcTable[i] = c;
+		}
+	}
+	crc = ~crc;
+	while(n--) crc = crcTable[(crc^*p++)&0xff] ^ (crc>>8);
+	return ~crc;
+}
+
+static uint32_t getLe32(const uint8_t* p) {
+	return p[0] | ((uint32_t)p[1]<<8) | ((uint32_t)p[2]<<16) | ((uint32_t)p[3]<<24);
+}
+
+static void putLe32(uint8_t* p, uint32_t v) {
+	p[0] = v; p[1] = v>>8; p[2] = v>>16; p[3] = v>>24;
+}
+
+static double now() {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec/1e6;
+}
+
+// *** SERIAL PORT
+
+static speed_t baudConst(long baud) {
+	switch(baud) {
+		case 9600: return B9600;
+		case 19200: return B19200;
+		case 38400: return B38400;
+		case 57600: return B57600;
+		case 115200: return B115200;
+		case 230400: return B230400;
+#if defined(B460800)
+		case 460800: return B460800;
+		case 921600: return B921600;
+#endif
+	}
+	return 0;
+}
+
+static bool openPort(const char* dev, long baud) {
+	struct termios t;
+	speed_t sp;
+	if((sp=baudConst(baud))==0) { fprintf(stderr, "unsupported baud rate %ld\n", baud); return false; }
+	if((port=open(dev, O_RDWR|O_NOCTTY))<0) { perror(dev); return false; }
+	if(tcgetattr(port, &t)<0) { perror("tcgetattr"); return false; }
+	cfmakeraw(&t);
+	cfsetispeed(&t, sp);
+	cfsetospeed(&t, sp);
+	t.c_cflag |= CLOCAL|CREAD;
+	t.c_cc[VMIN] = 0;
+	t.c_cc[VTIME] = 0;
+	if(tcsetattr(port, TCSANOW, &t)<0) { perror("tcsetattr"); return false; }
+	tcflush(port, TCIOFLUSH);
+	return true;
+}
+
+static void writeAll(const uint8_t* p, size_t n) {
+	ssize_t w;
+	while(n>0) {
+		if((w=write(port, p, n))<0) { if(errno==EINTR || errno==EAGAIN) continue; perror("write"); exit(1); }
+		p += w; n -= w;
+	}
+}
+
+// Next byte from the port, or -1 after timeout seconds with nothing.
+static int readByte(double timeout) {
+	static uint8_t buf[1024];
+	static int have, used;
+	fd_set fds;
+	struct timeval tv;
+	int n;
+	if(used<have) return buf[used++];
+	FD_ZERO(&fds);
+	FD_SET(port, &fds);
+	tv.tv_sec = (long)timeout;
+	tv.tv_usec = (long)((timeout-tv.tv_sec)*1e6);
+	if(select(port+1, &fds, NULL, NULL, &tv)<=0) return -1;
+	if((n=read(port, buf, sizeof(buf)))<=0) return -1;
+	have = n;
+	used = 1;
+	return buf[0];
+}
+
+// *** FRAMES
+
+struct Frame {
+	uint8_t type, seq;
+	int len;
+	uint8_t data[TMSH_XFER_MAXDATA];
+};
+
+static void sendFrame(uint8_t type, uint8_t seq, const uint8_t* data=NULL, int len=0) {
+	uint8_t out[TMSH_XFER_FRAME];
+	out[0] = TMSH_XFER_SOH;
+	out[1] = type;
+	out[2] = seq;
+	out[3] = len;
+	out[4] = len>>8;
+	if(len>0) memcpy(out+TMSH_XFER_HDR, data, len);
+	putLe32(out+TMSH_XFER_HDR+len, crc32Update(0, out+1, TMSH_XFER_HDR-1+len));
+	writeAll(out, TMSH_XFER_HDR+len+4);
+}
+
+// Wait for a frame.  1 for a good one, 0 for a bad one, -1 on timeout.
+static int getFrame(Frame& f, double timeout) {
+	uint8_t in[TMSH_XFER_FRAME];
+	int n, c, len;
+	double end;
+	end = now()+timeout;
+	n = 0;
+	len = 0;
+	while(now()<end) {
+		if((c=readByte(end-now()))<0) break;
+		if(n==0 && c!=TMSH_XFER_SOH) continue;
+		in[n++] = c;
+		if(n<TMSH_XFER_HDR) continue;
+		len = in[3] | (in[4]<<8);
+		if(len>TMSH_XFER_MAXDATA) return 0;
+		if(n<TMSH_XFER_HDR+len+4) continue;
+		if(getLe32(in+TMSH_XFER_HDR+len)!=crc32Update(0, in+1, TMSH_XFER_HDR-1+len)) return 0;
+		f.type = in[1];
+		f.seq = in[2];
+		f.len = len;
+		memcpy(f.data, in+TMSH_XFER_HDR, len);
+		return 1;
+	}
+	return -1;
+}
+
+static void command(const char* cmd, const char* fn) {
+	char line[300];
+	snprintf(line, sizeof(line), "%s %s\r", cmd, fn);
+	writeAll((const uint8_t*)line, strlen(line));
+}
+
+// Skip the shell's chatter up to the "<what>: ready" line.
+static bool waitReady(const char* what, double timeout) {
+	char want[16];
+	int matched, c;
+	double end;
+	snprintf(want, sizeof(want), "%s: ready\n", what);
+	matched = 0;
+	end = now()+timeout;
+	while(want[matched]!='\0') {
+		if(now()>=end || (c=readByte(end-now()))<0) return false;
+		if(c==want[matched]) matched++;
+		else matched = c==want[0] ? 1 : 0;
+	}
+	return true;
+}
+
+static void throughput(size_t bytes, double secs, long baud) {
+	double rate;
+	rate = secs>0 ? bytes/secs : 0;
+	printf("%zu bytes in %.2f s, %.0f bytes/s (%.0f%% of the line rate)\n",
+	  bytes, secs, rate, 100*rate/(baud/10.0));
+}
+
+// *** PUT (the node runs rx)
+
+static int put(const char* local, const char* remote, long baud) {
+	FILE* fp;
+	uint8_t* data;
+	uint8_t buf[8];
+	size_t size, from, baseOff, nextOff;
+	uint8_t base, next, n;
+	int r, tries;
+	bool finalSent;
+	double start;
+	Frame f;
+
+	if((fp=fopen(local, "rb"))==NULL) { perror(local); return 1; }
+	fseek(fp, 0, SEEK_END);
+	size = ftell(fp);
+	rewind(fp);
+	data = (uint8_t*)malloc(size+1);
+	if(data==NULL || fread(data, 1, size, fp)!=size) { fprintf(stderr, "can't read %s\n", local); return 1; }
+	fclose(fp);
+
+	command("rx", remote);
+	for(tries=0; ; tries++) {
+		if(tries>TMSH_XFER_RETRIES) { fprintf(stderr, "no answer from the node\n"); return 1; }
+		if(getFrame(f, TMSH_XFER_TIMEOUT/1000.0)==1 && f.type==TMSH_XFER_RESUME && f.len==4) break;
+	}
+	from = getLe32(f.data);
+	if(from>size) {
+		fprintf(stderr, "the node already has %zu bytes of %s, more than %s; rm %s.part there\n", from, remote, local, remote);
+		sendFrame(TMSH_XFER_ABORT, 0);
+		return 1;
+	}
+	if(from>0) printf("resuming at %zu\n", from);
+
+	start = now();
+	base = next = 0;
+	baseOff = nextOff = from;
+	finalSent = false;
+	tries = 0;
+	for(;;) {
+		while((uint8_t)(next-base)<TMSH_XFER_WINDOW && nextOff<size) {
+			int len = size-nextOff<TMSH_XFER_MAXDATA ? size-nextOff : TMSH_XFER_MAXDATA;
+			sendFrame(TMSH_XFER_DATA, next++, data+nextOff, len);
+			nextOff += len;
+		}
+		if(base==next && nextOff>=size && !finalSent) {
+			putLe32(buf, size);
+			putLe32(buf+4, crc32Update(0, data, size));
+			sendFrame(TMSH_XFER_FINAL, next, buf, 8);
+			finalSent = true;
+		}
+		r = getFrame(f, TMSH_XFER_TIMEOUT/1000.0);
+		if(r==0) continue;
+		if(r<0) {
+			if(++tries>TMSH_XFER_RETRIES) { fprintf(stderr, "timed out\n"); return 1; }
+			next = base; nextOff = baseOff; finalSent = false;
+			continue;
+		}
+		tries = 0;
+		if(f.type==TMSH_XFER_ACK) {
+			if(finalSent && f.seq==next) break;
+			n = f.seq+1-base;
+			if(n>=1 && n<=(uint8_t)(next-base)) { base += n; baseOff += n*(size_t)TMSH_XFER_MAXDATA; if(baseOff>size) baseOff = size; }
+		} else if(f.type==TMSH_XFER_NAK) {
+			n = f.seq-base;
+			if(n<=(uint8_t)(next-base)) {
+				base += n; baseOff += n*(size_t)TMSH_XFER_MAXDATA; if(baseOff>size) baseOff = size;
+				next = base; nextOff = baseOff; finalSent = false;
+			}
+		} else if(f.type==TMSH_XFER_ABORT) {
+			fprintf(stderr, "the node gave up\n");
+			return 1;
+		}
+	}
+	throughput(size-from, now()-start, baud);
+	free(data);
+	return 0;
+}
+
+// *** GET (the node runs tx)
+
+static int get(const char* remote, const char* local, long baud) {
+	char part[1024];
+	FILE* fp;
+	uint8_t buf[TMSH_XFER_MAXDATA];
+	uint32_t crc;
+	size_t have, from, n;
+	uint8_t expect;
+	int r, tries;
+	bool nakSent;
+	double start;
+	Frame f;
+
+	snprintf(part, sizeof(part), "%s.part", local);
+	crc = 0;
+	have = 0;
+	if((fp=fopen(part, "rb"))!=NULL) {
+		while((n=fread(buf, 1, sizeof(buf), fp))>0) { crc = crc32Update(crc, buf, n); have += n; }
+		fclose(fp);
+	}
+	if((fp=fopen(part, "ab"))==NULL) { perror(part); return 1; }
+	from = have;
+	if(from>0) printf("resuming at %zu\n", from);
+
+	command("tx", remote);
+	if(!waitReady("tx", 5)) { fprintf(stderr, "no answer from the node\n"); return 1; }
+	start = now();
+	expect = 0;
+	nakSent = false;
+	tries = 0;
+	putLe32(buf, have);
+	sendFrame(TMSH_XFER_RESUME, 0, buf, 4);
+	for(;;) {
+		r = getFrame(f, TMSH_XFER_TIMEOUT/1000.0);
+		if(r<0) {
+			if(++tries>TMSH_XFER_RETRIES) { fprintf(stderr, "timed out\n"); fclose(fp); return 1; }
+			if(expect==0) { putLe32(buf, have); sendFrame(TMSH_XFER_RESUME, 0, buf, 4); }
+			else sendFrame(TMSH_XFER_NAK, expect);
+			continue;
+		}
+		tries = 0;
+		if(r==0) { if(!nakSent) sendFrame(TMSH_XFER_NAK, expect); nakSent = true; continue; }
+		if(f.type==TMSH_XFER_DATA) {
+			if(f.seq==expect) {
+				if(fwrite(f.data, 1, f.len, fp)!=(size_t)f.len) { perror(part); sendFrame(TMSH_XFER_ABORT, 0); return 1; }
+				crc = crc32Update(crc, f.data, f.len);
+				have += f.len;
+				sendFrame(TMSH_XFER_ACK, expect++);
+				nakSent = false;
+			} else if((uint8_t)(expect-f.seq)<=TMSH_XFER_WINDOW) sendFrame(TMSH_XFER_ACK, expect-1);
+			else { if(!nakSent) sendFrame(TMSH_XFER_NAK, expect); nakSent = true; }
+		} else if(f.type==TMSH_XFER_FINAL) {
+			fclose(fp);
+			if(f.len!=8 || getLe32(f.data)!=have || getLe32(f.data+4)!=crc) {
+				fprintf(stderr, "%s doesn't match what was sent; removed\n", part);
+				sendFrame(TMSH_XFER_ABORT, 0);
+				remove(part);
+				return 1;
+			}
+			sendFrame(TMSH_XFER_ACK, f.seq);
+			if(rename(part, local)<0) { perror(local); return 1; }
+			break;
+		} else if(f.type==TMSH_XFER_ABORT) {
+			fprintf(stderr, "the node gave up\n");
+			fclose(fp);
+			return 1;
+		}
+	}
+	throughput(have-from, now()-start, baud);
+	return 0;
+}
+
+int main(int argc, char** argv) {
+	long baud;
+	int i;
+	baud = 115200;
+	i = 1;
+	if(i+1<argc && strcmp(argv[i], "-b")==0) { baud = atol(argv[i+1]); i += 2; }
+	if(argc-i!=4 || (strcmp(argv[i+1], "put")!=0 && strcmp(argv[i+1], "get")!=0)) {
+		fprintf(stderr, "usage: tmshxfer [-b baud] port put localfn remotefn\n"
+		                "       tmshxfer [-b baud] port get remotefn localfn\n");
+		return 2;
+	}
+	if(!openPort(argv[i], baud)) return 1;
+	if(strcmp(argv[i+1], "put")==0) return put(argv[i+2], argv[i+3], baud);
+	return get(argv[i+2], argv[i+3], baud);
+}
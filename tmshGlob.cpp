@@ -0,0 +1,118 @@
+//
+// File name patterns -- see tmshGlob.h
+//
+#include <Arduino.h>
+
+#if defined(ARDUINO_ARCH_ESP8266) || defined(ARDUINO_ARCH_ESP32)
+#include <FS.h>
+#include <string.h>
+
+#include "tmshGlob.h"
+
+String addSlash(const char* fn);	// from utils
+
+static const char* globClass(const char* pat, char c, bool& matched) {
+	// pat is just past a [.  Whether c is in the class, and where the class ends (at its
+	// ]), or NULL if it doesn't end.  A ] first in the class is part of it.
+	bool negate;
+	matched = false;
+	negate = *pat=='!' || *pat=='^';
+	if(negate) pat++;
+	do {
+		if(*pat=='\0') return NULL;
+		if(pat[1]=='-' && pat[2]!=']' && pat[2]!='\0') {
+			if(c>=pat[0] && c<=pat[2]) matched = true;
+			pat += 3;
+		} else {
+			if(c==*pat) matched = true;
+			pat++;
+		}
+	} while(*pat!=']');
+	if(negate) matched = !matched;
+	return pat;
+}
+
+bool Tmsh_globMatch(const char* pat, const char* name) {
+	// Iterative, with one point to go back to:  the last *, and the place in name it has
+	// swallowed up to.  Any later * makes the earlier one's choices final.
+	const char* starPat = NULL;
+	const char* starName = NULL;
+	const char* end;
+	bool in;
+	while(*name) {
+		if(*pat=='*') {
+			starPat = ++pat;
+			starName = name;
+			continue;
+		}
+		if(*pat=='[' && (end=globClass(pat+1, *name, in))!=NULL) {
+			if(in) { pat = end+1; name++; continue; }
+		} else if(*pat=='?' || (*pat!='\0' && *pat==*name)) {
+			pat++; name++;
+			continue;
+		}
+		if(starPat==NULL) return false;
+		pat = starPat;
+		name = ++starName;
+	}
+	while(*pat=='*') pat++;
+	return *pat=='\0';
+}
+
+bool Tmsh_isGlob(const char* s) {
+	return strpbrk(s, "*?[")!=NULL;
+}
+
+bool Tmsh_glob::begin(fs::FS& store, const char* pattern, const char* skip) {
+	String dirName;
+	end();
+	fs = &store;
+	pat = addSlash(pattern);
+	baseAt = pat.lastIndexOf('/')+1;
+	skipPath = skip!=NULL ? addSlash(skip) : String("");
+	literalDone = false;
+	if(!Tmsh_isGlob(pat.c_str()+baseAt)) return true;
+	dirName = baseAt>1 ? pat.substring(0, baseAt-1) : String("/");
+	dir = fs->open(dirName.c_str());
+	if(!dir || !dir.isDirectory()) { end(); return false; }
+	return true;
+}
+
+bool Tmsh_glob::next() {
+	const char* name;
+	String full;
+	if(fs==NULL) return false;
+	if(!dir) {
+		// a plain name:  just it, once
+		if(literalDone) return false;
+		literalDone = true;
+		if(pat==skipPath || !fs->exists(pat.c_str())) return false;
+		File f = fs->open(pat.c_str(), FILE_READ);
+		if(!f || f.isDirectory()) return false;
+		cur = pat;
+		curSize = f.size();
+		f.close();
+		return true;
+	}
+	for(;;) {
+		File f = dir.openNextFile();
+		if(!f) return false;
+		if(f.isDirectory()) continue;
+		// Some filesystems give the whole path, some just the last part.  On a flat one
+		// (SPIFFS), a directory's files are the ones whose path starts with it.
+		name = f.name();
+		full = name[0]=='/' ? String(name) : pat.substring(0, baseAt)+name;
+		curSize = f.size();
+		f.close();
+		if(strncmp(full.c_str(), pat.c_str(), baseAt)!=0 || strchr(full.c_str()+baseAt, '/')!=NULL) continue;
+		if(full==skipPath || !Tmsh_globMatch(pat.c_str()+baseAt, full.c_str()+baseAt)) continue;
+		cur = full;
+		return true;
+	}
+}
+
+void Tmsh_glob::end() {
+	if(dir) dir.close();
+	fs = NULL;
+}
+#endif
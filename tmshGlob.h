@@ -0,0 +1,52 @@
+//
+// File name patterns for the file builtins:  * ? [abc] [a-z] [!a-z]
+//
+// Tmsh_glob hands back the files that match a pattern one at a time, from one walk of
+// the directory the pattern is in, so a pattern can match any number of files without
+// them having to fit on the command line.  Only the last part of a pattern (after its
+// last /) can have pattern characters in it; "/logs/*.txt" walks /logs.  A name with no
+// pattern characters is handed back as it is, if there's such a file.
+//
+// Directories are never matched.  Files can be removed as they're handed back.
+//
+
+#if !defined(__TMSHGLOB__)
+#define __TMSHGLOB__
+
+#include <Arduino.h>
+#if defined(ARDUINO_ARCH_ESP8266) || defined(ARDUINO_ARCH_ESP32)
+#include <FS.h>
+
+// Whether name matches pat, all of it.
+bool Tmsh_globMatch(const char* pat, const char* name);
+// Whether s has any pattern characters in it.
+bool Tmsh_isGlob(const char* s);
+
+class Tmsh_glob {
+	public:
+		Tmsh_glob(): fs(NULL) {}
+
+		// Start on pattern (a relative one is from /).  skip, if it isn't NULL, is a file
+		// not to hand back, such as cp's destination.  false if the directory can't be
+		// read.
+		bool begin(fs::FS& fs, const char* pattern, const char* skip=NULL);
+		// On to the next matching file; false when there are no more.
+		bool next();
+		void end();
+
+		const String& path() const { return cur; }
+		long size() const { return curSize; }
+
+	private:
+		fs::FS* fs;
+		File dir;				// the directory being walked; closed for a plain name
+		String pat;				// the whole pattern, from /
+		int baseAt;				// where its last part starts
+		String skipPath;
+		String cur;
+		long curSize;
+		bool literalDone;
+};
+#endif
+
+#endif
@@ -0,0 +1,91 @@
+//
+// Heap telemetry for the shell -- see tmshHeap.h
+//
+#include <Arduino.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "tmshHeap.h"
+
+struct HeapArea {
+	unsigned long marks;	// brackets run
+	unsigned long took;		// brackets that ended with less free heap
+	unsigned long gave;		// brackets that ended with more
+	long taken;
+	long given;
+};
+
+static HeapArea heapAreas[TMSH_HEAP_AREAS];
+static long heapLow = -1;		// lowest free heap seen since the last reset
+static long heapLowBlock = -1;	// smallest "largest block" seen since the last reset
+
+static const char heapAreaNames[TMSH_HEAP_AREAS][10] PROGMEM = {
+	"readline", "tokenizer", "ed", "file", "shell"
+};
+
+long Tmsh_heapFree() {
+#if defined(ARDUINO_ARCH_AVR)
+	extern int __heap_start, *__brkval;
+	int v;
+	return (char*)&v - (__brkval==0 ? (char*)&__heap_start : (char*)__brkval);
+#elif defined(ARDUINO_ARCH_ESP8266) || defined(ARDUINO_ARCH_ESP32)
+	return ESP.getFreeHeap();
+#else
+	return -1;
+#endif
+}
+
+long Tmsh_heapLargestBlock() {
+#if defined(ARDUINO_ARCH_ESP32)
+	return ESP.getMaxAllocHeap();
+#elif defined(ARDUINO_ARCH_ESP8266)
+	return ESP.getMaxFreeBlockSize();
+#else
+	return Tmsh_heapFree();
+#endif
+}
+
+static void heapSample() {
+	long n;
+	n = Tmsh_heapFree();
+	if(heapLow<0 || n<heapLow) heapLow = n;
+	n = Tmsh_heapLargestBlock();
+	if(heapLowBlock<0 || n<heapLowBlock) heapLowBlock = n;
+}
+
+void Tmsh_heapCharge(int area, long used) {
+	HeapArea* a;
+	a = &heapAreas[area];
+	a->marks++;
+	if(used>0) { a->took++; a->taken += used; }
+	else if(used<0) { a->gave++; a->given -= used; }
+	heapSample();
+}
+
+void Tmsh_heapReset() {
+	memset(heapAreas, 0, sizeof(heapAreas));
+	heapLow = heapLowBlock = -1;
+	heapSample();
+}
+
+void Tmsh_heapReport(Print& out) {
+	char line[64];
+	int i;
+	heapSample();
+	out.print(F("area        marks    took    gave   taken   given     net\n"));
+	for(i=0; i<TMSH_HEAP_AREAS; i++) {
+		const HeapArea& a = heapAreas[i];
+		snprintf(line, sizeof(line), "%-9s%8lu%8lu%8lu%8ld%8ld%8ld\n",
+		  "", a.marks, a.took, a.gave, a.taken, a.given, a.taken-a.given);
+		out.print(reinterpret_cast<const __FlashStringHelper*>(heapAreaNames[i]));
+		out.print(line+strlen_P(heapAreaNames[i]));
+	}
+	snprintf(line, sizeof(line), "free %ld, low %ld\n", Tmsh_heapFree(), heapLow);
+	out.print(line);
+	snprintf(line, sizeof(line), "largest block %ld, low %ld\n", Tmsh_heapLargestBlock(), heapLowBlock);
+	out.print(line);
+#if defined(ARDUINO_ARCH_ESP32)
+	snprintf(line, sizeof(line), "low since boot %ld\n", (long)ESP.getMinFreeHeap());
+	out.print(line);
+#endif
+}
@@ -0,0 +1,69 @@
+//
+// Heap telemetry for the shell
+//
+// Nearly everything the shell does allocates Strings, so rather than hook malloc, each
+// subsystem brackets its work with a Tmsh_heapMark, and the change in free heap across
+// the bracket is charged to that subsystem.  So what's counted is brackets, not
+// allocations:  for each area, how many brackets ran, how many of them ended with less
+// free heap (took) or more (gave), and the bytes taken and given back.  Work that
+// allocates and frees the same amount inside one bracket isn't seen.
+//
+// A bracket never spans a yield, or it would charge whatever the other tasks did in
+// between.  Longer work is bracketed a task slice at a time.  Heap used for a file
+// builtin by the I/O worker, on the other core, isn't seen.
+//
+// The marks cost nothing unless the profile has heapStats on.
+//
+
+#if !defined(__TMSHHEAP__)
+#define __TMSHHEAP__
+
+#include <Arduino.h>
+#include <TaskManagerShProfile.h>
+
+// what the heap is charged to
+enum {
+	TMSH_HEAP_READLINE,
+	TMSH_HEAP_TOKENIZER,
+	TMSH_HEAP_ED,
+	TMSH_HEAP_FILE,
+	TMSH_HEAP_SHELL,		// a command's redirection sink and cat/grep's stream
+	TMSH_HEAP_AREAS
+};
+
+// Free heap now, and the biggest single block that could be allocated.
+// On AVR, both are the gap between the top of the heap and the stack.
+long Tmsh_heapFree();
+long Tmsh_heapLargestBlock();
+
+// Charge a change in free heap to an area; used>0 means heap was taken.
+void Tmsh_heapCharge(int area, long used);
+
+// Print the counters to out, or clear them and start the low-water marks over.
+void Tmsh_heapReport(Print& out);
+void Tmsh_heapReset();
+
+// Bracket some work:  mark.begin(area) ... mark.end(), which returns the heap taken.
+// Plain data, so it can be a local in a task body.  leaveOut() takes out of a bracket
+// what a bracket inside it charged to some other area.
+struct Tmsh_heapMark {
+	long freeBefore;
+	int area;
+	void begin(int a) {
+		if(!TmshProfile::heapStats) return;
+		area = a;
+		freeBefore = Tmsh_heapFree();
+	}
+	long end() {
+		long used;
+		if(!TmshProfile::heapStats) return 0;
+		used = freeBefore-Tmsh_heapFree();
+		Tmsh_heapCharge(area, used);
+		return used;
+	}
+	void leaveOut(long used) {
+		freeBefore -= used;
+	}
+};
+
+#endif
@@ -0,0 +1,85 @@
+//
+// File I/O worker -- see tmshIo.h
+//
+#include <Arduino.h>
+
+#if defined(ARDUINO_ARCH_ESP8266) || defined(ARDUINO_ARCH_ESP32)
+#include "tmshIo.h"
+#if defined(TMSH_HOST)
+#include <thread>
+#include <chrono>
+#endif
+
+// ioHead is only written by the loop, and ioTail only by the worker.
+static Tmsh_ioJob* ioQueue[TMSH_IO_QUEUE];
+static std::atomic<unsigned> ioHead(0);	// where the next job goes
+static std::atomic<unsigned> ioTail(0);	// the next job to run
+static bool ioStarted = false;
+#if defined(ARDUINO_ARCH_ESP32) && !defined(TMSH_HOST)
+static TaskHandle_t ioTask = NULL;
+#endif
+
+static void ioWork(void*) {
+	Tmsh_ioJob* job;
+	unsigned tail;
+	for(;;) {
+		tail = ioTail.load(std::memory_order_relaxed);
+		if(tail==ioHead.load(std::memory_order_acquire)) {
+			// nothing to do; sleep until Tmsh_ioSubmit says otherwise
+#if defined(TMSH_HOST)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+#elif defined(ARDUINO_ARCH_ESP32)
+			ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+#endif
+			continue;
+		}
+		job = ioQueue[tail%TMSH_IO_QUEUE];
+		job->fn(job->arg);
+		ioTail.store(tail+1, std::memory_order_release);
+		job->done.store(true, std::memory_order_release);
+	}
+}
+
+bool Tmsh_ioBegin() {
+	if(!TmshProfile::ioWorker || ioStarted) return ioStarted;
+#if defined(TMSH_HOST)
+	std::thread(ioWork, (void*)NULL).detach();
+	ioStarted = true;
+#elif defined(ARDUINO_ARCH_ESP32)
+	// the core that isn't running the loop
+	ioStarted = xTaskCreatePinnedToCore(ioWork, "tmshIo", TMSH_IO_STACK, NULL, 1, &ioTask,
+	  xPortGetCoreID()==0 ? 1 : 0)==pdPASS;
+#endif
+	return ioStarted;
+}
+
+bool Tmsh_ioOffloaded() {
+	return ioStarted;
+}
+
+long Tmsh_ioStackLeft() {
+#if defined(ARDUINO_ARCH_ESP32) && !defined(TMSH_HOST)
+	// the ESP32's FreeRTOS counts stack in bytes
+	if(ioStarted) return uxTaskGetStackHighWaterMark(ioTask);
+#endif
+	return -1;
+}
+
+bool Tmsh_ioSubmit(Tmsh_ioJob* job) {
+	unsigned head;
+	if(!ioStarted) {
+		job->fn(job->arg);
+		job->done.store(true, std::memory_order_release);
+		return true;
+	}
+	head = ioHead.load(std::memory_order_relaxed);
+	if(head-ioTail.load(std::memory_order_acquire)==TMSH_IO_QUEUE) return false;
+	job->done.store(false, std::memory_order_relaxed);
+	ioQueue[head%TMSH_IO_QUEUE] = job;
+	ioHead.store(head+1, std::memory_order_release);
+#if defined(ARDUINO_ARCH_ESP32) && !defined(TMSH_HOST)
+	xTaskNotifyGive(ioTask);
+#endif
+	return true;
+}
+#endif
@@ -0,0 +1,59 @@
+//
+// File I/O off the TaskManager core
+//
+// Flash erases and writes take milliseconds each, and while one is going on in a builtin
+// nothing else in the cooperative loop runs.  On an ESP32 the shell hands that work to a
+// worker task pinned to the other core, and yields until it's done:
+//    job.fn = myJob; job.arg = ...;
+//    while(!Tmsh_ioSubmit(&job)) { TM_YIELD(n); }
+//    while(!Tmsh_ioDone(&job)) { TM_YIELD(n+1); }
+// Jobs go to the worker through a lock-free single-producer/single-consumer ring, so only
+// tasks in the TaskManager loop may submit.  A job mustn't touch anything the loop is
+// using until it's done, and shouldn't trace.
+//
+// Elsewhere (or if the profile's ioWorker is off, or the worker couldn't be started)
+// Tmsh_ioSubmit just runs the job, so the calling code is the same everywhere.  A host
+// build (-DTMSH_HOST) runs the worker as a std::thread.
+//
+// What the worker can't do:  while the ESP32 erases or writes its SPI flash, the flash
+// cache is off on both cores, and a task on the other core stops as soon as it needs
+// code or constant data from flash, which the loop nearly always does.  So each erase
+// (tens of ms for a 4 KB sector) or page write still holds up the loop.  Between them
+// (the job's reads, CRCs, directory walks, network waits) the loop runs.  A job that
+// writes a lot still costs the loop some latency, just less than it would inline.  To
+// see how much on a board, set a low stall threshold and look at it after a copy, e.g.
+// "stalls 5", "cp big.bin copy.bin", "stalls".
+//
+
+#if !defined(__TMSHIO__)
+#define __TMSHIO__
+
+#include <Arduino.h>
+#include <TaskManagerShProfile.h>
+#if defined(ARDUINO_ARCH_ESP8266) || defined(ARDUINO_ARCH_ESP32)
+#include <atomic>
+
+#define TMSH_IO_QUEUE 4			// jobs waiting for the worker; a power of two
+// Worker stack, in bytes.  sync's jobs run HTTPClient, a DNS lookup and an lwIP connect
+// on it, which is why Arduino gives its own loopTask 8 KB; "mem" shows what's never used.
+#define TMSH_IO_STACK 8192
+
+struct Tmsh_ioJob {
+	void (*fn)(void* arg);
+	void* arg;
+	std::atomic<bool> done;
+	Tmsh_ioJob(): fn(NULL), arg(NULL), done(true) {}
+};
+
+// Start the worker.  false if jobs will run inline.
+bool Tmsh_ioBegin();
+bool Tmsh_ioOffloaded();
+// Bytes of the worker's stack that have never been used, or -1 if there's no worker
+// (or it's a host thread).
+long Tmsh_ioStackLeft();
+// Queue job for the worker.  false if the queue is full; try again after a yield.
+bool Tmsh_ioSubmit(Tmsh_ioJob* job);
+inline bool Tmsh_ioDone(Tmsh_ioJob* job) { return job->done.load(std::memory_order_acquire); }
+#endif
+
+#endif
@@ -0,0 +1,241 @@
+//
+// Key/value store on one file -- see tmshKv.h
+//
+#include <Arduino.h>
+
+#if defined(ARDUINO_ARCH_ESP8266) || defined(ARDUINO_ARCH_ESP32)
+#include <FS.h>
+#include <string.h>
+
+#include "utils.h"
+#include "tmshKv.h"
+
+#define KV_SET 'S'
+#define KV_DEL 'D'
+#define KV_MASK (TMSH_KV_SLOTS-1)
+
+Tmsh_kvStore Tmsh_kv;
+
+static uint32_t getLe32(const uint8_t* p) {
+	return p[0] | ((uint32_t)p[1]<<8) | ((uint32_t)p[2]<<16) | ((uint32_t)p[3]<<24);
+}
+
+static void putLe32(uint8_t* p, uint32_t v) {
+	p[0] = v; p[1] = v>>8; p[2] = v>>16; p[3] = v>>24;
+}
+
+uint32_t Tmsh_kvStore::hashOf(const char* key, int len) {
+	// FNV-1a
+	uint32_t h = 2166136261UL;
+	while(len-->0) { h ^= (uint8_t)*key++; h *= 16777619UL; }
+	return h;
+}
+
+bool Tmsh_kvStore::readRecord(long offset, int size) {
+	return log.seek(offset) && log.read(rec, size)==(size_t)size;
+}
+
+int Tmsh_kvStore::find(const char* key, int len, uint32_t h) {
+	// The slot holding key, with its record (less the CRC) read into rec; or, if it's not
+	// there, -1-(the empty slot it would go in).
+	int i;
+	for(i=h&KV_MASK; slots[i].keyLen!=0; i=(i+1)&KV_MASK) {
+		if(slots[i].hash==h && slots[i].keyLen==len && readRecord(slots[i].offset, 4+len+slots[i].valLen)
+		  && memcmp(rec+4, key, len)==0) return i;
+	}
+	return -1-i;
+}
+
+void Tmsh_kvStore::remove(int i) {
+	// Empty slot i, and move back any later slot in its probe run that could then no
+	// longer be found.
+	int j, home;
+	for(j=(i+1)&KV_MASK; slots[j].keyLen!=0; j=(j+1)&KV_MASK) {
+		home = slots[j].hash&KV_MASK;
+		// j stays put if its home is cyclically in (i, j]
+		if(i<=j ? (i<home && home<=j) : (i<home || home<=j)) continue;
+		slots[i] = slots[j];
+		i = j;
+	}
+	slots[i].keyLen = 0;
+}
+
+bool Tmsh_kvStore::append(char type, const char* key, int keyLen, const char* value, int valLen) {
+	// One record, in one write.  A failed write leaves end alone, so the next append
+	// writes over whatever part of this one got out.
+	int size;
+	rec[0] = type;
+	rec[1] = keyLen;
+	rec[2] = valLen;
+	rec[3] = valLen>>8;
+	memcpy(rec+4, key, keyLen);
+	if(valLen>0) memcpy(rec+4+keyLen, value, valLen);
+	putLe32(rec+4+keyLen+valLen, crc32Update(0, rec, 4+keyLen+valLen));
+	size = 4+keyLen+valLen+4;
+	if(!log.seek(end) || log.write(rec, size)!=(size_t)size) return false;
+	log.flush();
+	end += size;
+	return true;
+}
+
+bool Tmsh_kvStore::reopen() {
+	log = fs->open(path.c_str(), "r+");
+	if(!log) { fs = NULL; return false; }
+	return true;
+}
+
+bool Tmsh_kvStore::begin(fs::FS& store, const char* logPath) {
+	char key[TMSH_KV_MAXKEY];
+	long size, pos;
+	int kl, vl, i;
+	bool torn, full;
+	uint32_t h;
+
+	fs = &store;
+	path = logPath;
+	memset(slots, 0, sizeof(slots));
+	keys = 0;
+	end = live = 0;
+	// A compact that a reset cut short can leave the log as path~, or only as path.tmp.
+	// Every record is CRC'd, so a path.tmp with no log is read as far as it's good.
+	recoverFile(*fs, path.c_str());
+	if(!fs->exists(path.c_str()) && fs->exists((path+".tmp").c_str()))
+		fs->rename((path+".tmp").c_str(), path.c_str());
+	if(!fs->exists(path.c_str())) {
+		File f = fs->open(path.c_str(), FILE_WRITE);
+		if(!f) { fs = NULL; return false; }
+		f.close();
+	}
+	if(!reopen()) return false;
+
+	// Replay the log into the index, up to the end or the first bad record.
+	size = log.size();
+	torn = full = false;
+	for(pos=0; pos<size; pos+=8+kl+vl) {
+		if(size-pos<8 || !readRecord(pos, 4)) { torn = true; break; }
+		kl = rec[1];
+		vl = rec[2] | (rec[3]<<8);
+		if((rec[0]!=KV_SET && rec[0]!=KV_DEL) || kl==0 || kl>TMSH_KV_MAXKEY || vl>TMSH_KV_MAXVAL
+		  || (rec[0]==KV_DEL && vl!=0) || pos+8+kl+vl>size || !readRecord(pos, 8+kl+vl)
+		  || getLe32(rec+4+kl+vl)!=crc32Update(0, rec, 4+kl+vl)) { torn = true; break; }
+		memcpy(key, rec+4, kl);
+		h = hashOf(key, kl);
+		if(rec[0]==KV_SET) {
+			i = find(key, kl, h);
+			if(i>=0) live -= sizeOf(slots[i]);
+			else if(keys==TmshProfile::kvMaxKeys) { full = true; continue; }
+			else { i = -1-i; keys++; }
+			slots[i].hash = h;
+			slots[i].offset = pos;
+			slots[i].valLen = vl;
+			slots[i].keyLen = kl;
+			live += sizeOf(slots[i]);
+		} else if((i=find(key, kl, h))>=0) {
+			live -= sizeOf(slots[i]);
+			remove(i);
+			keys--;
+		}
+	}
+	end = pos;
+	if(torn) compact();
+	return !full;
+}
+
+int Tmsh_kvStore::get(const char* key, char* val, int valSize) {
+	int i, kl, n;
+	kl = strlen(key);
+	if(fs==NULL || kl==0 || kl>TMSH_KV_MAXKEY || (i=find(key, kl, hashOf(key, kl)))<0) return -1;
+	n = slots[i].valLen<valSize ? slots[i].valLen : valSize-1;
+	memcpy(val, rec+4+kl, n);
+	val[n] = '\0';
+	return slots[i].valLen;
+}
+
+bool Tmsh_kvStore::get(const char* key, String& val) {
+	int i, kl;
+	kl = strlen(key);
+	if(fs==NULL || kl==0 || kl>TMSH_KV_MAXKEY || (i=find(key, kl, hashOf(key, kl)))<0) return false;
+	rec[4+kl+slots[i].valLen] = '\0';	// over the CRC, which find() didn't read
+	val = (const char*)rec+4+kl;
+	return true;
+}
+
+bool Tmsh_kvStore::set(const char* key, const char* value, int len) {
+	int i, kl;
+	long offset;
+	uint32_t h;
+	kl = strlen(key);
+	if(len<0) len = strlen(value);
+	if(fs==NULL || kl==0 || kl>TMSH_KV_MAXKEY || len>TMSH_KV_MAXVAL) return false;
+	h = hashOf(key, kl);
+	i = find(key, kl, h);
+	if(i<0 && keys==TmshProfile::kvMaxKeys) return false;
+	offset = end;
+	if(!append(KV_SET, key, kl, value, len)) return false;
+	if(i>=0) live -= sizeOf(slots[i]);
+	else { i = -1-i; keys++; }
+	slots[i].hash = h;
+	slots[i].offset = offset;
+	slots[i].valLen = len;
+	slots[i].keyLen = kl;
+	live += sizeOf(slots[i]);
+	if(end-live>TMSH_KV_COMPACT_MIN && end-live>live) compact();
+	return true;
+}
+
+bool Tmsh_kvStore::del(const char* key) {
+	int i, kl;
+	kl = strlen(key);
+	if(fs==NULL || kl==0 || kl>TMSH_KV_MAXKEY || (i=find(key, kl, hashOf(key, kl)))<0) return false;
+	if(!append(KV_DEL, key, kl, NULL, 0)) return false;
+	live -= sizeOf(slots[i]);
+	remove(i);
+	keys--;
+	if(end-live>TMSH_KV_COMPACT_MIN && end-live>live) compact();
+	return true;
+}
+
+bool Tmsh_kvStore::compact() {
+	String tmp;
+	long pos;
+	int i, size;
+	bool ok;
+	if(fs==NULL) return false;
+	tmp = path+".tmp";
+	File f = fs->open(tmp.c_str(), FILE_WRITE);
+	if(!f) return false;
+	ok = true;
+	for(i=0; i<TMSH_KV_SLOTS && ok; i++) {
+		if(slots[i].keyLen==0) continue;
+		size = sizeOf(slots[i]);
+		ok = readRecord(slots[i].offset, size) && f.write(rec, size)==(size_t)size;
+	}
+	f.close();
+	if(!ok) { fs->remove(tmp.c_str()); return false; }
+	log.close();
+	ok = replaceFile(*fs, tmp.c_str(), path.c_str());
+	if(!reopen() || !ok) return false;
+	// the records went out in slot order; point the index at where they are now
+	for(i=0, pos=0; i<TMSH_KV_SLOTS; i++) {
+		if(slots[i].keyLen==0) continue;
+		slots[i].offset = pos;
+		pos += sizeOf(slots[i]);
+	}
+	end = pos;
+	return true;
+}
+
+int Tmsh_kvStore::entry(int i, char* key, char* val, int valSize) {
+	int n;
+	for(; fs!=NULL && i<TMSH_KV_SLOTS; i++) {
+		if(slots[i].keyLen==0 || !readRecord(slots[i].offset, 4+slots[i].keyLen+slots[i].valLen)) continue;
+		memcpy(key, rec+4, slots[i].keyLen);
+		key[slots[i].keyLen] = '\0';
+		n = slots[i].valLen<valSize ? slots[i].valLen : valSize-1;
+		memcpy(val, rec+4+slots[i].keyLen, n);
+		val[n] = '\0';
+		return i+1;
+	}
+	return -1;
+}
+#endif
@@ -0,0 +1,101 @@
+//
+// Key/value store on one file
+//
+// Settings live as records appended to a log file:
+//    type('S' set, 'D' delete)  keyLen(1)  valLen(2, LE)  key  value  crc32(4, LE, over type..value)
+// An update is one append.  A hash index in RAM, built by one scan of the log in begin(),
+// says where each key's latest record is, so a get is one seek and one read.  Records
+// that have been overwritten or deleted are dead space; once there's more of it than
+// live data (and at least TMSH_KV_COMPACT_MIN bytes), the live records are copied to a
+// fresh file that replaces the log.
+//
+// A reset in the middle of an append leaves a torn record at the end of the log.  The
+// scan stops at the first record whose CRC doesn't check, and begin() compacts it away.
+// A reset in the middle of a compact leaves the old log or the new one, and begin()
+// puts whichever it is back before it reads it.
+//
+// Writes go to flash, so the shell's kv builtins do them (set, del and compact) as I/O
+// jobs (tmshIo.h).  While one is out, Tmsh_kvBusy() is true, and a task shouldn't use
+// Tmsh_kv until it isn't.
+//
+// The index only holds where things are, not the keys themselves, so it costs
+// 12 bytes a slot no matter how long the keys are.
+//
+
+#if !defined(__TMSHKV__)
+#define __TMSHKV__
+
+#include <Arduino.h>
+#include <TaskManagerShProfile.h>
+#if defined(ARDUINO_ARCH_ESP8266) || defined(ARDUINO_ARCH_ESP32)
+#include <FS.h>
+
+#define TMSH_KV_FILE "/kv.log"
+#define TMSH_KV_MAXKEY 32
+#define TMSH_KV_MAXVAL 512
+#define TMSH_KV_COMPACT_MIN 2048
+
+// index slots:  a power of two, at least twice the keys, so probes stay short
+constexpr int Tmsh_kvSlotsFor(int keys, int n=1) { return n>=2*keys ? n : Tmsh_kvSlotsFor(keys, 2*n); }
+#define TMSH_KV_SLOTS Tmsh_kvSlotsFor(TmshProfile::kvMaxKeys>0 ? TmshProfile::kvMaxKeys : 1)
+
+class Tmsh_kvStore {
+	public:
+		Tmsh_kvStore(): fs(NULL), keys(0), end(0), live(0) {}
+
+		// Open (or create) the log at path and build the index.  false if it can't be
+		// opened or the index is full.
+		bool begin(fs::FS& fs, const char* path=TMSH_KV_FILE);
+		bool ready() const { return fs!=NULL; }
+
+		// The value of key, NUL-terminated in val (cut short to fit valSize).  Returns its
+		// full length, or -1 if there's no such key.
+		int get(const char* key, char* val, int valSize);
+		bool get(const char* key, String& val);
+		// Set key to len bytes of value (len -1 for strlen).  false if the key or value is
+		// too long, the index is full, or the write failed.
+		bool set(const char* key, const char* value, int len=-1);
+		// false if there was no such key.
+		bool del(const char* key);
+		// Copy the live records to a fresh log.
+		bool compact();
+
+		// Walk the keys:  for(i=0; (i=kv.entry(i, key, val, sizeof(val)))>=0; ) ...
+		// key must hold TMSH_KV_MAXKEY+1 chars.  Returns where to carry on from, or -1.
+		int entry(int i, char* key, char* val, int valSize);
+
+		int count() const { return keys; }
+		long logBytes() const { return end; }
+		long liveBytes() const { return live; }
+		long memUse() const { return sizeof(*this); }
+
+	private:
+		struct Slot {
+			uint32_t hash;
+			uint32_t offset;	// of the record in the log
+			uint16_t valLen;
+			uint8_t keyLen;		// 0 for an empty slot
+		};
+		Slot slots[TMSH_KV_SLOTS];
+		fs::FS* fs;
+		String path;
+		File log;
+		int keys;
+		long end;		// where the next record goes
+		long live;		// bytes of records the index points at
+		uint8_t rec[4+TMSH_KV_MAXKEY+TMSH_KV_MAXVAL+4];
+
+		static uint32_t hashOf(const char* key, int len);
+		static long sizeOf(const Slot& s) { return 4+s.keyLen+s.valLen+4; }
+		int find(const char* key, int len, uint32_t h);
+		void remove(int i);
+		bool readRecord(long offset, int size);
+		bool append(char type, const char* key, int keyLen, const char* value, int valLen);
+		bool reopen();
+};
+
+extern Tmsh_kvStore Tmsh_kv;	// the shell's store, for the kv builtins and for tasks
+bool Tmsh_kvBusy();
+#endif
+
+#endif
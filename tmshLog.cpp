@@ -0,0 +1,191 @@
+//
+// Ring log -- see tmshLog.h
+//
+#include <Arduino.h>
+
+#if defined(ARDUINO_ARCH_ESP8266) || defined(ARDUINO_ARCH_ESP32)
+#include <FS.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "tmshLog.h"
+
+String addSlash(const char* fn);	// from utils
+
+static const char logMagic[4] = { 'R', 'L', 'O', 'G' };
+
+static uint16_t getLe16(const uint8_t* p) {
+	return p[0] | (p[1]<<8);
+}
+
+static void putLe16(uint8_t* p, uint16_t v) {
+	p[0] = v; p[1] = v>>8;
+}
+
+bool Tmsh_ringLogInfo::read(File& f) {
+	// The header, checked against itself and the file's size.
+	uint8_t h[TMSH_LOG_HEADER];
+	if(!f.seek(0) || f.read(h, TMSH_LOG_HEADER)!=TMSH_LOG_HEADER || memcmp(h, logMagic, 4)!=0) return false;
+	sectorSize = getLe16(h+4);
+	sectors = getLe16(h+6);
+	first = getLe16(h+8);
+	cur = getLe16(h+10);
+	fill = getLe16(h+12);
+	return sectorSize>2 && sectors>=2 && first<sectors && cur<sectors && fill<=sectorSize-2
+	  && (long)f.size()==offsetOf(sectors);
+}
+
+bool Tmsh_ringLogInfo::write(File& f) const {
+	uint8_t h[TMSH_LOG_HEADER];
+	memset(h, 0, sizeof(h));
+	memcpy(h, logMagic, 4);
+	putLe16(h+4, sectorSize);
+	putLe16(h+6, sectors);
+	putLe16(h+8, first);
+	putLe16(h+10, cur);
+	putLe16(h+12, fill);
+	return f.seek(0) && f.write(h, TMSH_LOG_HEADER)==TMSH_LOG_HEADER;
+}
+
+bool Tmsh_ringLog::begin(fs::FS& fs, const char* path, int sectors, int sectorSize) {
+	uint8_t zeros[64];
+	long n;
+	int k;
+	String fn = addSlash(path);
+	end();
+	if(!fs.exists(fn.c_str())) {
+		// make it at its full size, all sectors empty
+		if(sectors<2 || sectorSize<16 || sectorSize>65535) return false;
+		if(!(f=fs.open(fn.c_str(), FILE_WRITE))) return false;
+		hdr.sectorSize = sectorSize;
+		hdr.sectors = sectors;
+		hdr.first = hdr.cur = hdr.fill = 0;
+		memset(zeros, 0, sizeof(zeros));
+		open = hdr.write(f);
+		for(n=(long)sectors*sectorSize; open && n>0; n-=k) {
+			k = n<(long)sizeof(zeros) ? n : sizeof(zeros);
+			open = f.write(zeros, k)==(size_t)k;
+		}
+		f.close();
+		if(!open) { fs.remove(fn.c_str()); return false; }
+	}
+	f = fs.open(fn.c_str(), "r+");
+	open = f && !f.isDirectory() && hdr.read(f);
+	if(!open && f) f.close();
+	return open;
+}
+
+void Tmsh_ringLog::end() {
+	if(open) f.close();
+	open = false;
+}
+
+bool Tmsh_ringLog::append(const char* line) {
+	uint8_t len[2];
+	int n, room;
+	if(!open) return false;
+	room = hdr.sectorSize-2;
+	n = strlen(line);
+	if(n+1>room) n = room-1;
+	if(hdr.fill+n+1>room) {
+		// Close off the current sector and move to the next, dropping the oldest if
+		// that's where it is.  The header moves on, to an empty sector, before the line
+		// goes in:  until then it still points at the old lines there.
+		putLe16(len, hdr.fill);
+		if(!f.seek(hdr.offsetOf(hdr.cur)) || f.write(len, 2)!=2) return false;
+		f.flush();
+		hdr.cur = (hdr.cur+1)%hdr.sectors;
+		if(hdr.cur==hdr.first) hdr.first = (hdr.first+1)%hdr.sectors;
+		hdr.fill = 0;
+		if(!hdr.write(f)) return false;
+		f.flush();
+	}
+	if(!f.seek(hdr.offsetOf(hdr.cur)+2+hdr.fill) || f.write((const uint8_t*)line, n)!=(size_t)n || f.write('\n')!=1) return false;
+	hdr.fill += n+1;
+	if(!hdr.write(f)) return false;
+	f.flush();
+	return true;
+}
+
+bool Tmsh_ringLog::printf(const char* fmt, ...) {
+	char line[128];
+	va_list args;
+	va_start(args, fmt);
+	vsnprintf(line, sizeof(line), fmt, args);
+	va_end(args);
+	return append(line);
+}
+
+bool Tmsh_ringLog::clear() {
+	if(!open) return false;
+	hdr.first = hdr.cur = hdr.fill = 0;
+	if(!hdr.write(f)) return false;
+	f.flush();
+	return true;
+}
+
+int Tmsh_ringLogReader::lengthOf(int i) {
+	// bytes of lines in the i'th sector on from first
+	uint8_t len[2];
+	int s = (hdr.first+i)%hdr.sectors;
+	if(s==hdr.cur) return hdr.fill;
+	if(!f.seek(hdr.offsetOf(s)) || f.read(len, 2)!=2) return 0;
+	return getLe16(len)<=hdr.sectorSize-2 ? getLe16(len) : 0;
+}
+
+bool Tmsh_ringLogReader::seekTo(int i, int from) {
+	sector = i;
+	len = lengthOf(i);
+	pos = from;
+	return f.seek(hdr.offsetOf((hdr.first+i)%hdr.sectors)+2+pos);
+}
+
+bool Tmsh_ringLogReader::begin(fs::FS& fs, const char* path, long lastLines) {
+	uint8_t buf[64];
+	long lines, skip;
+	int i, n, k, p;
+	f = fs.open(addSlash(path).c_str(), FILE_READ);
+	if(!f || f.isDirectory() || !hdr.read(f)) { end(); return false; }
+	if(!seekTo(0, 0)) { end(); return false; }
+	if(lastLines<=0) return true;
+
+	// Count lines back from the newest sector until there are enough, then skip the
+	// extra ones at the start of the sector that made it enough.
+	lines = 0;
+	for(i=hdr.used()-1; i>=0; i--) {
+		if(!seekTo(i, 0)) { end(); return false; }
+		for(n=0; n<len; n+=k) {
+			k = len-n<(int)sizeof(buf) ? len-n : sizeof(buf);
+			if((int)f.read(buf, k)!=k) { end(); return false; }
+			for(p=0; p<k; p++) if(buf[p]=='\n') lines++;
+		}
+		if(lines>=lastLines) break;
+	}
+	if(i<0) return seekTo(0, 0);
+	skip = lines-lastLines;
+	if(!seekTo(i, 0)) { end(); return false; }
+	while(skip>0 && pos<len) {
+		if(f.read(buf, 1)!=1) { end(); return false; }
+		pos++;
+		if(buf[0]=='\n') skip--;
+	}
+	return true;
+}
+
+int Tmsh_ringLogReader::read(uint8_t* buf, int n) {
+	int k;
+	if(!f) return 0;
+	while(pos==len) {
+		if(sector+1>=hdr.used() || !seekTo(sector+1, 0)) return 0;
+	}
+	k = len-pos<n ? len-pos : n;
+	if((k=f.read(buf, k))<=0) return 0;
+	pos += k;
+	return k;
+}
+
+void Tmsh_ringLogReader::end() {
+	if(f) f.close();
+}
+#endif
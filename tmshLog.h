@@ -0,0 +1,93 @@
+//
+// Ring log:  a log file of fixed size, for tasks that log forever
+//
+// The file is made once, at its full size:  a 16-byte header, then a number of sectors
+// of the same size.  Lines are appended to the current sector; a line that doesn't fit
+// in what's left of it starts the next one, and once every sector has been used, the
+// next one is the oldest, whose lines are dropped.  So an append is a write of the line
+// and of the header, wherever the log is, and the file never grows or gets rewritten.
+//
+// The header holds the sectors' size and number, the oldest sector, the current one and
+// how full it is.  Each sector starts with its length (2 bytes, LE), written when the
+// log moves on from it; the current sector's length is the header's.  Lines don't span
+// sectors, so a sector can be read on its own.  A line longer than a sector is cut.
+//
+// Only what the header says is there is read, and it's written after what it points at:
+// after the line, and, when an append moves to the next sector, after the length of the
+// one it closes and before anything goes into the new one.  So a reset in the middle of
+// an append loses that line, and the oldest sector if the append was dropping it.
+//
+// Tmsh_ringLogReader reads a log oldest line first, a block at a time, for logcat.
+//
+
+#if !defined(__TMSHLOG__)
+#define __TMSHLOG__
+
+#include <Arduino.h>
+#if defined(ARDUINO_ARCH_ESP8266) || defined(ARDUINO_ARCH_ESP32)
+#include <FS.h>
+
+#define TMSH_LOG_HEADER 16
+#define TMSH_LOG_SECTORS 16			// when begin() makes a log and isn't told
+#define TMSH_LOG_SECTOR 256
+
+// what's in the header
+struct Tmsh_ringLogInfo {
+	uint16_t sectorSize;
+	uint16_t sectors;
+	uint16_t first;		// the oldest sector
+	uint16_t cur;		// the one being written
+	uint16_t fill;		// bytes of lines in cur
+	// sectors in use, oldest to cur
+	int used() const { return (cur+sectors-first)%sectors + 1; }
+	long offsetOf(int sector) const { return TMSH_LOG_HEADER + (long)sector*sectorSize; }
+	bool read(File& f);
+	bool write(File& f) const;
+};
+
+class Tmsh_ringLog {
+	public:
+		Tmsh_ringLog(): open(false) {}
+
+		// Open the log at path, or make it, with sectors of sectorSize bytes, if there's
+		// no file there.  An existing log keeps its own sizes.  false if path is
+		// something other than a ring log, or it can't be made.
+		bool begin(fs::FS& fs, const char* path, int sectors=TMSH_LOG_SECTORS, int sectorSize=TMSH_LOG_SECTOR);
+		bool ready() const { return open; }
+		void end();
+
+		// Append line, and a \n.  false if it couldn't be written.
+		bool append(const char* line);
+		bool printf(const char* fmt, ...);
+		// Drop every line, keeping the file.
+		bool clear();
+
+		const Tmsh_ringLogInfo& info() const { return hdr; }
+
+	private:
+		File f;
+		Tmsh_ringLogInfo hdr;
+		bool open;
+};
+
+class Tmsh_ringLogReader {
+	public:
+		// Start reading the log at path from its lastLines'th last line (0 for the whole
+		// of it).  false if path isn't a ring log.
+		bool begin(fs::FS& fs, const char* path, long lastLines=0);
+		// Up to n more bytes of lines, oldest first; 0 at the end.
+		int read(uint8_t* buf, int n);
+		void end();
+
+	private:
+		File f;
+		Tmsh_ringLogInfo hdr;
+		int sector;			// how many sectors on from first
+		int pos, len;		// in that sector's lines
+
+		int lengthOf(int i);
+		bool seekTo(int i, int from);
+};
+#endif
+
+#endif
@@ -0,0 +1,47 @@
+//
+// Pipes for the shell's pipelines -- see tmshPipe.h
+//
+#include <Arduino.h>
+#include <string.h>
+
+#include "tmshPipe.h"
+
+void Tmsh_pipe::reset() {
+	head = tail = used = 0;
+	dropped = 0;
+	writerDone = readerDone = false;
+}
+
+size_t Tmsh_pipe::write(uint8_t c) {
+	if(readerDone) return 1;
+	if(used==TMSH_PIPE_SIZE) { dropped++; return 0; }
+	ring[head] = c;
+	if(++head==TMSH_PIPE_SIZE) head = 0;
+	used++;
+	return 1;
+}
+
+size_t Tmsh_pipe::write(const uint8_t* data, size_t len) {
+	size_t n, chunk;
+	if(readerDone) return len;
+	for(n=0; n<len && used<TMSH_PIPE_SIZE; n+=chunk) {
+		// up to the end of the ring or the end of the room, whichever comes first
+		chunk = TMSH_PIPE_SIZE-(head>used ? head : used);
+		if(chunk>len-n) chunk = len-n;
+		memcpy(ring+head, data+n, chunk);
+		head += chunk;
+		if(head==TMSH_PIPE_SIZE) head = 0;
+		used += chunk;
+	}
+	dropped += len-n;
+	return n;
+}
+
+int Tmsh_pipe::read() {
+	int c;
+	if(used==0) return -1;
+	c = ring[tail];
+	if(++tail==TMSH_PIPE_SIZE) tail = 0;
+	used--;
+	return c;
+}
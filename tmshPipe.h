@@ -0,0 +1,48 @@
+//
+// Pipes for the shell's pipelines:  cmd1 | cmd2 | ...
+//
+// A pipe is a fixed ring of TmshProfile::pipeBuf bytes between one stage's Out and the
+// next stage's In.  Nothing waits inside the pipe:  a writer that wants backpressure asks
+// for room() first and yields while there's none, and a reader yields while there's
+// nothing available() and the pipe hasn't ended().  Bytes written past the room there is
+// are dropped and counted, so a writer that doesn't ask loses output but never hangs.
+//
+
+#if !defined(__TMSHPIPE__)
+#define __TMSHPIPE__
+
+#include <Arduino.h>
+#include <TaskManagerShProfile.h>
+
+#define TMSH_PIPE_SIZE (TmshProfile::pipeBuf>0 ? TmshProfile::pipeBuf : 1)
+
+class Tmsh_pipe : public Stream {
+	public:
+		Tmsh_pipe() { reset(); }
+
+		// Empty it, with both ends open.
+		void reset();
+		// The writer is finished; the reader sees the end once it's read what's left.
+		void closeWrite() { writerDone = true; }
+		// The reader is gone; anything written from now on is thrown away.
+		void closeRead() { readerDone = true; head = tail = used = 0; }
+		bool ended() const { return writerDone && used==0; }
+		int room() const { return readerDone ? TMSH_PIPE_SIZE : TMSH_PIPE_SIZE-used; }
+		unsigned long dropped;		// bytes written when there was no room
+
+		using Print::write;
+		size_t write(uint8_t c) override;
+		size_t write(const uint8_t* data, size_t len) override;
+		int availableForWrite() override { return room(); }
+		int available() override { return used; }
+		int read() override;
+		int peek() override { return used>0 ? ring[tail] : -1; }
+		void flush() override {}
+
+	private:
+		uint8_t ring[TMSH_PIPE_SIZE];
+		int head, tail, used;
+		bool writerDone, readerDone;
+};
+
+#endif
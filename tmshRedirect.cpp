@@ -0,0 +1,56 @@
+//
+// Output redirection for the shell -- see tmshRedirect.h
+//
+#include <Arduino.h>
+
+#if defined(ARDUINO_ARCH_ESP8266) || defined(ARDUINO_ARCH_ESP32)
+#include <FS.h>
+#include <string.h>
+
+#include "tmshRedirect.h"
+
+String addSlash(const char* fn);	// from utils
+
+bool Tmsh_fileSink::open(fs::FS& fs, const char* path, bool append) {
+	used = 0;
+	failed = false;
+	f = fs.open(addSlash(path).c_str(), append ? FILE_APPEND : FILE_WRITE);
+	if(f && f.isDirectory()) f.close();
+	return (bool)f;
+}
+
+bool Tmsh_fileSink::close() {
+	if(!f) return !failed;
+	flush();
+	f.close();
+	return !failed;
+}
+
+void Tmsh_fileSink::flush() {
+	if(used>0 && f && f.write(block, used)!=used) failed = true;
+	used = 0;
+}
+
+size_t Tmsh_fileSink::write(uint8_t c) {
+	block[used++] = c;
+	if(used==TMSH_SINK_BLOCK) flush();
+	return 1;
+}
+
+size_t Tmsh_fileSink::write(const uint8_t* data, size_t len) {
+	size_t n, left;
+	for(left=len; left>0; left-=n, data+=n) {
+		if(used==0 && left>=TMSH_SINK_BLOCK) {
+			// a whole block or more with nothing waiting; no need to copy it
+			n = left-left%TMSH_SINK_BLOCK;
+			if(f && f.write(data, n)!=n) failed = true;
+			continue;
+		}
+		n = TMSH_SINK_BLOCK-used < left ? TMSH_SINK_BLOCK-used : left;
+		memcpy(block+used, data, n);
+		used += n;
+		if(used==TMSH_SINK_BLOCK) flush();
+	}
+	return len;
+}
+#endif
@@ -0,0 +1,41 @@
+//
+// Output redirection for the shell:  cmd args... > fn  and  cmd args... >> fn
+//
+// A command prints to its Tmsh_param's Out.  That's Serial, unless the line was
+// redirected, in which case Out is a Tmsh_fileSink:  a Print that gathers what's written
+// into blocks of TMSH_SINK_BLOCK bytes and writes each block to the file in one go, so
+// a long dump goes at flash speed and nothing of it touches the console.
+//
+
+#if !defined(__TMSHREDIRECT__)
+#define __TMSHREDIRECT__
+
+#include <Arduino.h>
+#if defined(ARDUINO_ARCH_ESP8266) || defined(ARDUINO_ARCH_ESP32)
+#include <FS.h>
+
+#define TMSH_SINK_BLOCK 512
+
+class Tmsh_fileSink : public Print {
+	public:
+		Tmsh_fileSink(): used(0), failed(false) {}
+		~Tmsh_fileSink() { close(); }
+
+		// Open path to write (append true for >>).  false if it can't be opened.
+		bool open(fs::FS& fs, const char* path, bool append);
+		// Write out what's left and close.  false if any of it failed to write.
+		bool close();
+
+		size_t write(uint8_t c) override;
+		size_t write(const uint8_t* data, size_t len) override;
+		void flush() override;
+
+	private:
+		File f;
+		size_t used;
+		bool failed;
+		uint8_t block[TMSH_SINK_BLOCK];
+};
+#endif
+
+#endif
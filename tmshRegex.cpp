@@ -0,0 +1,315 @@
+//
+// Small regular expression engine -- see tmshRegex.h
+//
+#include <Arduino.h>
+#include <string.h>
+
+#include "tmshRegex.h"
+
+// opcodes
+#define RE_CHAR 0
+#define RE_ANY 1
+#define RE_CLASS 2
+#define RE_SPLIT 3	// try x, then y
+#define RE_JMP 4
+#define RE_SAVE 5
+#define RE_BOL 6
+#define RE_EOL 7
+#define RE_MATCH 8
+
+// *** COMPILER
+// Straightforward recursive descent, emitting code as it goes.
+// Repeats are handled by inserting a SPLIT in front of code that's already been emitted.
+
+bool Tmsh_regex::emit(uint8_t op, uint8_t arg, int x, int y) {
+	return insert(nInsts, op, arg, x, y);
+}
+
+bool Tmsh_regex::insert(int pos, uint8_t op, uint8_t arg, int x, int y) {
+	// Put an instruction at pos, shifting the rest up.  Jumps to targets past pos move with
+	// their targets; a jump to pos itself now lands on the new instruction, which is what
+	// the repeat and alternation code wants.
+	int i;
+	if(nInsts==TMSH_RE_MAX_INSTS) { if(err==NULL) err = "pattern too complex"; return false; }
+	for(i=0; i<nInsts; i++) {
+		if(prog[i].x>pos) prog[i].x++;
+		if(prog[i].y>pos) prog[i].y++;
+	}
+	memmove(&prog[pos+1], &prog[pos], (nInsts-pos)*sizeof(Inst));
+	prog[pos].op = op;
+	prog[pos].arg = arg;
+	prog[pos].x = x;
+	prog[pos].y = y;
+	nInsts++;
+	return true;
+}
+
+void Tmsh_regex::parseAlt() {
+	// alt := concat ( '|' alt )?
+	int start, jmp;
+	start = nInsts;
+	parseConcat();
+	if(err!=NULL || *pat!='|') return;
+	pat++;
+	if(!insert(start, RE_SPLIT, 0, start+1, -1)) return;
+	jmp = nInsts;
+	if(!emit(RE_JMP)) return;
+	prog[start].y = nInsts;
+	parseAlt();
+	prog[jmp].x = nInsts;
+}
+
+void Tmsh_regex::parseConcat() {
+	while(err==NULL && *pat!='\0' && *pat!='|' && *pat!=')') parseRepeat();
+}
+
+void Tmsh_regex::parseRepeat() {
+	// repeat := atom ( '*' | '+' | '?' )?
+	int start;
+	start = nInsts;
+	parseAtom();
+	if(err!=NULL) return;
+	if(*pat=='*') {
+		pat++;
+		if(!insert(start, RE_SPLIT, 0, start+1, -1)) return;
+		if(!emit(RE_JMP, 0, start)) return;
+		prog[start].y = nInsts;
+	} else if(*pat=='+') {
+		pat++;
+		emit(RE_SPLIT, 0, start, nInsts+1);
+	} else if(*pat=='?') {
+		pat++;
+		if(!insert(start, RE_SPLIT, 0, start+1, -1)) return;
+		prog[start].y = nInsts;
+	}
+	if(err==NULL && (*pat=='*' || *pat=='+' || *pat=='?')) err = "repeat of a repeat";
+}
+
+void Tmsh_regex::parseAtom() {
+	int group;
+	switch(*pat) {
+		case '(':
+			pat++;
+			if(nGroups==TMSH_RE_MAX_GROUPS) { err = "too many groups"; return; }
+			group = ++nGroups;
+			if(!emit(RE_SAVE, 2*group)) return;
+			parseAlt();
+			if(err!=NULL) return;
+			if(*pat!=')') { err = "missing )"; return; }
+			pat++;
+			emit(RE_SAVE, 2*group+1);
+			break;
+		case '[':
+			pat++;
+			parseClass();
+			break;
+		case '.':
+			pat++;
+			emit(RE_ANY);
+			break;
+		case '^':
+			pat++;
+			emit(RE_BOL);
+			break;
+		case '$':
+			pat++;
+			emit(RE_EOL);
+			break;
+		case '*': case '+': case '?':
+			err = "nothing to repeat";
+			break;
+		case '\\':
+			pat++;
+			if(*pat=='\0') { err = "trailing \\"; return; }
+			// fall through -- the escaped char is a literal
+		default:
+			emit(RE_CHAR, (uint8_t)*pat++);
+			break;
+	}
+}
+
+void Tmsh_regex::parseClass() {
+	// [abc] [a-z] [^...]  A ] first in the list is a literal, as is anything after a \.
+	bool negate;
+	uint8_t lo, hi;
+	int c;
+	uint8_t* bits;
+	if(nClasses==TMSH_RE_MAX_CLASSES) { err = "too many [] classes"; return; }
+	bits = classes[nClasses];
+	memset(bits, 0, 32);
+	negate = *pat=='^';
+	if(negate) pat++;
+	do {
+		if(*pat=='\0') { err = "missing ]"; return; }
+		if(*pat=='\\' && pat[1]!='\0') pat++;
+		lo = hi = (uint8_t)*pat++;
+		if(*pat=='-' && pat[1]!=']' && pat[1]!='\0') {
+			pat++;
+			if(*pat=='\\' && pat[1]!='\0') pat++;
+			hi = (uint8_t)*pat++;
+		}
+		for(c=lo; c<=hi; c++) bits[c>>3] |= 1<<(c&7);
+	} while(*pat!=']');
+	pat++;
+	if(negate) for(c=0; c<32; c++) bits[c] = ~bits[c];
+	bits[0] &= ~1;	// never match the terminating \0
+	emit(RE_CLASS, nClasses++);
+}
+
+const char* Tmsh_regex::compile(const char* pattern) {
+	nInsts = nClasses = nGroups = 0;
+	pat = pattern;
+	err = NULL;
+	emit(RE_SAVE, 0);
+	parseAlt();
+	if(err==NULL && *pat==')') err = "unmatched )";
+	if(err==NULL) emit(RE_SAVE, 1);
+	if(err==NULL) emit(RE_MATCH);
+	if(err!=NULL) nInsts = 0;
+	return err;
+}
+
+// *** MATCHER
+// The thread lists and visit marks are shared by all patterns; a search never yields,
+// so only one can be running at a time.
+
+struct ReThread {
+	int8_t pc;
+	int16_t caps[TMSH_RE_NSLOTS];
+};
+struct ReThreadList {
+	int n;
+	ReThread t[TMSH_RE_MAX_INSTS];
+};
+static ReThreadList reLists[2];
+static uint16_t reMark[TMSH_RE_MAX_INSTS];
+static uint16_t reGen;
+
+static void reNextGen() {
+	if(++reGen==0) {
+		memset(reMark, 0, sizeof(reMark));
+		reGen = 1;
+	}
+}
+
+void Tmsh_regex::addThread(ReThreadList* l, int pc, int16_t* caps, int pos) {
+	// Follow jumps, splits, saves and anchors from pc, adding the resulting char-consuming
+	// (or MATCH) threads to l in priority order.  Recursion depth is bounded by nInsts.
+	int16_t old;
+	if(reMark[pc]==reGen) return;
+	reMark[pc] = reGen;
+	const Inst& in = prog[pc];
+	switch(in.op) {
+		case RE_JMP:
+			addThread(l, in.x, caps, pos);
+			break;
+		case RE_SPLIT:
+			addThread(l, in.x, caps, pos);
+			addThread(l, in.y, caps, pos);
+			break;
+		case RE_SAVE:
+			old = caps[in.arg];
+			caps[in.arg] = pos;
+			addThread(l, pc+1, caps, pos);
+			caps[in.arg] = old;
+			break;
+		case RE_BOL:
+			if(pos==0) addThread(l, pc+1, caps, pos);
+			break;
+		case RE_EOL:
+			if(text[pos]=='\0') addThread(l, pc+1, caps, pos);
+			break;
+		default:
+			l->t[l->n].pc = pc;
+			memcpy(l->t[l->n].caps, caps, sizeof(l->t[l->n].caps));
+			l->n++;
+			break;
+	}
+}
+
+bool Tmsh_regex::search(const char* text, int start, int* caps) {
+	ReThreadList* clist;
+	ReThreadList* nlist;
+	ReThreadList* tmp;
+	int16_t initCaps[TMSH_RE_NSLOTS];
+	int pos, i;
+	bool matched;
+	uint8_t c;
+
+	if(nInsts==0) return false;
+	this->text = text;
+	for(i=0; i<TMSH_RE_NSLOTS; i++) initCaps[i] = -1;
+	matched = false;
+	clist = &reLists[0];
+	nlist = &reLists[1];
+	clist->n = 0;
+	reNextGen();
+	addThread(clist, 0, initCaps, start);
+	for(pos=start; ; pos++) {
+		if(clist->n==0 && matched) break;
+		c = (uint8_t)text[pos];
+		nlist->n = 0;
+		reNextGen();
+		for(i=0; i<clist->n; i++) {
+			ReThread* t = &clist->t[i];
+			const Inst& in = prog[t->pc];
+			if(in.op==RE_MATCH) {
+				// lower-priority threads can't beat this one
+				for(int j=0; j<TMSH_RE_NSLOTS; j++) caps[j] = t->caps[j];
+				matched = true;
+				break;
+			}
+			if(c=='\0') continue;
+			if((in.op==RE_CHAR && c==in.arg) || in.op==RE_ANY
+			  || (in.op==RE_CLASS && (classes[in.arg][c>>3] & (1<<(c&7))))) {
+				addThread(nlist, t->pc+1, t->caps, pos+1);
+			}
+		}
+		if(c=='\0') break;
+		// try a match starting at the next position, at the lowest priority
+		if(!matched) addThread(nlist, 0, initCaps, pos+1);
+		tmp = clist; clist = nlist; nlist = tmp;
+	}
+	return matched;
+}
+
+// *** CACHE
+// A couple of recently used patterns, so that repeated f/s commands don't recompile.
+#define TMSH_RE_CACHE_SIZE 2
+
+static struct {
+	String pattern;
+	Tmsh_regex re;
+	unsigned long lastUse;
+	bool valid;
+} reCache[TMSH_RE_CACHE_SIZE];
+static unsigned long reCacheClock;
+
+Tmsh_regex* Tmsh_regexCompile(const char* pattern, const char** err) {
+	int i, victim;
+	victim = 0;
+	for(i=0; i<TMSH_RE_CACHE_SIZE; i++) {
+		if(reCache[i].valid && reCache[i].pattern==pattern) {
+			reCache[i].lastUse = ++reCacheClock;
+			return &reCache[i].re;
+		}
+		if(reCache[victim].valid && (!reCache[i].valid || reCache[i].lastUse<reCache[victim].lastUse)) victim = i;
+	}
+	if((*err=reCache[victim].re.compile(pattern))!=NULL) {
+		reCache[victim].valid = false;
+		return NULL;
+	}
+	reCache[victim].pattern = pattern;
+	reCache[victim].lastUse = ++reCacheClock;
+	reCache[victim].valid = true;
+	return &reCache[victim].re;
+}
+
+long Tmsh_regexMemUse() {
+	// the matcher's scratch space plus the cache
+	long n;
+	int i;
+	n = sizeof(reLists) + sizeof(reMark) + sizeof(reCache);
+	for(i=0; i<TMSH_RE_CACHE_SIZE; i++) n += reCache[i].pattern.length();
+	return n;
+}
@@ -0,0 +1,75 @@
+//
+// Small regular expression engine for the shell and ed
+//
+// Patterns are compiled once into a little NFA program and run with a
+// Pike VM (all threads in lockstep), so matching time is linear in the
+// length of the text and the memory used is fixed.
+//
+// Supported:  c  .  [abc] [a-z] [^...]  * + ?  |  ( )  ^ $  \c (literal c)
+// Groups are numbered 1..TMSH_RE_MAX_GROUPS from their opening (.
+// Leftmost match wins; among matches at the same spot, * + ? are greedy.
+//
+
+#if !defined(__TMSHREGEX__)
+#define __TMSHREGEX__
+
+#include <Arduino.h>
+
+// The state budget.  A pattern that needs more than this fails to compile.
+#define TMSH_RE_MAX_INSTS 64
+#define TMSH_RE_MAX_GROUPS 4
+#define TMSH_RE_MAX_CLASSES 4
+#define TMSH_RE_NSLOTS (2*(TMSH_RE_MAX_GROUPS+1))
+
+class Tmsh_regex {
+	public:
+		Tmsh_regex(): nInsts(0), nGroups(0) {}
+
+		// Compile pattern.  Returns NULL if OK, else a description of the problem.
+		const char* compile(const char* pattern);
+
+		// Search text for a match starting at or after offset start.
+		// On a match, caps[0],caps[1] are the start and end (exclusive) offsets of the whole
+		// match, caps[2n],caps[2n+1] those of group n; -1 for a group that didn't take part.
+		// caps must hold TMSH_RE_NSLOTS ints.
+		bool search(const char* text, int start, int* caps);
+
+		int groups() const { return nGroups; }
+
+	private:
+		struct Inst {
+			uint8_t op;
+			uint8_t arg;	// char, class number, or save slot
+			int8_t x, y;	// jump targets
+		};
+		Inst prog[TMSH_RE_MAX_INSTS];
+		uint8_t classes[TMSH_RE_MAX_CLASSES][32];
+		int nInsts;
+		int nClasses;
+		int nGroups;
+
+		// compiler state
+		const char* pat;
+		const char* err;
+		// matcher state
+		const char* text;
+
+		bool emit(uint8_t op, uint8_t arg=0, int x=-1, int y=-1);
+		bool insert(int pos, uint8_t op, uint8_t arg=0, int x=-1, int y=-1);
+		void parseAlt();
+		void parseConcat();
+		void parseRepeat();
+		void parseAtom();
+		void parseClass();
+		void addThread(struct ReThreadList* l, int pc, int16_t* caps, int pos);
+};
+
+// Compile pattern, or fetch it already compiled from a small cache of recent patterns.
+// Returns NULL if the pattern is bad, with *err set to the reason.  The pointer stays good
+// until enough other patterns have been compiled to push this one out of the cache.
+Tmsh_regex* Tmsh_regexCompile(const char* pattern, const char** err);
+
+// Bytes of RAM the engine's static scratch and cache are using, for the shell's mem report.
+long Tmsh_regexMemUse();
+
+#endif
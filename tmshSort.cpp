@@ -0,0 +1,254 @@
+//
+// External merge sort -- see tmshSort.h
+//
+#include <Arduino.h>
+
+#if defined(ARDUINO_ARCH_ESP8266) || defined(ARDUINO_ARCH_ESP32)
+#include <FS.h>
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+
+#include "utils.h"
+#include "tmshSort.h"
+
+static_assert(TmshProfile::sortBuf==0 || TMSH_SORT_FANIN>=2, "TaskManagerSh sortBuf is too small to merge in");
+
+String addSlash(const char* fn);	// from utils
+
+static int sortSeq = 0;
+static const Tmsh_sort* sortCmpOwner;	// for qsort, which has no context argument
+
+Tmsh_sort::Tmsh_sort(): fs(NULL), arena(NULL), nHeap(0), srcDone(false), haveLine(false), merging(false),
+  final(false), firstRun(0), nextRun(0), nMerge(0), levelEnd(0), lastStep(1), nRuns(0), haveLast(false), nIn(0),
+  nOut(0), nCut(0) {}
+
+Tmsh_sort::~Tmsh_sort() {
+	int i;
+	for(i=0; i<nMerge; i++) if(ins[i].f) ins[i].f.close();
+	if(src.f) src.f.close();
+	out.close();
+	if(fs!=NULL) {
+		for(i=firstRun; i<=nextRun; i++) fs->remove(runName(i).c_str());	// nextRun, if it was being written
+		fs->remove((outPath+".tmp").c_str());
+	}
+	delete[] arena;
+}
+
+String Tmsh_sort::runName(int run) const {
+	return String("/.sort") + String(seq) + "." + String(run);
+}
+
+bool Tmsh_sort::begin(fs::FS& store, const char* in, const char* outFn, int keyField, bool num, bool uniq) {
+	fs = &store;
+	outPath = addSlash(outFn);
+	if(!tmpNameFits(outFn)) { Serial.printf("Name too long [%s]\n", outFn); return false; }
+	field = keyField;
+	numeric = num;
+	unique = uniq;
+	seq = sortSeq++;
+	src.f = fs->open(addSlash(in).c_str(), FILE_READ);
+	if(!src.f || src.f.isDirectory()) { Serial.printf("Can't read [%s]\n", in); return false; }
+	if((arena=new(std::nothrow) char[TmshProfile::sortBuf])==NULL) { Serial.print(F("Out of memory.\n")); return false; }
+	src.blk = arena;
+	src.blkLen = src.blkPos = 0;
+	src.line = arena+TMSH_SORT_BLOCK;
+	return true;
+}
+
+bool Tmsh_sort::readLine(Input& in) {
+	// The next line of in into in.line, without its \r\n.  false at the end.
+	char c;
+	in.len = 0;
+	for(;;) {
+		if(in.blkPos==in.blkLen) {
+			in.blkLen = in.f.read((uint8_t*)in.blk, TMSH_SORT_BLOCK);
+			in.blkPos = 0;
+			if(in.blkLen<=0) {
+				in.blkLen = 0;
+				in.line[in.len] = '\0';
+				return in.len>0;	// a last line with no \n
+			}
+		}
+		c = in.blk[in.blkPos++];
+		if(c=='\n') break;
+		if(c=='\r') continue;
+		if(in.len<TMSH_SORT_MAXLINE) in.line[in.len++] = c;
+		else if(in.len++==TMSH_SORT_MAXLINE) nCut++;
+	}
+	if(in.len>TMSH_SORT_MAXLINE) in.len = TMSH_SORT_MAXLINE;
+	in.line[in.len] = '\0';
+	return true;
+}
+
+const char* Tmsh_sort::key(const char* line, int& len) const {
+	// the field to sort on; an empty one if the line hasn't that many
+	const char* end;
+	int i;
+	for(i=1; i<field && *line; line++) if(*line==',') i++;
+	if(i<field) { len = 0; return line; }
+	end = field>0 ? strchr(line, ',') : NULL;
+	len = end!=NULL ? end-line : strlen(line);
+	return line;
+}
+
+int Tmsh_sort::compare(const char* a, const char* b) const {
+	const char *ka, *kb;
+	int la, lb, n;
+	double da, db;
+	ka = key(a, la);
+	kb = key(b, lb);
+	if(numeric) {
+		// strtod stops at the comma that ends the field
+		da = strtod(ka, NULL);
+		db = strtod(kb, NULL);
+		return da<db ? -1 : da>db ? 1 : 0;
+	}
+	n = memcmp(ka, kb, la<lb ? la : lb);
+	return n!=0 ? n : la-lb;
+}
+
+int Tmsh_sort::qsortCompare(const void* a, const void* b) {
+	// equal keys by where the lines are in the arena, which is the order they were read
+	const char* la = *(char* const*)a;
+	const char* lb = *(char* const*)b;
+	int n = sortCmpOwner->compare(la, lb);
+	return n!=0 ? n : la<lb ? -1 : la>lb ? 1 : 0;
+}
+
+void Tmsh_sort::emit(const char* line) {
+	int len;
+	if(unique && haveLast && compare(last, line)==0) return;
+	len = strlen(line);
+	out.write((const uint8_t*)line, len);
+	out.write('\n');
+	if(unique) {
+		memcpy(last, line, len+1);
+		haveLast = true;
+	}
+	if(final) nOut++;
+}
+
+int Tmsh_sort::formRun() {
+	// Fill the arena above src's buffers with lines, packed up from the bottom, with a
+	// pointer to each packed down from the top.  Sort the pointers and write the run.
+	char* next = arena+TMSH_SORT_BLOCK+TMSH_SORT_MAXLINE+1;
+	char** ptrs = (char**)(arena+(TmshProfile::sortBuf & ~(long)(sizeof(char*)-1)));
+	int n, i;
+	for(n=0; ; n++) {
+		if(!haveLine) {
+			if(!readLine(src)) { srcDone = true; break; }
+			nIn++;
+			haveLine = true;
+		}
+		if(next+src.len+1 > (char*)(ptrs-n-1)) break;
+		memcpy(next, src.line, src.len+1);
+		ptrs[-n-1] = next;
+		next += src.len+1;
+		haveLine = false;
+	}
+	if(srcDone) src.f.close();
+	if(n==0 && nextRun>0) return 1;		// the last run ended right at the end
+	sortCmpOwner = this;
+	qsort(ptrs-n, n, sizeof(char*), qsortCompare);
+
+	// all of it fitted in the one run:  it can go straight to out
+	final = srcDone && nextRun==0;
+	if(!out.open(*fs, final ? (outPath+".tmp").c_str() : runName(nextRun).c_str(), false)) {
+		Serial.print(F("Can't write a sort file.\n"));
+		return -1;
+	}
+	haveLast = false;
+	nRuns++;
+	for(i=0; i<n; i++) emit(ptrs[-n+i]);
+	if(!out.close()) { Serial.print(F("Can't write a sort file.\n")); return -1; }
+	if(final) {
+		if(!replaceFile(*fs, (outPath+".tmp").c_str(), outPath.c_str())) { Serial.printf("Can't write [%s]\n", outPath.c_str()); return -1; }
+		return 0;
+	}
+	nextRun++;
+	return 1;
+}
+
+bool Tmsh_sort::before(int a, int b) const {
+	// whether input a's line goes out before input b's:  equal keys by the earlier run
+	int n = compare(ins[a].line, ins[b].line);
+	return n<0 || (n==0 && a<b);
+}
+
+void Tmsh_sort::siftDown(int i) {
+	int child;
+	uint8_t t;
+	for(; (child=2*i+1)<nHeap; i=child) {
+		if(child+1<nHeap && before(heap[child+1], heap[child])) child++;
+		if(!before(heap[child], heap[i])) break;
+		t = heap[i]; heap[i] = heap[child]; heap[child] = t;
+	}
+}
+
+int Tmsh_sort::mergeStep() {
+	long written;
+	int i;
+	if(!merging) {
+		// Start merging the oldest runs, into a new run, or into out if they're the last.
+		// A merge doesn't take runs from two levels, as the newer level's runs were made
+		// from older input.
+		if(firstRun==levelEnd) levelEnd = nextRun;
+		nMerge = levelEnd-firstRun<TMSH_SORT_FANIN ? levelEnd-firstRun : TMSH_SORT_FANIN;
+		final = nMerge==nextRun-firstRun;
+		nHeap = 0;
+		for(i=0; i<nMerge; i++) {
+			ins[i].f = fs->open(runName(firstRun+i).c_str(), FILE_READ);
+			ins[i].blk = arena+i*(TMSH_SORT_BLOCK+TMSH_SORT_MAXLINE+1);
+			ins[i].line = ins[i].blk+TMSH_SORT_BLOCK;
+			ins[i].blkLen = ins[i].blkPos = 0;
+			if(!ins[i].f) { Serial.print(F("Can't read a sort file.\n")); return -1; }
+			if(readLine(ins[i])) heap[nHeap++] = i;
+		}
+		for(i=nHeap/2-1; i>=0; i--) siftDown(i);
+		if(!out.open(*fs, final ? (outPath+".tmp").c_str() : runName(nextRun).c_str(), false)) {
+			Serial.print(F("Can't write a sort file.\n"));
+			return -1;
+		}
+		haveLast = false;
+		merging = true;
+	}
+
+	for(written=0; nHeap>0 && written<TMSH_SORT_STRETCH; ) {
+		i = heap[0];
+		emit(ins[i].line);
+		written += ins[i].len+1;
+		if(!readLine(ins[i])) heap[0] = heap[--nHeap];
+		siftDown(0);
+	}
+	if(nHeap>0) return 1;
+
+	// this merge is done
+	merging = false;
+	for(i=0; i<nMerge; i++) {
+		ins[i].f.close();
+		fs->remove(runName(firstRun+i).c_str());
+	}
+	firstRun += nMerge;
+	nMerge = 0;
+	if(!out.close()) { Serial.print(F("Can't write a sort file.\n")); return -1; }
+	if(final) {
+		if(!replaceFile(*fs, (outPath+".tmp").c_str(), outPath.c_str())) { Serial.printf("Can't write [%s]\n", outPath.c_str()); return -1; }
+		return 0;
+	}
+	nextRun++;
+	return 1;
+}
+
+int Tmsh_sort::step() {
+	if(arena==NULL) return -1;
+	if(!srcDone) return formRun();
+	if(firstRun==nextRun) return 0;		// out is written
+	return mergeStep();
+}
+
+void Tmsh_sort::stepJob(void* sort) {
+	Tmsh_sort* s = (Tmsh_sort*)sort;
+	s->lastStep = s->step();
+}
+#endif
@@ -0,0 +1,103 @@
+//
+// External merge sort:  sort [-k field] [-n] [-u] in out
+//
+// The input is read a block at a time into an arena of the profile's sortBuf bytes.  Each
+// time the arena fills, its lines are sorted and written out as a run, a temp file.  The
+// runs are then merged, up to as many at a time as the arena has room for a read block
+// and a line each, with a little heap to pick the next line.  The last merge writes to a
+// temp file that's renamed over out, so in and out can be the same file.  However big
+// the file, the sort uses the arena and nothing else.
+//
+// Tmsh_sort is a state machine:  each step() forms one run, or moves a stretch of lines
+// through a merge, so the caller can yield between steps.  A step reads and writes
+// flash, so the shell runs each one as an I/O job (stepJob, tmshIo.h).
+//
+// The sort is stable:  lines whose keys are equal come out in the order they went in.
+// Ties in a run go by where the lines are in the arena, and in a merge by which run they
+// came from, and runs are merged a level at a time so that the runs in a merge are
+// always in the order of the input.  -k n sorts on the n'th comma-separated field (from
+// 1) instead of the whole line, -n compares it as a number, and -u keeps only the first
+// of lines whose keys are equal.  Lines longer than TMSH_SORT_MAXLINE are cut short.
+//
+
+#if !defined(__TMSHSORT__)
+#define __TMSHSORT__
+
+#include <Arduino.h>
+#include <TaskManagerShProfile.h>
+#if defined(ARDUINO_ARCH_ESP8266) || defined(ARDUINO_ARCH_ESP32)
+#include <FS.h>
+#include "tmshRedirect.h"
+
+#define TMSH_SORT_BLOCK 512
+#define TMSH_SORT_MAXLINE 255
+#define TMSH_SORT_MAXFANIN 16
+#define TMSH_SORT_STRETCH 2048		// bytes a merge step writes before it gives way
+
+// runs merged at once:  a read block and a line for each, as many as fit
+#define TMSH_SORT_FANIN (TmshProfile::sortBuf/(TMSH_SORT_BLOCK+TMSH_SORT_MAXLINE+1) < TMSH_SORT_MAXFANIN \
+	? (int)(TmshProfile::sortBuf/(TMSH_SORT_BLOCK+TMSH_SORT_MAXLINE+1)) : TMSH_SORT_MAXFANIN)
+
+class Tmsh_sort {
+	public:
+		Tmsh_sort();
+		~Tmsh_sort();		// throws away any temp files still about
+
+		// Get ready to sort in into out.  field 0 sorts on whole lines.  false (after
+		// saying why on Serial) if in can't be read or there's no memory for the arena.
+		bool begin(fs::FS& fs, const char* in, const char* out, int field, bool numeric, bool unique);
+		// The next run or stretch of merging.  1 if there's more to do, 0 once out is
+		// written, -1 if a file couldn't be written (said on Serial).
+		int step();
+		// step() as an I/O job, with the Tmsh_sort as its arg; stepped() is what it gave.
+		static void stepJob(void* sort);
+		int stepped() const { return lastStep; }
+
+		long linesIn() const { return nIn; }
+		long linesOut() const { return nOut; }
+		int runs() const { return nRuns; }
+		long cut() const { return nCut; }	// lines cut short
+
+	private:
+		struct Input {
+			File f;
+			char* blk;
+			int blkLen, blkPos;
+			char* line;
+			int len;
+		};
+		fs::FS* fs;
+		String outPath;
+		int field;
+		bool numeric, unique;
+		int seq;					// names this sort's temp files
+		char* arena;
+		Input src;					// the file being sorted
+		Input ins[TMSH_SORT_MAXFANIN];
+		uint8_t heap[TMSH_SORT_MAXFANIN];
+		int nHeap;
+		Tmsh_fileSink out;
+		bool srcDone, haveLine;		// haveLine:  src.line didn't fit in the last run
+		bool merging, final;
+		int firstRun, nextRun, nMerge;	// runs firstRun..nextRun-1 are waiting to be merged
+		int levelEnd;				// and those before levelEnd go before any made from them
+		int lastStep;
+		int nRuns;
+		char last[TMSH_SORT_MAXLINE+1];	// the last line written, for -u
+		bool haveLast;
+		long nIn, nOut, nCut;
+
+		String runName(int run) const;
+		bool readLine(Input& in);
+		const char* key(const char* line, int& len) const;
+		int compare(const char* a, const char* b) const;
+		static int qsortCompare(const void* a, const void* b);
+		void emit(const char* line);
+		bool before(int a, int b) const;
+		void siftDown(int i);
+		int formRun();
+		int mergeStep();
+};
+#endif
+
+#endif
@@ -0,0 +1,111 @@
+//
+// Stall detector for the shell's tasks -- see tmshStall.h
+//
+#include <Arduino.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(ARDUINO_ARCH_ESP8266) || defined(ARDUINO_ARCH_ESP32)
+#include <FS.h>
+#include <SPIFFS.h>
+#include <TaskManagerSub.h>
+#include <TaskManagerSh.h>
+#include "tmshIo.h"
+#include "utils.h"
+#endif
+#include "tmshStall.h"
+
+unsigned long Tmsh_stallMs = TmshProfile::stallMs;
+
+static TmshTable<Tmsh_stall, (TmshProfile::stallMs>0 ? TMSH_STALL_SLOTS : 0)> stalls;
+static int stallNext;			// the slot the next one goes in
+static unsigned long stallCount;
+static Tmsh_stall stallWorst;
+#if defined(ARDUINO_ARCH_ESP8266) || defined(ARDUINO_ARCH_ESP32)
+#define STALL_LOG_SLOTS (TmshProfile::stallMs>0 && TmshProfile::stallLog ? TMSH_STALL_SLOTS : 0)
+static unsigned long stallUnlogged;	// noted since the log task last took them
+// what the log task has handed to its job:  the job's own copy, as the table moves on
+static TmshTable<Tmsh_stall, STALL_LOG_SLOTS> stallLogged;
+static int stallLoggedN;
+static unsigned long stallMissed;	// in the table once, but gone before the task got to them
+static bool stallBooted;			// this boot has started its part of the log
+
+static void stallLogJob(void*) {
+	// A "boot" line before the first stalls since the reset, then one line per stall.
+	// Once the log is big enough it becomes /stalls.old and a new one is started.
+	File f;
+	int i;
+	f = SPIFFS.open(TMSH_STALL_LOG, FILE_READ);
+	if(f && f.size()>=TMSH_STALL_LOGMAX) {
+		f.close();
+		replaceFile(SPIFFS, TMSH_STALL_LOG, "/stalls.old");
+	} else if(f) f.close();
+	if(!(f=SPIFFS.open(TMSH_STALL_LOG, FILE_APPEND))) return;
+	if(!stallBooted) f.print(F("boot\n"));
+	stallBooted = true;
+	if(stallMissed>0) f.printf("missed %lu\n", stallMissed);
+	for(i=0; i<stallLoggedN; i++) f.printf("%lu %lu %s\n", stallLogged[i].at, stallLogged[i].ms, stallLogged[i].name);
+	f.close();
+}
+
+void Tmsh_stallLogTask() {
+	static Tmsh_ioJob job;
+	unsigned long n;
+	int i;
+	TM_BEGIN();
+	if(stallUnlogged==0 || !Tmsh_fsReady) { TM_RETURN(); }
+	n = stallUnlogged<TMSH_STALL_SLOTS ? stallUnlogged : TMSH_STALL_SLOTS;
+	stallMissed = stallUnlogged-n;
+	for(i=0; i<(int)n; i++) stallLogged[i] = stalls[(stallNext+TMSH_STALL_SLOTS-n+i)%TMSH_STALL_SLOTS];
+	stallLoggedN = n;
+	stallUnlogged = 0;
+	job.fn = stallLogJob;
+	while(!Tmsh_ioSubmit(&job)) { TM_YIELD(1); }
+	while(!Tmsh_ioDone(&job)) { TM_YIELD(2); }
+	TM_END();
+}
+#endif
+
+void Tmsh_stallNote(const char* name, unsigned long ms) {
+	if(TmshProfile::stallMs==0) return;
+	Tmsh_stall& s = stalls[stallNext];
+	s.at = millis();
+	s.ms = ms;
+	strncpy(s.name, name, TMSH_STALL_NAME);
+	s.name[TMSH_STALL_NAME] = '\0';
+	if(ms>stallWorst.ms) stallWorst = s;
+	stallNext = (stallNext+1)%TMSH_STALL_SLOTS;
+	stallCount++;
+#if defined(ARDUINO_ARCH_ESP8266) || defined(ARDUINO_ARCH_ESP32)
+	if(TmshProfile::stallLog) stallUnlogged++;
+#endif
+}
+
+void Tmsh_stallClear() {
+	stallNext = 0;
+	stallCount = 0;
+	stallWorst.ms = 0;
+#if defined(ARDUINO_ARCH_ESP8266) || defined(ARDUINO_ARCH_ESP32)
+	stallUnlogged = 0;		// the table's been restarted, so there's nothing to find them by
+#endif
+}
+
+void Tmsh_stallReport(Print& out) {
+	char line[48];
+	unsigned long i, n;
+	snprintf(line, sizeof(line), "over %lu ms: %lu", Tmsh_stallMs, stallCount);
+	out.print(line);
+	if(stallCount>0) {
+		snprintf(line, sizeof(line), ", worst %lu ms (%s)", stallWorst.ms, stallWorst.name);
+		out.print(line);
+	}
+	out.println();
+	if(stallCount==0) return;
+	out.print(F("     at ms      ms  task\n"));
+	n = stallCount<TMSH_STALL_SLOTS ? stallCount : TMSH_STALL_SLOTS;
+	for(i=0; i<n; i++) {
+		const Tmsh_stall& s = stalls[(stallNext+TMSH_STALL_SLOTS-n+i)%TMSH_STALL_SLOTS];
+		snprintf(line, sizeof(line), "%10lu%8lu  %s\n", s.at, s.ms, s.name);
+		out.print(line);
+	}
+}
@@ -0,0 +1,55 @@
+//
+// Stall detector for the shell's tasks
+//
+// TaskManager is cooperative, so a task that doesn't yield holds up every other one.
+// The shell times each slice of its own tasks and of the user commands -- from the task
+// being resumed to its yielding or returning -- and notes any slice longer than the
+// profile's stallMs, with the command or task it was and how long it took.  The last
+// TMSH_STALL_SLOTS are kept for the stalls builtin.
+//
+// With stallLog on (ESP only), they're also appended to TMSH_STALL_LOG, so the ones
+// before a watchdog reset can still be read after it.  Noting a stall only copies it to
+// the table.  Tmsh_stallLogTask, a low-priority task the shell runs every
+// TMSH_STALL_LOGTICK ms, writes what's new there through the I/O worker (tmshIo.h), so
+// the log costs the loop nothing where there is one.  A slice the watchdog cuts short
+// never ends, so isn't there, and nor are stalls from the last tick before it; the ones
+// leading up to it usually are.  If more than TMSH_STALL_SLOTS come in one tick, the log
+// says how many it missed.
+//
+// Nothing is compiled in unless stallMs is above 0.
+//
+
+#if !defined(__TMSHSTALL__)
+#define __TMSHSTALL__
+
+#include <Arduino.h>
+#include <TaskManagerShProfile.h>
+
+#define TMSH_STALL_SLOTS 8
+#define TMSH_STALL_NAME 12			// longest task name kept
+#define TMSH_STALL_LOG "/stalls.log"
+#define TMSH_STALL_LOGMAX 4096		// bytes, before the log is moved to /stalls.old
+#define TMSH_STALL_LOGTICK 1000		// ms between writes to the log
+
+struct Tmsh_stall {
+	unsigned long at;				// millis() when the slice ended
+	unsigned long ms;				// how long it ran
+	char name[TMSH_STALL_NAME+1];
+};
+
+// Slices longer than this are stalls.  Starts at the profile's stallMs.
+extern unsigned long Tmsh_stallMs;
+
+// Note a slice of ms by the task called name (not yet in the table).
+void Tmsh_stallNote(const char* name, unsigned long ms);
+
+// Print the threshold, the counts and the table, oldest first, to out; or clear them.
+void Tmsh_stallReport(Print& out);
+void Tmsh_stallClear();
+
+#if defined(ARDUINO_ARCH_ESP8266) || defined(ARDUINO_ARCH_ESP32)
+// STALLLOG_TASK:  append the stalls noted since it last ran to TMSH_STALL_LOG.
+void Tmsh_stallLogTask();
+#endif
+
+#endif
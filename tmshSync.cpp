@@ -0,0 +1,167 @@
+//
+// Manifest-based file sync -- see tmshSync.h
+//
+#include <Arduino.h>
+
+#if defined(ARDUINO_ARCH_ESP8266) || defined(ARDUINO_ARCH_ESP32)
+#include <FS.h>
+#include <SPIFFS.h>
+#include <stdio.h>
+#include <new>
+
+#include "utils.h"
+#include "tmshSync.h"
+
+String addSlash(const char* fn);	// from utils
+
+#define SYNC_MANIFEST "/.sync.mf"	// the manifest, while it's being worked through
+#define SYNC_NEWINDEX "/.sync.new"	// the next index, until it's complete
+
+// An index line, as far as matching goes.
+struct SyncEntry {
+	uint32_t pathHash;
+	long size;
+	uint32_t crc;
+	bool seen;			// the manifest still lists it
+};
+
+static uint32_t syncHash(const char* s) {
+	// FNV-1a
+	uint32_t h = 2166136261UL;
+	while(*s) { h ^= (uint8_t)*s++; h *= 16777619UL; }
+	return h;
+}
+
+static bool syncParse(const String& line, char* path, long& size, uint32_t& crc) {
+	// "path size crc" into path, size and crc.  false for a blank line, a comment, or
+	// anything else.  The 32 is TMSH_SYNC_MAXPATH.
+	unsigned long c;
+	if(sscanf(line.c_str(), "%32s %ld %lx", path, &size, &c)!=3 || path[0]=='#' || size<0) return false;
+	crc = c;
+	return true;
+}
+
+static bool syncSizeIs(const String& path, long size) {
+	File f = SPIFFS.open(path.c_str(), FILE_READ);
+	bool same = f && !f.isDirectory() && (long)f.size()==size;
+	if(f) f.close();
+	return same;
+}
+
+static bool syncContentIs(const String& path, long size, uint32_t crc) {
+	uint8_t buf[256];
+	uint32_t fileCrc;
+	int n;
+	if(!syncSizeIs(path, size)) return false;
+	File f = SPIFFS.open(path.c_str(), FILE_READ);
+	fileCrc = 0;
+	while((n=f.read(buf, sizeof(buf)))>0) fileCrc = crc32Update(fileCrc, buf, n);
+	f.close();
+	return fileCrc==crc;
+}
+
+void Tmsh_syncJob(void* arg) {
+	Tmsh_sync& sy = *(Tmsh_sync*)arg;
+	SyncEntry* index;
+	int nIndex, i;
+	char path[TMSH_SYNC_MAXPATH+1];
+	long size, got;
+	uint32_t crc, gotCrc, h;
+	String base, target, tmp, line;
+	bool same, complete, indexOk;
+
+	sy.ok = false;
+	if((index=new(std::nothrow) SyncEntry[TMSH_SYNC_MAXFILES])==NULL) { Serial.print(F("Out of memory.\n")); return; }
+
+	// what the last sync left in place
+	nIndex = 0;
+	File f = SPIFFS.open(TMSH_SYNC_INDEX, FILE_READ);
+	while(f && f.available() && nIndex<TMSH_SYNC_MAXFILES) {
+		line = f.readStringUntil('\n');
+		if(!syncParse(line, path, size, crc)) continue;
+		index[nIndex].pathHash = syncHash(path);
+		index[nIndex].size = size;
+		index[nIndex].crc = crc;
+		index[nIndex].seen = false;
+		nIndex++;
+	}
+	if(f) f.close();
+
+	if(httpGetFile(SPIFFS, sy.url, SYNC_MANIFEST, &crc)<0) {
+		Serial.printf("Can't fetch [%s]\n", sy.url.c_str());
+		SPIFFS.remove(SYNC_MANIFEST);
+		delete[] index;
+		return;
+	}
+	base = sy.url.substring(0, sy.url.lastIndexOf('/')+1);
+
+	// Fetch what's missing or different, and write down what's now in place.
+	f = SPIFFS.open(SYNC_MANIFEST, FILE_READ);
+	File out = SPIFFS.open(SYNC_NEWINDEX, FILE_WRITE);
+	indexOk = (bool)out;
+	complete = true;
+	sy.ok = true;
+	while(f.available()) {
+		line = f.readStringUntil('\n');
+		if(!syncParse(line, path, size, crc)) continue;
+		if(sy.files==TMSH_SYNC_MAXFILES) { Serial.print(F("Too many files in the manifest.\n")); complete = sy.ok = false; break; }
+		sy.files++;
+		sy.totalBytes += size;
+		target = addSlash(path);
+		h = syncHash(target.c_str());
+		for(i=0; i<nIndex && index[i].pathHash!=h; i++) continue;
+		if(i<nIndex) index[i].seen = true;
+		// as the index has it, only the size needs checking
+		if(i<nIndex && index[i].size==size && index[i].crc==crc) same = syncSizeIs(target, size);
+		else same = syncContentIs(target, size, crc);
+		if(!same) {
+			Serial.printf("Fetching %s\n", target.c_str());
+			tmp = target + ".tmp";
+			if(!tmpNameFits(target.c_str())) {
+				Serial.printf("Name too long [%s]\n", target.c_str());
+				sy.failed++;
+				sy.ok = false;
+				continue;
+			}
+			got = httpGetFile(SPIFFS, base + (path[0]=='/' ? path+1 : path), tmp.c_str(), &gotCrc);
+			if(got!=size || gotCrc!=crc || !replaceFile(SPIFFS, tmp.c_str(), target.c_str())) {
+				Serial.printf("Can't fetch %s\n", target.c_str());
+				SPIFFS.remove(tmp.c_str());
+				sy.failed++;
+				sy.ok = false;
+				continue;
+			}
+			sy.fetched++;
+			sy.fetchedBytes += got;
+		}
+		if(out && out.printf("%s %ld %08lx\n", target.c_str(), size, (unsigned long)crc)<=0) indexOk = false;
+	}
+	f.close();
+	SPIFFS.remove(SYNC_MANIFEST);
+
+	// What earlier syncs brought in that the manifest no longer lists:  deleted with -d,
+	// or else kept in the index so that a later -d knows about it.  Neither if the manifest
+	// wasn't read to the end, as the rest of it is unknown.
+	if(complete) {
+		f = SPIFFS.open(TMSH_SYNC_INDEX, FILE_READ);
+		for(i=0; f && f.available() && i<nIndex; ) {
+			line = f.readStringUntil('\n');
+			if(!syncParse(line, path, size, crc) || index[i++].seen) continue;
+			if(sy.prune) {
+				Serial.printf("Deleting %s\n", path);
+				SPIFFS.remove(path);
+				sy.deleted++;
+			} else if(out && out.printf("%s %ld %08lx\n", path, size, (unsigned long)crc)<=0) indexOk = false;
+		}
+		if(f) f.close();
+	}
+	if(out) out.close();
+	delete[] index;
+
+	// An index that's out of date could skip a file that needs fetching; none is better.
+	if(!indexOk || !replaceFile(SPIFFS, SYNC_NEWINDEX, TMSH_SYNC_INDEX)) {
+		SPIFFS.remove(SYNC_NEWINDEX);
+		SPIFFS.remove(TMSH_SYNC_INDEX);
+	}
+}
+#endif
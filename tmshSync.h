@@ -0,0 +1,52 @@
+//
+// Manifest-based file sync:  sync [-d] manifest-url
+//
+// The manifest is a text file, one line per file:
+//    path  size  crc32(hex)
+// (# starts a comment).  Paths are relative to where the manifest is, so
+//    http://host/node7/manifest.txt  listing  conf/app.cfg
+// fetches http://host/node7/conf/app.cfg into /conf/app.cfg.
+//
+// TMSH_SYNC_INDEX lists, in the same form, what the last sync left in place.  A file whose
+// line in the manifest matches its line there, and that's still the right size, isn't
+// looked at.  One that isn't in the index but is the right size has its CRC checked, so
+// the first sync doesn't fetch files that are already there.  The rest are fetched to a
+// temp file, checked against the manifest, and only then renamed over the old one.  With
+// -d, files that were in the index but have gone from the manifest are deleted; files
+// that never came from a sync are left alone.
+//
+// Tmsh_syncJob does it all, as an I/O job (see tmshIo.h), since it sits on the network.
+// Progress and problems go to Serial; the totals are left in the Tmsh_sync.  Where
+// there's no I/O worker (an ESP8266, or ioWorker off) the job runs in place, so the whole
+// sync, every fetch's waits for data (up to 10 s each) included, holds up the
+// loop; the shell says so before it starts.
+//
+
+#if !defined(__TMSHSYNC__)
+#define __TMSHSYNC__
+
+#include <Arduino.h>
+#if defined(ARDUINO_ARCH_ESP8266) || defined(ARDUINO_ARCH_ESP32)
+
+#define TMSH_SYNC_INDEX "/.sync"
+#define TMSH_SYNC_MAXFILES 128		// in a manifest, and in the index
+#define TMSH_SYNC_MAXPATH 32
+
+struct Tmsh_sync {
+	String url;
+	bool prune;				// -d
+	bool ok;				// false if the manifest couldn't be had, or any file failed
+	int files;				// in the manifest
+	int fetched;
+	int failed;
+	int deleted;
+	long totalBytes;		// what a full push would have sent
+	long fetchedBytes;
+	Tmsh_sync(const String& u, bool d): url(u), prune(d), ok(false), files(0), fetched(0), failed(0),
+	  deleted(0), totalBytes(0), fetchedBytes(0) {}
+};
+
+void Tmsh_syncJob(void* sync);
+#endif
+
+#endif
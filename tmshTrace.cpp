@@ -0,0 +1,85 @@
+//
+// Event tracer for the shell -- see tmshTrace.h
+//
+#include <Arduino.h>
+#include <TaskManagerSub.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "tmshTrace.h"
+
+struct TraceEvent {
+	uint32_t ts;		// micros()
+	char phase;
+	uint8_t cat;
+	tm_taskId_t task;
+	char name[TMSH_TRACE_NAMELEN+1];
+};
+
+#define TRACE_RING (TmshProfile::traceEvents>0 ? TmshProfile::traceEvents : 1)
+static TraceEvent traceRing[TRACE_RING];
+static int traceNext;		// where the next event goes
+static bool traceWrapped;	// the ring has filled at least once
+bool Tmsh_tracing = false;
+
+static const char* const traceCatNames[TMSH_TRACE_CATS] = { "shell", "readline", "file", "ed" };
+
+void Tmsh_traceRecord(char phase, uint8_t cat, const char* name) {
+	TraceEvent* e;
+	int i;
+	e = &traceRing[traceNext];
+	e->ts = micros();
+	e->phase = phase;
+	e->cat = cat;
+	e->task = TaskMgr.myId();
+	// names go into JSON as is, so keep them to plain characters
+	for(i=0; i<TMSH_TRACE_NAMELEN && name[i]!='\0'; i++) {
+		e->name[i] = name[i]=='"' || name[i]=='\\' || name[i]<' ' ? '_' : name[i];
+	}
+	e->name[i] = '\0';
+	if(++traceNext==TRACE_RING) { traceNext = 0; traceWrapped = true; }
+}
+
+void Tmsh_traceStart() {
+	traceNext = 0;
+	traceWrapped = false;
+	Tmsh_tracing = true;
+}
+
+void Tmsh_traceStop() {
+	Tmsh_tracing = false;
+}
+
+#if defined(ARDUINO_ARCH_ESP8266) || defined(ARDUINO_ARCH_ESP32)
+String addSlash(const char* fn);	// from utils
+
+int Tmsh_traceDump(fs::FS& fs, const char* path) {
+	// Timestamps are written relative to the oldest event, which also takes care of
+	// micros() wrapping during the trace.
+	char line[112];
+	int i, n, count;
+	bool wasTracing, ok;
+	String target = addSlash(path);
+	const TraceEvent* e;
+
+	wasTracing = Tmsh_tracing;
+	Tmsh_tracing = false;	// hold the ring still
+	File f = fs.open(target.c_str(), FILE_WRITE);
+	if(!f || f.isDirectory()) { Tmsh_tracing = wasTracing; return -1; }
+	count = traceWrapped ? TRACE_RING : traceNext;
+	i = traceWrapped ? traceNext : 0;
+	ok = f.print("{\"traceEvents\":[\n")>0;
+	for(n=0; n<count && ok; n++) {
+		e = &traceRing[(i+n)%TRACE_RING];
+		snprintf(line, sizeof(line),
+		  "%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"%c\",\"ts\":%lu,\"pid\":1,\"tid\":%d%s}\n",
+		  n==0 ? "" : ",", e->name, traceCatNames[e->cat], e->phase,
+		  (unsigned long)(e->ts-traceRing[i].ts), (int)e->task, e->phase=='i' ? ",\"s\":\"t\"" : "");
+		ok = f.print(line)>0;
+	}
+	ok = ok && f.print("]}\n")>0;
+	f.close();
+	Tmsh_tracing = wasTracing;
+	return ok ? count : -1;
+}
+#endif
@@ -0,0 +1,51 @@
+//
+// Event tracer for the shell
+//
+// A fixed ring of begin/end/instant events, recorded at the shell's key points and
+// written out in Chrome trace-event JSON (load it in chrome://tracing or Perfetto).
+// The newest events overwrite the oldest.
+//
+// There's one writer, the TaskManager loop, so the ring needs no lock.  With tracing
+// stopped, a TMSH_TRACE costs one test of a bool; with traceEvents 0 in the profile it
+// costs nothing at all.
+//
+
+#if !defined(__TMSHTRACE__)
+#define __TMSHTRACE__
+
+#include <Arduino.h>
+#include <TaskManagerShProfile.h>
+#if defined(ARDUINO_ARCH_ESP8266) || defined(ARDUINO_ARCH_ESP32)
+#include <FS.h>
+#endif
+
+// event categories
+enum {
+	TMSH_TRACE_SHELL,
+	TMSH_TRACE_READLINE,
+	TMSH_TRACE_FILE,
+	TMSH_TRACE_ED,
+	TMSH_TRACE_CATS
+};
+
+#define TMSH_TRACE_NAMELEN 11
+
+extern bool Tmsh_tracing;
+
+// Record an event:  phase is 'B' (begin), 'E' (end) or 'i' (instant).  name is copied.
+void Tmsh_traceRecord(char phase, uint8_t cat, const char* name);
+
+#define TMSH_TRACE(phase, cat, name) \
+	do { if(TmshProfile::traceEvents>0 && Tmsh_tracing) Tmsh_traceRecord(phase, cat, name); } while(0)
+
+// Empty the ring and start recording; stop recording.
+void Tmsh_traceStart();
+void Tmsh_traceStop();
+
+#if defined(ARDUINO_ARCH_ESP8266) || defined(ARDUINO_ARCH_ESP32)
+// Write the ring, oldest first, to path as a Chrome trace.  Returns the number of events
+// written, or -1 if the file couldn't be written.
+int Tmsh_traceDump(fs::FS& fs, const char* path);
+#endif
+
+#endif
@@ -0,0 +1,390 @@
+//
+// Framed file transfer over Serial -- see tmshXfer.h for the protocol
+//
+// rx fn receives into fn.part, written through a block buffer, and renames it to fn once
+// the final length and CRC check out.  An interrupted rx leaves fn.part behind, and the
+// next rx of the same file carries on from the end of it.
+// tx fn sends fn, starting from whatever offset the receiver says it already has.
+//
+// Both are subtasks that yield while waiting for the other side.  Sending a frame does
+// block until Serial has taken it, which is about 25 ms a frame at 115200.
+//
+#include <Arduino.h>
+#include  <TaskManagerSub.h>
+
+#if defined(ARDUINO_ARCH_ESP8266) || defined(ARDUINO_ARCH_ESP32)
+#include <FS.h>
+#include <SPIFFS.h>
+#include <new>
+
+#include  <TaskManagerSh.h>
+#include "utils.h"
+#include "tmshXfer.h"
+
+#define TMSH_XFER_BLOCK 1024	// rx gathers writes to flash into blocks this size
+
+String addSlash(const char* fn);	// from utils
+
+// what poll() found
+enum { XFER_NONE, XFER_OK, XFER_BAD };
+
+static uint32_t getLe32(const uint8_t* p) {
+	return p[0] | ((uint32_t)p[1]<<8) | ((uint32_t)p[2]<<16) | ((uint32_t)p[3]<<24);
+}
+
+static void putLe32(uint8_t* p, uint32_t v) {
+	p[0] = v; p[1] = v>>8; p[2] = v>>16; p[3] = v>>24;
+}
+
+class XferContext {
+	public:
+		XferContext(): inLen(0), blockUsed(0), fileCrc(0), offset(0), resumedAt(0), tries(0), done(false),
+			failed(true), gotAny(false), nakSent(false), finalSent(false) { lastHeard = millis(); }
+		~XferContext() { if(f) f.close(); }
+
+		File f;
+		String target;
+		String part;
+
+		// Frames in.  poll() reads what Serial has and says whether a frame is complete.
+		uint8_t in[TMSH_XFER_FRAME];
+		int inLen;
+		int poll();
+		uint8_t inType() const { return in[1]; }
+		uint8_t inSeq() const { return in[2]; }
+		int inDataLen() const { return in[3] | (in[4]<<8); }
+		const uint8_t* inData() const { return in+TMSH_XFER_HDR; }
+
+		// Frames out
+		uint8_t out[TMSH_XFER_FRAME];
+		void send(uint8_t type, uint8_t seq, const uint8_t* data=NULL, int len=0);
+		void sendOffset(uint8_t type, uint8_t seq, uint32_t n);
+
+		// The file.  offset is how much of it has been received, or read for sending.
+		uint8_t block[TMSH_XFER_BLOCK];
+		int blockUsed;
+		uint32_t fileCrc;
+		uint32_t offset;
+		uint32_t resumedAt;	// where this try started
+		bool flush();
+		bool put(const uint8_t* data, int len);
+
+		// The other side has been quiet for a timeout; counts them in tries.
+		unsigned long lastHeard;
+		int tries;
+		bool quiet();
+
+		bool done;
+		bool failed;
+		unsigned long startTime;
+
+		// rx
+		uint8_t expect;		// next sequence number wanted
+		bool gotAny;
+		bool nakSent;		// for expect; one NAK per gap is enough
+		bool openPart();
+		void rxFrame(int r);
+		void nak();
+
+		// tx.  base is the oldest unacknowledged frame, next the next one to send; data
+		// frames are all full except the last, so the offset of any frame follows from base.
+		uint8_t base, next;
+		uint32_t baseOffset;
+		uint32_t size;
+		uint32_t crcOffset;	// fileCrc covers the file up to here
+		bool finalSent;
+		void startTx(uint32_t from);
+		bool txSendOne();
+		void txFrame(int r);
+		void goBack();
+
+		void report(const char* what);
+};
+
+static XferContext* xfer;	// one transfer at a time
+
+int XferContext::poll() {
+	int c, len;
+	while(Serial.available()>0) {
+		c = Serial.read();
+		if(inLen==0 && c!=TMSH_XFER_SOH) continue;	// noise between frames
+		in[inLen++] = c;
+		if(inLen<TMSH_XFER_HDR) continue;
+		len = inDataLen();
+		if(len>TMSH_XFER_MAXDATA) { inLen = 0; return XFER_BAD; }
+		if(inLen<TMSH_XFER_HDR+len+4) continue;
+		inLen = 0;
+		lastHeard = millis();
+		tries = 0;
+		return getLe32(in+TMSH_XFER_HDR+len)==crc32Update(0, in+1, TMSH_XFER_HDR-1+len) ? XFER_OK : XFER_BAD;
+	}
+	return XFER_NONE;
+}
+
+void XferContext::send(uint8_t type, uint8_t seq, const uint8_t* data, int len) {
+	out[0] = TMSH_XFER_SOH;
+	out[1] = type;
+	out[2] = seq;
+	out[3] = len;
+	out[4] = len>>8;
+	if(len>0) memcpy(out+TMSH_XFER_HDR, data, len);
+	putLe32(out+TMSH_XFER_HDR+len, crc32Update(0, out+1, TMSH_XFER_HDR-1+len));
+	Serial.write(out, TMSH_XFER_HDR+len+4);
+}
+
+void XferContext::sendOffset(uint8_t type, uint8_t seq, uint32_t n) {
+	uint8_t buf[4];
+	putLe32(buf, n);
+	send(type, seq, buf, 4);
+}
+
+bool XferContext::quiet() {
+	if(millis()-lastHeard<TMSH_XFER_TIMEOUT) return false;
+	lastHeard = millis();
+	tries++;
+	return true;
+}
+
+bool XferContext::flush() {
+	bool ok;
+	ok = blockUsed==0 || f.write(block, blockUsed)==(size_t)blockUsed;
+	blockUsed = 0;
+	return ok;
+}
+
+bool XferContext::put(const uint8_t* data, int len) {
+	int n;
+	fileCrc = crc32Update(fileCrc, data, len);
+	offset += len;
+	while(len>0) {
+		n = min(len, TMSH_XFER_BLOCK-blockUsed);
+		memcpy(block+blockUsed, data, n);
+		blockUsed += n; data += n; len -= n;
+		if(blockUsed==TMSH_XFER_BLOCK && !flush()) return false;
+	}
+	return true;
+}
+
+void XferContext::report(const char* what) {
+	unsigned long ms;
+	ms = millis()-startTime;
+	if(failed) Serial.printf("%s [%s] failed at %lu bytes.\n", what, target.c_str(), (unsigned long)offset);
+	else Serial.printf("%s [%s]: %lu bytes in %lu ms (%lu bytes/s).\n", what, target.c_str(),
+	  (unsigned long)(offset-resumedAt), ms, ms>0 ? (unsigned long)((offset-resumedAt)*1000ULL/ms) : 0UL);
+}
+
+// *** RX
+
+bool XferContext::openPart() {
+	// Carry on from a .part file left by an earlier try, if there is one.
+	int n;
+	offset = 0;
+	fileCrc = 0;
+	if(SPIFFS.exists(part.c_str())) {
+		f = SPIFFS.open(part.c_str(), FILE_READ);
+		while(f && (n=f.read(block, TMSH_XFER_BLOCK))>0) {
+			fileCrc = crc32Update(fileCrc, block, n);
+			offset += n;
+		}
+		if(f) f.close();
+		f = SPIFFS.open(part.c_str(), FILE_APPEND);
+	} else f = SPIFFS.open(part.c_str(), FILE_WRITE);
+	return f && !f.isDirectory();
+}
+
+void XferContext::nak() {
+	if(!nakSent) send(TMSH_XFER_NAK, expect);
+	nakSent = true;
+}
+
+void XferContext::rxFrame(int r) {
+	if(r==XFER_BAD) { nak(); return; }
+	gotAny = true;
+	switch(inType()) {
+		case TMSH_XFER_DATA:
+			if(inSeq()==expect) {
+				if(!put(inData(), inDataLen())) { send(TMSH_XFER_ABORT, 0); done = true; return; }
+				send(TMSH_XFER_ACK, expect++);
+				nakSent = false;
+			} else if((uint8_t)(expect-inSeq())<=TMSH_XFER_WINDOW) {
+				send(TMSH_XFER_ACK, expect-1);	// a repeat, so our ack went missing
+			} else nak();
+			break;
+		case TMSH_XFER_FINAL:
+			done = true;
+			if(!flush()) { send(TMSH_XFER_ABORT, 0); return; }
+			f.close();
+			if(inDataLen()==8 && getLe32(inData())==offset && getLe32(inData()+4)==fileCrc
+			  && replaceFile(SPIFFS, part.c_str(), target.c_str())) {
+				send(TMSH_XFER_ACK, inSeq());
+				failed = false;
+			} else {
+				// not the file that was sent; a resume would only repeat the damage
+				send(TMSH_XFER_ABORT, 0);
+				SPIFFS.remove(part.c_str());
+			}
+			break;
+		case TMSH_XFER_ABORT:
+			flush();	// keep what we have, for a resume
+			done = true;
+			break;
+	}
+}
+
+void Tmsh_rxTask() {
+	// rx fn
+	static int r;
+	TM_BEGINSUB_P(Tmsh_paramP, shParamP);
+	if(shParamP->Argc!=2) { Serial.print("Syntax: rx fn\n"); shParamP->Status = 1; TM_RETURN(); }
+	if((xfer=new(std::nothrow) XferContext())==NULL) {
+		Serial.print("Not enough memory for rx.\n"); shParamP->Status = 1; TM_RETURN();
+	}
+	xfer->target = addSlash(shParamP->Argv[1].c_str());
+	xfer->part = xfer->target + ".part";
+	if(!xfer->openPart()) {
+		Serial.printf("Can't write [%s]\n", xfer->part.c_str());
+		delete xfer; xfer = NULL;
+		shParamP->Status = 1; TM_RETURN();
+	}
+	Serial.print("rx: ready\n");
+	xfer->startTime = millis();
+	xfer->resumedAt = xfer->offset;
+	xfer->expect = 0;
+	xfer->sendOffset(TMSH_XFER_RESUME, 0, xfer->offset);
+	while(!xfer->done) {
+		while((r=xfer->poll())==XFER_NONE) {
+			if(xfer->quiet()) {
+				if(xfer->tries>TMSH_XFER_RETRIES) { xfer->flush(); xfer->done = true; break; }
+				if(!xfer->gotAny) xfer->sendOffset(TMSH_XFER_RESUME, 0, xfer->offset);
+				else { xfer->nakSent = false; xfer->nak(); }
+			}
+			TM_YIELD(1);
+		}
+		if(r!=XFER_NONE) xfer->rxFrame(r);
+	}
+	xfer->report("rx");
+	shParamP->Status = xfer->failed ? 1 : 0;
+	delete xfer; xfer = NULL;
+	TM_ENDSUB();
+}
+
+// *** TX
+
+void XferContext::startTx(uint32_t from) {
+	// The receiver has the first 'from' bytes.  Bring fileCrc up to there.
+	int n;
+	if(from>size) from = 0;	// it has more than there is; not the same file
+	fileCrc = 0;
+	for(crcOffset=0; crcOffset<from; crcOffset+=n) {
+		if((n=f.read(block, min((uint32_t)TMSH_XFER_BLOCK, from-crcOffset)))<=0) { from = crcOffset = fileCrc = 0; break; }
+		fileCrc = crc32Update(fileCrc, block, n);
+	}
+	base = next = 0;
+	baseOffset = offset = resumedAt = from;
+	f.seek(from);
+}
+
+bool XferContext::txSendOne() {
+	// Send the next frame if the window has room.  False if there was nothing to send.
+	int n;
+	uint8_t buf[8];
+	if(finalSent) return false;
+	if((uint8_t)(next-base)<TMSH_XFER_WINDOW && offset<size) {
+		n = f.read(block, min((uint32_t)TMSH_XFER_MAXDATA, size-offset));
+		if(n<=0) { send(TMSH_XFER_ABORT, 0); done = true; return false; }
+		if(offset==crcOffset) { fileCrc = crc32Update(fileCrc, block, n); crcOffset += n; }
+		send(TMSH_XFER_DATA, next++, block, n);
+		offset += n;
+		return true;
+	}
+	if(base==next && offset>=size) {
+		putLe32(buf, size);
+		putLe32(buf+4, fileCrc);
+		send(TMSH_XFER_FINAL, next, buf, 8);
+		finalSent = true;
+		return true;
+	}
+	return false;
+}
+
+void XferContext::goBack() {
+	// resend everything from base
+	next = base;
+	offset = baseOffset;
+	f.seek(offset);
+	finalSent = false;
+}
+
+void XferContext::txFrame(int r) {
+	uint8_t n;
+	if(r==XFER_BAD) return;		// the receiver will NAK or time out
+	switch(inType()) {
+		case TMSH_XFER_ACK:
+			if(finalSent && inSeq()==next) { failed = false; done = true; break; }
+			n = inSeq()+1-base;		// frames this acknowledges
+			if(n>=1 && n<=(uint8_t)(next-base)) {
+				base += n;
+				baseOffset = min(size, baseOffset+n*(uint32_t)TMSH_XFER_MAXDATA);
+			}
+			break;
+		case TMSH_XFER_NAK:
+			// everything before inSeq() got there; resend from it
+			n = inSeq()-base;
+			if(n<=(uint8_t)(next-base)) {
+				base += n;
+				baseOffset = min(size, baseOffset+n*(uint32_t)TMSH_XFER_MAXDATA);
+				goBack();
+			}
+			break;
+		case TMSH_XFER_ABORT:
+			done = true;
+			break;
+	}
+}
+
+void Tmsh_txTask() {
+	// tx fn
+	static int r;
+	TM_BEGINSUB_P(Tmsh_paramP, shParamP);
+	if(shParamP->Argc!=2) { Serial.print("Syntax: tx fn\n"); shParamP->Status = 1; TM_RETURN(); }
+	if((xfer=new(std::nothrow) XferContext())==NULL) {
+		Serial.print("Not enough memory for tx.\n"); shParamP->Status = 1; TM_RETURN();
+	}
+	xfer->target = addSlash(shParamP->Argv[1].c_str());
+	xfer->f = SPIFFS.open(xfer->target.c_str(), FILE_READ);
+	if(!xfer->f || xfer->f.isDirectory()) {
+		Serial.printf("Can't read [%s]\n", xfer->target.c_str());
+		delete xfer; xfer = NULL;
+		shParamP->Status = 1; TM_RETURN();
+	}
+	xfer->size = xfer->f.size();
+	Serial.print("tx: ready\n");
+	xfer->startTime = millis();
+
+	// wait for the receiver to say where to start
+	while(!xfer->done) {
+		while((r=xfer->poll())==XFER_NONE) {
+			if(xfer->quiet() && xfer->tries>TMSH_XFER_RETRIES) { xfer->done = true; break; }
+			TM_YIELD(2);
+		}
+		if(r!=XFER_OK) continue;
+		if(xfer->inType()==TMSH_XFER_ABORT) xfer->done = true;
+		else if(xfer->inType()==TMSH_XFER_RESUME && xfer->inDataLen()==4) break;
+	}
+
+	if(!xfer->done) xfer->startTx(getLe32(xfer->inData()));
+	while(!xfer->done) {
+		if((r=xfer->poll())!=XFER_NONE) xfer->txFrame(r);
+		else if(!xfer->txSendOne() && xfer->quiet()) {
+			if(xfer->tries>TMSH_XFER_RETRIES) { xfer->send(TMSH_XFER_ABORT, 0); xfer->done = true; }
+			else xfer->goBack();
+		}
+		TM_YIELD(3);
+	}
+	xfer->report("tx");
+	shParamP->Status = xfer->failed ? 1 : 0;
+	delete xfer; xfer = NULL;
+	TM_ENDSUB();
+}
+
+#endif // ESP architecture
@@ -0,0 +1,40 @@
+//
+// Framed file transfer over Serial:  rx fn (host to node) and tx fn (node to host)
+//
+// Every frame is
+//    SOH  type  seq  len(2, LE)  data(len)  crc32(4, LE, over type..data)
+// Bytes before a SOH are skipped, so the shell's echo of the command line and its
+// "rx: ready" line don't get in the way.  A frame with a bad CRC is dropped.
+//
+// The receiver opens with R, whose data is the 4-byte offset it already has (from a
+// .part file left by an earlier try, so a transfer picks up where it stopped).  The sender
+// then sends D frames of up to TMSH_XFER_MAXDATA bytes, keeping up to TMSH_XFER_WINDOW
+// unacknowledged.  The receiver answers each in-order D with A(seq); on a gap or a bad
+// frame it sends N(expected seq) and the sender goes back to that frame.  When
+// everything's acknowledged the sender sends F, whose data is the total length and the
+// CRC32 of the whole file (4 bytes each), and the receiver answers A if they check out.
+// X from either side ends the transfer.
+//
+// This header is plain C++ so the host client in extras/ can share it.
+//
+
+#if !defined(__TMSHXFER__)
+#define __TMSHXFER__
+
+#define TMSH_XFER_SOH 0x01
+#define TMSH_XFER_HDR 5					// SOH type seq len
+#define TMSH_XFER_MAXDATA 256
+#define TMSH_XFER_FRAME (TMSH_XFER_HDR+TMSH_XFER_MAXDATA+4)
+#define TMSH_XFER_WINDOW 4
+#define TMSH_XFER_TIMEOUT 500			// ms without a frame before nudging the other side
+#define TMSH_XFER_RETRIES 20			// nudges in a row before giving up
+
+// frame types
+#define TMSH_XFER_RESUME 'R'
+#define TMSH_XFER_DATA 'D'
+#define TMSH_XFER_ACK 'A'
+#define TMSH_XFER_NAK 'N'
+#define TMSH_XFER_FINAL 'F'
+#define TMSH_XFER_ABORT 'X'
+
+#endif
@@ -5,12 +5,20 @@
 #include <arduino.h>
 
 #include <TaskManagerSub.h>
-#include <TaskManagerSh.h.>
+#include <TaskManagerSh.h>
 //#include <Update.h>
-//#include <HTTPClient.h>
+#if defined(ARDUINO_ARCH_ESP32)
+#include <WiFi.h>
+#include <HTTPClient.h>
+#else
+#include <ESP8266WiFi.h>
+#include <ESP8266HTTPClient.h>
+#endif
 
 #include "utils.h"
 
+#define HTTP_TIMEOUT 10000	// ms without data before a download is given up
+
 static char space32[] = "                                ";
 static char* spaces(int n) {
   if(n<0) n=0; else if(n>32) n=32;
@@ -22,29 +30,31 @@ String addSlash(const char* path) {
   else return String("/")+path;
 }
 
-void ls(fs::FS &fs, const char* dirName, int levels) {
-  Serial.printf("%s%s",spaces(levels*2), dirName);
+void ls(fs::FS &fs, const char* dirName, int levels, Print& out) {
+  out.printf("%s%s",spaces(levels*2), dirName);
   // Open it as a dir and print a line for it
   File root = fs.open(dirName);
   if(!root) return;
-  Serial.print(root.isDirectory()?" (DIR)\n":" (not DIR)\n");
+  out.print(root.isDirectory()?" (DIR)\n":" (not DIR)\n");
   // Now go through the files
   File file = root.openNextFile();
   while(file) {
     if(file.isDirectory()) {
-      ls(fs, file.name(), levels+1);
+      ls(fs, file.name(), levels+1, out);
     } else {
-      Serial.printf("%s%s  %d\n", spaces(levels*2), file.name(), file.size());
+      out.printf("%s%s  %d\n", spaces(levels*2), file.name(), file.size());
     }
     file.close();
     file = root.openNextFile();
   }
   root.close();
 }
-void cat(fs::FS &fs, const char* path) {
+void cat(fs::FS &fs, const char* path, Print& out) {
+  uint8_t buf[256];
+  size_t n;
   File file = fs.open(addSlash(path).c_str(), FILE_READ);
   if(!file || file.isDirectory()) return;
-  while(file.available()) { Serial.write(file.read()); }
+  while((n=file.read(buf, sizeof(buf)))>0) out.write(buf, n);
   file.close();
 }
 void echoTo(fs::FS &fs, const char* path, const char* content) {
@@ -68,7 +78,7 @@ void rm(fs::FS &fs, const char* path) {
 }
 void cp(fs::FS &fs, const char* old, const char* newf) {
   File oldFile = fs.open(addSlash(old).c_str(), FILE_READ);
-  File newFile = fs.open(addSlash(newf).c_str());
+  File newFile = fs.open(addSlash(newf).c_str(), FILE_WRITE);
   if(!old || oldFile.isDirectory() || !newFile || newFile.isDirectory()) { oldFile.close(); newFile.close(); return; }
   while(oldFile.available()) newFile.write(oldFile.read());
   oldFile.close();
@@ -83,6 +93,127 @@ void appendFile(fs::FS &fs, const char* dest, const char* src) {
   srcFile.close();
   destFile.close();
 }
+bool replaceFile(fs::FS &fs, const char* tmp, const char* dest) {
+  // Move a fully written tmp file over dest.
+  // Some filesystems (SPIFFS) won't rename onto an existing file.  For those, dest is
+  // first moved aside to dest~, which is only there while tmp is known to be complete;
+  // recoverFile() finishes the job after a reset part way through.
+  String destPath = addSlash(dest);
+  String tmpPath = addSlash(tmp);
+  String oldPath = destPath + "~";
+  if(fs.rename(tmpPath.c_str(), destPath.c_str())) return true;
+  fs.remove(oldPath.c_str());
+  if(!fs.rename(destPath.c_str(), oldPath.c_str())) return false;
+  if(!fs.rename(tmpPath.c_str(), destPath.c_str())) {
+    fs.rename(oldPath.c_str(), destPath.c_str());
+    return false;
+  }
+  fs.remove(oldPath.c_str());
+  return true;
+}
+bool recoverFile(fs::FS &fs, const char* dest) {
+  // Finish a replaceFile() that a reset cut short.  If dest is missing but dest~ is
+  // there, dest.tmp (if it's there) is complete and goes in dest; otherwise dest~ goes
+  // back.  A dest.tmp without a dest~ may be partly written and is left alone.
+  // true if dest was put back.
+  String destPath = addSlash(dest);
+  String oldPath = destPath + "~";
+  String tmpPath = destPath + ".tmp";
+  if(!fs.exists(oldPath.c_str())) return false;
+  if(fs.exists(destPath.c_str())) { fs.remove(oldPath.c_str()); return false; }
+  if(fs.exists(tmpPath.c_str()) && fs.rename(tmpPath.c_str(), destPath.c_str())) {
+    fs.remove(oldPath.c_str());
+    return true;
+  }
+  return fs.rename(oldPath.c_str(), destPath.c_str());
+}
+void recoverFiles(fs::FS &fs) {
+  // recoverFile() for every dest~ in /
+  File root = fs.open("/");
+  String name;
+  String pending[8];
+  int n, i;
+  if(!root || !root.isDirectory()) return;
+  // gathered first, as renaming while walking could skip or repeat names
+  n = 0;
+  for(File f=root.openNextFile(); f && n<8; f=root.openNextFile()) {
+    name = f.name();
+    f.close();
+    if(name.endsWith("~")) pending[n++] = name.substring(0, name.length()-1);
+  }
+  root.close();
+  for(i=0; i<n; i++) {
+    if(recoverFile(fs, pending[i].c_str())) Serial.printf("Recovered [%s]\n", pending[i].c_str());
+  }
+}
+bool tmpNameFits(const char* dest) {
+  // whether dest.tmp and dest~ are short enough names for the filesystem
+  return addSlash(dest).length()+4 <= TMSH_MAX_PATH;
+}
+uint32_t crc32Update(uint32_t crc, const uint8_t* data, size_t len) {
+  // Standard (zlib) CRC-32, a nibble at a time to keep the table small.
+  // Start with crc=0; feed the result back in to continue.
+  static const uint32_t nibbleTable[16] = {
+    0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+    0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+  };
+  crc = ~crc;
+  while(len--) {
+    crc ^= *data++;
+    crc = (crc>>4) ^ nibbleTable[crc&0x0f];
+    crc = (crc>>4) ^ nibbleTable[crc&0x0f];
+  }
+  return ~crc;
+}
+long httpGetFile(fs::FS &fs, const String& url, const char* localFn, uint32_t* crc) {
+  // GET url into localFn (replacing it), with the CRC-32 of what arrived in *crc.
+  // Returns the bytes received, or -1 if the request failed, came up short, or
+  // couldn't be written.
+  HTTPClient http;
+  WiFiClient client;
+  uint8_t buf[256];
+  long len, got;
+  int n;
+  unsigned long lastData;
+  if(!http.begin(client, url)) return -1;
+  http.useHTTP10(true);   // no chunked replies
+  if(http.GET()!=HTTP_CODE_OK) { http.end(); return -1; }
+  File f = fs.open(addSlash(localFn).c_str(), FILE_WRITE);
+  if(!f) { http.end(); return -1; }
+  len = http.getSize();   // -1 if the server didn't say
+  WiFiClient* s = http.getStreamPtr();
+  got = 0;
+  *crc = 0;
+  lastData = millis();
+  while(len<0 || got<len) {
+    if((n=s->available())<=0) {
+      if(!s->connected() || millis()-lastData>HTTP_TIMEOUT) break;
+      delay(1);
+      continue;
+    }
+    if((n=s->read(buf, n<(int)sizeof(buf) ? n : sizeof(buf)))<=0) continue;
+    if(f.write(buf, n)!=(size_t)n) { got = -1; break; }
+    *crc = crc32Update(*crc, buf, n);
+    got += n;
+    lastData = millis();
+  }
+  f.close();
+  http.end();
+  return len>=0 && got!=len ? -1 : got;
+}
+bool getFromWeb(fs::FS &fs, const String IP, const String remoteFn, const String localFn) {
+  // Fetch http://IP/remoteFn into localFn.  It goes to a temp file first, so a failed
+  // fetch leaves localFn as it was.
+  String tmp = addSlash(localFn.c_str()) + ".tmp";
+  uint32_t crc;
+  if(!tmpNameFits(localFn.c_str())) return false;
+  if(httpGetFile(fs, "http://" + IP + addSlash(remoteFn.c_str()), tmp.c_str(), &crc)<0
+    || !replaceFile(fs, tmp.c_str(), localFn.c_str())) {
+    fs.remove(tmp.c_str());
+    return false;
+  }
+  return true;
+}
 void format(fs::FS &fs, const char* dirName) {
   // just rm everything on fs
   File root = fs.open(dirName);
@@ -14,8 +14,9 @@
 #endif
 
 #if defined(ARDUINO_ARCH_ESP8266) || defined(ARDUINO_ARCH_ESP32)
-void ls(fs::FS &fs, const char* dirName, int levels);
-void cat(fs::FS &fs, const char* path);
+#define TMSH_MAX_PATH 31	// SPIFFS's longest name, with its /
+void ls(fs::FS &fs, const char* dirName, int levels, Print& out=Serial);
+void cat(fs::FS &fs, const char* path, Print& out=Serial);
 void echoTo(fs::FS &fs, const char* path, const char* content);
 void appendTo(fs::FS &fs, const char* path, const char* content);
 void mv(fs::FS &fs, const char* old, const char* newf);
@@ -23,7 +24,13 @@ void rm(fs::FS &fs, const char* path);
 void cp(fs::FS &fs, const char* old, const char* newf);
 void format(fs::FS &fs, const char* dirName);
 void appendFile(fs::FS &fs, const char* old, const char* newf);
-void getFromWeb(fs::FS &fs, const String IP, const String remoteFn, const String localFn);
+bool replaceFile(fs::FS &fs, const char* tmp, const char* dest);
+bool recoverFile(fs::FS &fs, const char* dest);
+void recoverFiles(fs::FS &fs);
+bool tmpNameFits(const char* dest);
+uint32_t crc32Update(uint32_t crc, const uint8_t* data, size_t len);
+long httpGetFile(fs::FS &fs, const String& url, const char* localFn, uint32_t* crc);
+bool getFromWeb(fs::FS &fs, const String IP, const String remoteFn, const String localFn);
 void putToWeb(fs::FS &fs, const String IP, const String localFn, const String remoteFn);
 bool otaReflash(String ip, String fn);
 #endif // ESP32 arch